@@ -0,0 +1,53 @@
+#ifndef BATCH_BATCH_CHAIN_H
+#define BATCH_BATCH_CHAIN_H
+
+#include "operation_chain.h"
+
+#include <opencv2/core.hpp>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One of the image_processing filter functions, at a fixed level, as an
+// operation. They take colour or grey images.
+class FilterOperation: public ImageOperation {
+public:
+    typedef void (*Filter)(double, const cv::Mat&, cv::Mat&);
+    FilterOperation(Filter filter, double level): filter(filter), level(level) {}
+    void apply(const cv::Mat &image){ filter(level, image, output); }
+private:
+    Filter filter;
+    double level;
+};
+
+// The operations given on the command line, eg: "median:0.2,canny:2",
+// in an OperationChain. Each one is name:parameter, where the parameter
+// is sigma for the simple operations and the 0 to 1 slider level for the
+// filters.
+//
+// Frames are BGR. The simple operations want grey images, so a conversion
+// is put in before the first of them.
+//
+// The operations keep buffers between calls, so each thread needs its own
+// chain.
+class BatchChain {
+public:
+    void apply(const cv::Mat &image, cv::Mat &result);
+    const std::string &describe()const{ return description; }
+
+private:
+    friend std::unique_ptr<BatchChain> parseBatchChain(const std::string &spec);
+    BatchChain();
+
+    std::vector<std::unique_ptr<ImageOperation>> operations;
+    OperationChain chain;
+    std::string description;
+};
+
+// Returns an empty pointer if the spec can't be parsed
+std::unique_ptr<BatchChain> parseBatchChain(const std::string &spec);
+// The operation names and what their parameter means
+void printBatchOperations(std::ostream &os);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef BATCH_WORK_POOL_H
+#define BATCH_WORK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own deque of tasks.
+//
+// submit() deals tasks out round robin. A worker takes from the front of
+// its own deque, and once that is empty takes from the back of the
+// others', so a worker which got cheap frames helps out the ones which got
+// expensive ones instead of sitting idle.
+//
+// Tasks are given the index of the worker running them, so they can use
+// per worker state (eg: operations, which keep their buffers between
+// calls) without locking.
+class WorkPool {
+public:
+    typedef std::function<void(int worker)> Task;
+
+    explicit WorkPool(int num_workers);
+    // Runs whatever is still queued, then joins the workers
+    ~WorkPool();
+
+    void submit(Task task);
+    // Waits until every task submitted so far has finished
+    void wait();
+
+    int size()const{ return (int)workers.size(); }
+    std::size_t get_executed()const{ return executed.load(); }
+    // Tasks run by a worker other than the one they were given to
+    std::size_t get_stolen()const{ return stolen.load(); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void run(int worker);
+    bool take(int worker, Task &task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::size_t next_queue;
+
+    // Workers with nothing to do sleep here
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable all_done;
+    std::size_t queued;   // Submitted and not yet taken
+    std::size_t pending;  // Submitted and not yet finished
+    bool stopping;
+
+    std::atomic<std::size_t> executed;
+    std::atomic<std::size_t> stolen;
+};
+
+#endif
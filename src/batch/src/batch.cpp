@@ -0,0 +1,351 @@
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+#include <opencv2/core/utils/filesystem.hpp>
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch_chain.h"
+#include "bounded_ring.h"
+#include "work_pool.h"
+
+// A video file, or a single image, and where its result goes
+struct BatchJob {
+    std::string input;
+    std::string output;
+    bool video;
+    double fps;
+};
+
+struct BatchFrame {
+    cv::Mat frame;
+    cv::Mat result;
+    std::vector<uchar> encoded; // Image outputs, encoded by the worker
+    int job;
+    std::size_t sequence;       // Across every job, the order they are written in
+};
+
+struct BatchStats {
+    std::size_t frames;
+    double seconds;
+    std::size_t stolen;
+    std::size_t max_waiting; // Most frames finished and waiting for an earlier one
+    std::size_t failed_writes;
+};
+
+static double secondsSince(int64 start) {
+    return (cv::getTickCount() - start)/cv::getTickFrequency();
+}
+
+static std::string lower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+static std::string extension(const std::string &path) {
+    std::size_t dot = path.find_last_of('.');
+    std::size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return "";
+    return lower(path.substr(dot));
+}
+
+static std::string baseName(const std::string &path) {
+    std::size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static bool isImage(const std::string &ext) {
+    for (const char *known: { ".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".ppm",
+                              ".pgm", ".webp" }) {
+        if (ext == known) return true;
+    }
+    return false;
+}
+
+static bool isVideo(const std::string &ext) {
+    for (const char *known: { ".avi", ".mp4", ".mov", ".mkv", ".mpg", ".mpeg", ".wmv" }) {
+        if (ext == known) return true;
+    }
+    return false;
+}
+
+// Input is a file, a directory or a glob. Files which are neither images
+// nor videos are skipped.
+static std::vector<BatchJob> findJobs(const std::string &input, const std::string &output_dir) {
+    std::vector<cv::String> files;
+    cv::glob(input, files, false);
+    std::sort(files.begin(), files.end());
+    std::vector<BatchJob> jobs;
+    for (const cv::String &file: files) {
+        std::string ext = extension(file);
+        BatchJob job;
+        job.input = file;
+        job.video = isVideo(ext);
+        job.fps = 0;
+        if (job.video) {
+            std::string name = baseName(file);
+            job.output = output_dir + "/" + name.substr(0, name.size() - ext.size()) + ".avi";
+            cv::VideoCapture video(file);
+            if (!video.isOpened()) {
+                std::cout << "Could not open " << file << ", skipping it" << std::endl;
+                continue;
+            }
+            job.fps = video.get(cv::CAP_PROP_FPS);
+            if (job.fps <= 0) job.fps = 25;
+        } else if (isImage(ext)) {
+            job.output = output_dir + "/" + baseName(file);
+        } else {
+            continue;
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+// Decodes on one thread, runs the chain on the frames in parallel on the
+// pool, and writes the results in their original order on another thread.
+//
+//   decode thread -> [ring] -> calling thread (submits) -> pool workers
+//       -> [finished frames, by sequence] -> write thread
+//
+// At most queue_size frames are between being submitted and written, on
+// top of the ring, so memory doesn't grow when writing falls behind.
+// Image results are encoded by the workers, since each one is separate.
+// Video frames have to go through the VideoWriter one at a time, so the
+// write thread encodes those.
+static BatchStats runBatch(const std::vector<BatchJob> &jobs, const std::string &chain_spec,
+                           int workers, std::size_t queue_size, bool write, int fourcc)
+{
+    std::vector<std::unique_ptr<BatchChain>> chains;
+    for (int i = 0; i < workers; i++) {
+        chains.push_back(parseBatchChain(chain_spec));
+    }
+    BoundedRing<BatchFrame> decoded(queue_size, BoundedRing<BatchFrame>::BLOCK);
+
+    std::mutex mutex;
+    std::condition_variable frame_finished, frame_written;
+    std::map<std::size_t, std::shared_ptr<BatchFrame>> finished;
+    std::size_t in_flight = 0, submitted = 0;
+    bool all_submitted = false;
+    BatchStats stats = BatchStats();
+
+    int64 start = cv::getTickCount();
+    std::thread decode_thread([&]() {
+        BatchFrame slot;
+        std::size_t sequence = 0;
+        for (std::size_t j = 0; j < jobs.size(); j++) {
+            slot.job = (int)j;
+            if (jobs[j].video) {
+                cv::VideoCapture video(jobs[j].input);
+                while (video.read(slot.frame)) {
+                    slot.sequence = sequence++;
+                    if (!decoded.push(slot)) return;
+                }
+            } else {
+                slot.frame = cv::imread(jobs[j].input, cv::IMREAD_COLOR);
+                if (slot.frame.empty()) {
+                    std::cout << "Could not read " << jobs[j].input << std::endl;
+                    continue;
+                }
+                slot.sequence = sequence++;
+                if (!decoded.push(slot)) return;
+            }
+        }
+        decoded.close();
+    });
+
+    std::thread write_thread([&]() {
+        cv::VideoWriter writer;
+        int writer_job = -1;
+        std::size_t next = 0;
+        for (;;) {
+            std::shared_ptr<BatchFrame> frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                frame_finished.wait(lock, [&]() {
+                    return finished.count(next) || (all_submitted && next == submitted);
+                });
+                if (!finished.count(next)) break;
+                stats.max_waiting = std::max(stats.max_waiting, finished.size());
+                frame = finished[next];
+                finished.erase(next);
+            }
+            const BatchJob &job = jobs[frame->job];
+            bool ok = true;
+            if (write && job.video) {
+                if (writer_job != frame->job) {
+                    writer.release();
+                    writer.open(job.output, fourcc, job.fps, frame->result.size(),
+                                frame->result.channels() > 1);
+                    writer_job = frame->job;
+                }
+                ok = writer.isOpened();
+                if (ok) writer.write(frame->result);
+            } else if (write) {
+                std::ofstream file(job.output, std::ios::binary);
+                file.write((const char*)frame->encoded.data(), frame->encoded.size());
+                ok = !frame->encoded.empty() && (bool)file;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!ok) stats.failed_writes++;
+                in_flight--;
+                next++;
+            }
+            frame_written.notify_one();
+        }
+    });
+
+    {
+        WorkPool pool(workers);
+        BatchFrame slot;
+        while (decoded.pop(slot)) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                frame_written.wait(lock, [&]() { return in_flight < queue_size; });
+                in_flight++;
+                submitted++;
+            }
+            std::shared_ptr<BatchFrame> frame = std::make_shared<BatchFrame>();
+            std::swap(*frame, slot);
+            pool.submit([&, frame](int worker) {
+                chains[worker]->apply(frame->frame, frame->result);
+                frame->frame.release();
+                const BatchJob &job = jobs[frame->job];
+                if (write && !job.video) {
+                    cv::imencode(extension(job.output), frame->result, frame->encoded);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished[frame->sequence] = frame;
+                }
+                frame_finished.notify_one();
+            });
+        }
+        pool.wait();
+        stats.stolen = pool.get_stolen();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        all_submitted = true;
+    }
+    frame_finished.notify_one();
+    write_thread.join();
+    decode_thread.join();
+
+    stats.frames = submitted;
+    stats.seconds = secondsSince(start);
+    return stats;
+}
+
+// Frames per second of the decode thread on its own, which is as fast as
+// the batch can go however many workers there are
+static double decodeRate(const std::vector<BatchJob> &jobs) {
+    std::size_t frames = 0;
+    cv::Mat frame;
+    int64 start = cv::getTickCount();
+    for (const BatchJob &job: jobs) {
+        if (job.video) {
+            cv::VideoCapture video(job.input);
+            while (video.read(frame)) frames++;
+        } else {
+            frame = cv::imread(job.input, cv::IMREAD_COLOR);
+            if (!frame.empty()) frames++;
+        }
+    }
+    return frames/secondsSince(start);
+}
+
+static void reportStats(const BatchStats &stats, int workers) {
+    std::cout << workers << " workers: " << stats.frames << " frames in " << stats.seconds
+              << " s, " << stats.frames/stats.seconds << " fps, " << stats.stolen
+              << " stolen, up to " << stats.max_waiting << " waiting to be written in order"
+              << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    cv::CommandLineParser parser(argc, argv,
+        "{help h||}"
+        "{@input|data/*.jpg|video file, image, directory, or a glob of them}"
+        "{chain|smooth:1.5,canny:2|comma separated name:parameter operations, see --list}"
+        "{output|batch_output|directory to write the results to}"
+        "{threads|0|workers, 0 for one per CPU}"
+        "{inner_threads|1|threads OpenCV may use inside each frame, 0 for its default}"
+        "{queue|0|frames decoded ahead or waiting to be written, 0 for 4 per worker}"
+        "{codec|MJPG|fourcc of the output videos}"
+        "{scaling||time 1, 2, 4... workers up to --threads without writing anything}"
+        "{list||list the operations and exit}");
+    if (parser.has("help")) {
+        parser.printMessage();
+        printBatchOperations(std::cout);
+        return 0;
+    }
+    if (parser.has("list")) {
+        printBatchOperations(std::cout);
+        return 0;
+    }
+
+    std::string chain_spec = parser.get<std::string>("chain");
+    std::unique_ptr<BatchChain> chain = parseBatchChain(chain_spec);
+    if (!chain) {
+        std::cout << "Bad chain " << chain_spec << std::endl;
+        printBatchOperations(std::cout);
+        return 1;
+    }
+    std::string output_dir = parser.get<std::string>("output");
+    std::vector<BatchJob> jobs = findJobs(parser.get<std::string>("@input"), output_dir);
+    if (jobs.empty()) {
+        std::cout << "No images or videos match " << parser.get<std::string>("@input")
+                  << std::endl;
+        return 1;
+    }
+    int threads = parser.get<int>("threads");
+    if (threads <= 0) threads = cv::getNumberOfCPUs();
+    std::size_t queue_size = parser.get<int>("queue") > 0 ? parser.get<int>("queue") : 4*threads;
+    std::string codec = parser.get<std::string>("codec") + "    ";
+    int fourcc = cv::VideoWriter::fourcc(codec[0], codec[1], codec[2], codec[3]);
+
+    // Frames are the unit of parallelism. OpenCV's own threads inside each
+    // frame would only compete with the workers for the same cores.
+    int inner_threads = parser.get<int>("inner_threads");
+    cv::setNumThreads(inner_threads > 0 ? inner_threads : -1);
+
+    std::cout << jobs.size() << " inputs, " << chain->describe() << std::endl;
+    if (parser.has("scaling")) {
+        std::cout << "Decoding alone: " << decodeRate(jobs) << " fps" << std::endl;
+        double one_worker_fps = 0;
+        for (int workers = 1; ; workers = std::min(2*workers, threads)) {
+            BatchStats stats = runBatch(jobs, chain_spec, workers,
+                std::max<std::size_t>(queue_size, 4*workers), false, fourcc);
+            double fps = stats.frames/stats.seconds;
+            if (workers == 1) one_worker_fps = fps;
+            reportStats(stats, workers);
+            std::cout << "  " << fps/one_worker_fps << "x one worker, "
+                      << 100*fps/(one_worker_fps*workers) << "% efficiency" << std::endl;
+            if (workers == threads) break;
+        }
+        return 0;
+    }
+
+    if (!cv::utils::fs::createDirectories(output_dir)) {
+        std::cout << "Could not create " << output_dir << std::endl;
+        return 1;
+    }
+    BatchStats stats = runBatch(jobs, chain_spec, threads, queue_size, true, fourcc);
+    reportStats(stats, threads);
+    if (stats.failed_writes > 0) {
+        std::cout << stats.failed_writes << " frames could not be written to " << output_dir
+                  << std::endl;
+        return 1;
+    }
+    return 0;
+}
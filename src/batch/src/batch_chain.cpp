@@ -0,0 +1,101 @@
+#include "batch_chain.h"
+
+#include <opencv2/imgproc.hpp>
+#include <cstdlib>
+#include <sstream>
+
+#include "edge_operations.h"
+#include "filters.h"
+#include "row_operations.h"
+
+struct OperationName {
+    const char *name;
+    FilterOperation::Filter filter; // Null for the simple operations
+    const char *parameter;
+};
+
+static const OperationName operation_names[] = {
+    { "smooth", 0, "sigma" },
+    { "canny", 0, "sigma" },
+    { "marr", 0, "sigma" },
+    { "blur", applyHomogeneousBlur, "level" },
+    { "gaussian", applyGaussianBlur, "level" },
+    { "median", applyMedianBlur, "level" },
+    { "median_o1", applyMedianO1, "level" },
+    { "bilateral", applyBilateralBlur, "level" },
+    { "bilateral_grid", applyBilateralGrid, "level" },
+    { "erode", applyErosion, "level" },
+    { "dilate", applyDilation, "level" },
+    { "open", applyOpening, "level" },
+    { "close", applyClosing, "level" },
+    { "gradient", applyMorphGradient, "level" },
+};
+
+BatchChain::BatchChain():
+    chain(32)
+{
+}
+
+void BatchChain::apply(const cv::Mat &image, cv::Mat &result) {
+    chain.apply(image);
+    // Copied out, the chain's output is overwritten by the next frame
+    chain.get_output().copyTo(result);
+}
+
+static ImageOperation *createOperation(const OperationName &name, double parameter) {
+    if (name.filter) {
+        if (parameter < 0 || parameter > 1) return 0;
+        return new FilterOperation(name.filter, parameter);
+    }
+    if (parameter <= 0) return 0;
+    std::string n = name.name;
+    if (n == "smooth") return new SmoothOperation(gaussian_ksize(parameter), parameter);
+    if (n == "canny") return new CannyEdgeDetectorCustom(gaussian_ksize(parameter), parameter);
+    return new MarrHildrethDetectorCustom(gaussian_ksize(parameter), parameter);
+}
+
+std::unique_ptr<BatchChain> parseBatchChain(const std::string &spec) {
+    std::unique_ptr<BatchChain> batch_chain(new BatchChain());
+    bool gray = false;
+    std::stringstream stream(spec);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty()) continue;
+        std::size_t colon = item.find(':');
+        if (colon == std::string::npos) return std::unique_ptr<BatchChain>();
+        std::string name = item.substr(0, colon);
+        std::string value = item.substr(colon + 1);
+        char *end = 0;
+        double parameter = std::strtod(value.c_str(), &end);
+        if (value.empty() || *end != 0) return std::unique_ptr<BatchChain>();
+
+        const OperationName *found = 0;
+        for (const OperationName &candidate: operation_names) {
+            if (name == candidate.name) found = &candidate;
+        }
+        if (!found) return std::unique_ptr<BatchChain>();
+        if (!found->filter && !gray) {
+            ImageOperation *to_gray = new ColorConvertOperation(cv::COLOR_BGR2GRAY, CV_8UC1);
+            batch_chain->operations.emplace_back(to_gray);
+            batch_chain->chain.add(*to_gray);
+            gray = true;
+        }
+        ImageOperation *operation = createOperation(*found, parameter);
+        if (!operation) return std::unique_ptr<BatchChain>();
+        batch_chain->operations.emplace_back(operation);
+        batch_chain->chain.add(*operation);
+
+        if (!batch_chain->description.empty()) batch_chain->description += " -> ";
+        batch_chain->description += name + "(" + found->parameter + "=" + value + ")";
+    }
+    if (batch_chain->operations.empty()) return std::unique_ptr<BatchChain>();
+    return batch_chain;
+}
+
+void printBatchOperations(std::ostream &os) {
+    os << "Operations, as name:parameter:" << std::endl;
+    for (const OperationName &name: operation_names) {
+        os << "  " << name.name << ":" << name.parameter
+           << (name.filter ? " (0 to 1)" : "") << std::endl;
+    }
+}
@@ -0,0 +1,101 @@
+#include "work_pool.h"
+
+WorkPool::WorkPool(int num_workers):
+    next_queue(0), queued(0), pending(0), stopping(false), executed(0), stolen(0)
+{
+    if (num_workers < 1) num_workers = 1;
+    for (int i = 0; i < num_workers; i++) {
+        queues.emplace_back(new Queue());
+    }
+    for (int i = 0; i < num_workers; i++) {
+        workers.emplace_back(&WorkPool::run, this, i);
+    }
+}
+
+WorkPool::~WorkPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (std::thread &worker: workers) {
+        worker.join();
+    }
+}
+
+void WorkPool::submit(Task task) {
+    std::size_t q;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        q = next_queue;
+        next_queue = (next_queue + 1) % queues.size();
+        pending++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[q]->mutex);
+        queues[q]->tasks.push_back(std::move(task));
+    }
+    {
+        // Counted only once the task can be found, so a worker woken for it
+        // never comes back empty handed and goes to sleep with work queued
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+    }
+    work_available.notify_one();
+}
+
+void WorkPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    all_done.wait(lock, [this]() { return pending == 0; });
+}
+
+bool WorkPool::take(int worker, Task &task) {
+    {
+        Queue &own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            // Oldest first, the encoder writes frames in order
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    for (std::size_t i = 1; i < queues.size(); i++) {
+        Queue &other = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty()) {
+            // From the other end to its owner
+            task = std::move(other.tasks.back());
+            other.tasks.pop_back();
+            stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkPool::run(int worker) {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_available.wait(lock, [this]() { return queued > 0 || stopping; });
+            if (queued == 0) return;
+            // Claimed before searching, so there is always a task to find
+            queued--;
+        }
+        Task task;
+        while (!take(worker, task)) {
+            // Missed it while other workers were taking theirs
+            std::this_thread::yield();
+        }
+        task(worker);
+        executed++;
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = --pending == 0;
+        }
+        if (finished) all_done.notify_all();
+    }
+}
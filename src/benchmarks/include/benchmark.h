@@ -0,0 +1,44 @@
+#ifndef BENCHMARKS_BENCHMARK_H
+#define BENCHMARKS_BENCHMARK_H
+
+#include <opencv2/core.hpp>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct BenchmarkSettings {
+    int warmup;         // Untimed calls first, to fill caches and buffers
+    int min_repeats;
+    int max_repeats;
+    double max_seconds; // Stop repeating after this long, once past min_repeats
+};
+
+struct BenchmarkResult {
+    std::string name;
+    std::string image;
+    cv::Size size;
+    int threads;
+    int repeats;
+    double min_ms, median_ms, mean_ms, stddev_ms;
+
+    // Identifies the same measurement in another run
+    std::string key()const;
+};
+
+// Calls run settings.warmup times, then times each call until the repeat
+// or time limits are reached. Only the statistics are filled in.
+BenchmarkResult timeBenchmark(const std::function<void()> &run, const BenchmarkSettings &settings);
+
+// Results are stored as JSON (through cv::FileStorage), along with the
+// OpenCV version and number of CPUs they were measured with
+void writeResults(const std::string &path, const std::vector<BenchmarkResult> &results);
+std::vector<BenchmarkResult> readResults(const std::string &path);
+
+// Prints how the median time of each result compares with the same
+// measurement in baseline. Returns how many are slower by more than
+// tolerance (eg: 0.1 for 10%).
+int compareResults(std::ostream &os, const std::vector<BenchmarkResult> &results,
+                   const std::vector<BenchmarkResult> &baseline, double tolerance);
+
+#endif
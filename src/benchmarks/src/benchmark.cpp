@@ -0,0 +1,124 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+std::string BenchmarkResult::key()const {
+    return name + "|" + image + "|" + std::to_string(size.width) + "x" +
+        std::to_string(size.height) + "|" + std::to_string(threads);
+}
+
+BenchmarkResult timeBenchmark(const std::function<void()> &run, const BenchmarkSettings &settings) {
+    for (int k = 0; k < settings.warmup; k++) {
+        run();
+    }
+    std::vector<double> times_ms;
+    const int64 max_ticks = (int64)(settings.max_seconds*cv::getTickFrequency());
+    const int64 first = cv::getTickCount();
+    while ((int)times_ms.size() < settings.max_repeats) {
+        int64 start = cv::getTickCount();
+        run();
+        int64 end = cv::getTickCount();
+        times_ms.push_back(1000.0*(end - start)/cv::getTickFrequency());
+        if ((int)times_ms.size() >= settings.min_repeats && end - first > max_ticks) break;
+    }
+
+    BenchmarkResult result;
+    result.threads = 0;
+    result.repeats = (int)times_ms.size();
+    std::sort(times_ms.begin(), times_ms.end());
+    result.min_ms = times_ms.front();
+    std::size_t n = times_ms.size();
+    result.median_ms = n % 2 ? times_ms[n/2] : (times_ms[n/2 - 1] + times_ms[n/2])/2;
+    double sum = 0, sum_sq = 0;
+    for (double t: times_ms) {
+        sum += t;
+        sum_sq += t*t;
+    }
+    result.mean_ms = sum/n;
+    result.stddev_ms = std::sqrt(std::max(0.0, sum_sq/n - result.mean_ms*result.mean_ms));
+    return result;
+}
+
+void writeResults(const std::string &path, const std::vector<BenchmarkResult> &results) {
+    cv::FileStorage fs(path, cv::FileStorage::WRITE | cv::FileStorage::FORMAT_JSON);
+    if (!fs.isOpened()) {
+        CV_Error(cv::Error::StsError, "Could not open " + path + " for writing");
+    }
+    fs << "opencv_version" << CV_VERSION;
+    fs << "cpus" << cv::getNumberOfCPUs();
+    fs << "results" << "[";
+    for (const BenchmarkResult &result: results) {
+        fs << "{"
+           << "name" << result.name
+           << "image" << result.image
+           << "width" << result.size.width
+           << "height" << result.size.height
+           << "threads" << result.threads
+           << "repeats" << result.repeats
+           << "min_ms" << result.min_ms
+           << "median_ms" << result.median_ms
+           << "mean_ms" << result.mean_ms
+           << "stddev_ms" << result.stddev_ms
+           << "}";
+    }
+    fs << "]";
+}
+
+std::vector<BenchmarkResult> readResults(const std::string &path) {
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        CV_Error(cv::Error::StsError, "Could not open " + path);
+    }
+    std::vector<BenchmarkResult> results;
+    cv::FileNode list = fs["results"];
+    for (cv::FileNodeIterator it = list.begin(); it != list.end(); ++it) {
+        const cv::FileNode &node = *it;
+        BenchmarkResult result;
+        node["name"] >> result.name;
+        node["image"] >> result.image;
+        node["width"] >> result.size.width;
+        node["height"] >> result.size.height;
+        node["threads"] >> result.threads;
+        node["repeats"] >> result.repeats;
+        node["min_ms"] >> result.min_ms;
+        node["median_ms"] >> result.median_ms;
+        node["mean_ms"] >> result.mean_ms;
+        node["stddev_ms"] >> result.stddev_ms;
+        results.push_back(result);
+    }
+    return results;
+}
+
+int compareResults(std::ostream &os, const std::vector<BenchmarkResult> &results,
+                   const std::vector<BenchmarkResult> &baseline, double tolerance) {
+    std::map<std::string, const BenchmarkResult*> previous;
+    for (const BenchmarkResult &result: baseline) {
+        previous[result.key()] = &result;
+    }
+    int regressions = 0, improvements = 0, missing = 0;
+    for (const BenchmarkResult &result: results) {
+        auto found = previous.find(result.key());
+        if (found == previous.end()) {
+            missing++;
+            continue;
+        }
+        double ratio = result.median_ms/found->second->median_ms;
+        const char *verdict = "";
+        if (ratio > 1 + tolerance) {
+            verdict = "  REGRESSION";
+            regressions++;
+        } else if (ratio < 1 - tolerance) {
+            verdict = "  improved";
+            improvements++;
+        }
+        os << result.key() << ": " << found->second->median_ms << " -> "
+           << result.median_ms << " ms (" << ratio << "x)" << verdict << std::endl;
+    }
+    os << regressions << " regression(s), " << improvements << " improvement(s) beyond "
+       << 100*tolerance << "%";
+    if (missing > 0) os << ", " << missing << " not in the baseline";
+    os << std::endl;
+    return regressions;
+}
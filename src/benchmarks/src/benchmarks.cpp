@@ -0,0 +1,250 @@
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "edge_operations.h"
+#include "filters.h"
+#include "morphology.h"
+#include "row_operations.h"
+#include "square_difference.h"
+
+struct Benchmark {
+    std::string name;
+    bool color; // Takes the BGR image, otherwise the grey one
+    std::function<void(const cv::Mat &input)> run;
+};
+
+static std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+static void operationBenchmark(std::vector<Benchmark> &benchmarks,
+        const std::string &name, ImageOperation *operation) {
+    std::shared_ptr<ImageOperation> shared(operation);
+    benchmarks.push_back({ name, false, [shared](const cv::Mat &gray) {
+        shared->apply(gray);
+    }});
+}
+
+static void filterBenchmark(std::vector<Benchmark> &benchmarks, const std::string &name,
+        void (*filter)(double, const cv::Mat&, cv::Mat&), double level) {
+    std::shared_ptr<cv::Mat> output = std::make_shared<cv::Mat>();
+    benchmarks.push_back({ name + "(level=" + cv::format("%g", level) + ")", true,
+        [=](const cv::Mat &image) {
+            filter(level, image, *output);
+        }});
+}
+
+// applyErosion and applyDilation reuse their last result when called again
+// with an identical image, as they are from the slider. Each run gets the
+// image with its first pixel changed, so the erosion itself is timed. The
+// copy is only made when the image changes.
+static void morphologyBenchmark(std::vector<Benchmark> &benchmarks, const std::string &name,
+        void (*filter)(double, const cv::Mat&, cv::Mat&), double level) {
+    struct State {
+        cv::Mat frame, output;
+        const uchar *source;
+        int runs;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->source = nullptr;
+    state->runs = 0;
+    benchmarks.push_back({ name + "(level=" + cv::format("%g", level) + ")", true,
+        [=](const cv::Mat &image) {
+            if (state->source != image.data || state->frame.size() != image.size() ||
+                    state->frame.type() != image.type()) {
+                image.copyTo(state->frame);
+                state->source = image.data;
+            }
+            state->frame.ptr<uchar>(0)[0] = (uchar)++state->runs;
+            filter(level, state->frame, state->output);
+        }});
+}
+
+static std::vector<Benchmark> allBenchmarks() {
+    std::vector<Benchmark> benchmarks;
+
+    for (double sigma: { 1.0, 3.0 }) {
+        operationBenchmark(benchmarks, cv::format("SmoothOperation(sigma=%g)", sigma),
+                           new SmoothOperation(gaussian_ksize(sigma), sigma));
+    }
+    for (double sigma: { 1.0, 3.0, 7.0 }) {
+        operationBenchmark(benchmarks, cv::format("CannyEdgeDetectorCustom(sigma=%g)", sigma),
+                           new CannyEdgeDetectorCustom(gaussian_ksize(sigma), sigma));
+    }
+    for (double sigma: { 2.0, 4.0 }) {
+        operationBenchmark(benchmarks, cv::format("MarrHildrethDetectorCustom(sigma=%g)", sigma),
+                           new MarrHildrethDetectorCustom(gaussian_ksize(sigma), sigma));
+    }
+    operationBenchmark(benchmarks, "GaussianBlurOperation(ksize=5)", new GaussianBlurOperation(5, 1));
+    operationBenchmark(benchmarks, "Filter2DOperation(3x3)",
+                       new Filter2DOperation((cv::Mat_<char>(3,3) << -1,-1,-1, -1,8,-1, -1,-1,-1)));
+    operationBenchmark(benchmarks, "SobelMagnitudeOperation", new SobelMagnitudeOperation());
+    operationBenchmark(benchmarks, "NormalizeOperation", new NormalizeOperation());
+    operationBenchmark(benchmarks, "MirrorOperation", new MirrorOperation());
+    std::shared_ptr<ImageOperation> to_gray(new ColorConvertOperation(cv::COLOR_BGR2GRAY, CV_8UC1));
+    benchmarks.push_back({ "ColorConvertOperation(BGR2GRAY)", true, [to_gray](const cv::Mat &image) {
+        to_gray->apply(image);
+    }});
+
+    // The slider's filter functions, at a quarter and all the way up, with
+    // RectMorphology also timed on its own
+    for (double level: { 0.25, 1.0 }) {
+        filterBenchmark(benchmarks, "applyHomogeneousBlur", applyHomogeneousBlur, level);
+        filterBenchmark(benchmarks, "applyGaussianBlur", applyGaussianBlur, level);
+        filterBenchmark(benchmarks, "applyMedianBlur", applyMedianBlur, level);
+        filterBenchmark(benchmarks, "applyMedianO1", applyMedianO1, level);
+        filterBenchmark(benchmarks, "applyBilateralBlur", applyBilateralBlur, level);
+        filterBenchmark(benchmarks, "applyBilateralGrid", applyBilateralGrid, level);
+        morphologyBenchmark(benchmarks, "applyErosion", applyErosion, level);
+        morphologyBenchmark(benchmarks, "applyDilation", applyDilation, level);
+        filterBenchmark(benchmarks, "applyOpening", applyOpening, level);
+        filterBenchmark(benchmarks, "applyClosing", applyClosing, level);
+        filterBenchmark(benchmarks, "applyMorphGradient", applyMorphGradient, level);
+    }
+    for (int radius: { 1, 15 }) {
+        std::shared_ptr<RectMorphology> morphology = std::make_shared<RectMorphology>();
+        std::shared_ptr<cv::Mat> output = std::make_shared<cv::Mat>();
+        benchmarks.push_back({ cv::format("RectMorphology::erode(radius=%d)", radius), true,
+            [=](const cv::Mat &image) {
+                morphology->erode(image, *output, cv::Size(radius, radius));
+            }});
+    }
+
+    // Uniform, separable and general windows take different paths
+    cv::Mat gaussian = cv::getGaussianKernel(7, 2, CV_32F);
+    cv::Mat random(5, 5, CV_32F);
+    cv::RNG rng(0);
+    rng.fill(random, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(1));
+    const std::pair<std::string, cv::Mat> windows[] = {
+        { "box 3x3", cv::Mat::ones(3, 3, CV_8U) },
+        { "box 15x15", cv::Mat::ones(15, 15, CV_8U) },
+        { "gaussian 7x7", gaussian*gaussian.t() },
+        { "random 5x5", random },
+    };
+    for (const auto &window: windows) {
+        std::shared_ptr<cv::Mat> output = std::make_shared<cv::Mat>();
+        cv::Mat weights = window.second;
+        benchmarks.push_back({ "weightedSquareDifference(" + window.first + ")", false,
+            [=](const cv::Mat &gray) {
+                weightedSquareDifference(gray, *output, weights, cv::Point(-1, -1), CV_32F);
+            }});
+    }
+    return benchmarks;
+}
+
+int main(int argc, char** argv)
+{
+    cv::CommandLineParser parser(argc, argv,
+        "{help h||}"
+        "{images|lena.jpg,baboon.jpg,fruits.jpg|comma separated images from data/, or a glob}"
+        "{sizes|640x480,1280x720,1920x1080|comma separated resolutions to rescale to}"
+        "{threads|1,0|comma separated thread counts, 0 for OpenCV's default}"
+        "{filter||only run benchmarks whose name contains this}"
+        "{list||list the benchmarks and exit}"
+        "{warmup|2|untimed runs before timing}"
+        "{min_repeats|5|timed runs, at least}"
+        "{max_repeats|50|timed runs, at most}"
+        "{max_seconds|1|stop repeating after this long, once past min_repeats}"
+        "{json||write the results to this file}"
+        "{baseline||compare against results written earlier with --json}"
+        "{tolerance|0.1|slowdown (as a fraction) counted as a regression}");
+    if (parser.has("help")) {
+        parser.printMessage();
+        return 0;
+    }
+    std::vector<Benchmark> benchmarks = allBenchmarks();
+    std::string filter = parser.get<std::string>("filter");
+    if (parser.has("list")) {
+        for (const Benchmark &benchmark: benchmarks) {
+            std::cout << benchmark.name << std::endl;
+        }
+        return 0;
+    }
+
+    BenchmarkSettings settings;
+    settings.warmup = parser.get<int>("warmup");
+    settings.min_repeats = std::max(1, parser.get<int>("min_repeats"));
+    settings.max_repeats = std::max(settings.min_repeats, parser.get<int>("max_repeats"));
+    settings.max_seconds = parser.get<double>("max_seconds");
+
+    cv::samples::addSamplesDataSearchPath("data");
+    std::vector<std::string> image_names;
+    std::string images = parser.get<std::string>("images");
+    if (images.find('*') != std::string::npos) {
+        cv::glob(images, image_names);
+    } else {
+        image_names = split(images);
+    }
+    std::vector<cv::Size> sizes;
+    for (const std::string &size: split(parser.get<std::string>("sizes"))) {
+        int width, height;
+        if (std::sscanf(size.c_str(), "%dx%d", &width, &height) != 2) {
+            std::cout << "Bad size " << size << std::endl;
+            return 1;
+        }
+        sizes.push_back(cv::Size(width, height));
+    }
+    std::vector<int> thread_counts;
+    for (const std::string &threads: split(parser.get<std::string>("threads"))) {
+        thread_counts.push_back(std::stoi(threads));
+    }
+
+    std::vector<BenchmarkResult> results;
+    for (const std::string &image_name: image_names) {
+        cv::Mat original = cv::imread(cv::samples::findFile(image_name));
+        if (original.empty()) {
+            std::cout << "Could not read " << image_name << std::endl;
+            return 1;
+        }
+        for (const cv::Size &size: sizes) {
+            cv::Mat color, gray;
+            cv::resize(original, color, size, 0, 0, cv::INTER_AREA);
+            cv::cvtColor(color, gray, cv::COLOR_BGR2GRAY);
+            for (int threads: thread_counts) {
+                // A negative count puts back OpenCV's default
+                cv::setNumThreads(threads > 0 ? threads : -1);
+                for (const Benchmark &benchmark: benchmarks) {
+                    if (benchmark.name.find(filter) == std::string::npos) continue;
+                    const cv::Mat &input = benchmark.color ? color : gray;
+                    BenchmarkResult result = timeBenchmark(
+                        [&]() { benchmark.run(input); }, settings);
+                    result.name = benchmark.name;
+                    result.image = image_name;
+                    result.size = size;
+                    result.threads = cv::getNumThreads();
+                    results.push_back(result);
+                    std::cout << result.key() << ": median " << result.median_ms
+                              << " ms, min " << result.min_ms << " ms, stddev "
+                              << result.stddev_ms << " ms (" << result.repeats << " runs)"
+                              << std::endl;
+                }
+            }
+        }
+    }
+    cv::setNumThreads(-1);
+
+    if (parser.has("json")) {
+        writeResults(parser.get<std::string>("json"), results);
+    }
+    if (parser.has("baseline")) {
+        std::vector<BenchmarkResult> baseline = readResults(parser.get<std::string>("baseline"));
+        int regressions = compareResults(std::cout, results, baseline,
+                                         parser.get<double>("tolerance"));
+        return regressions > 0 ? 2 : 0;
+    }
+    return 0;
+}
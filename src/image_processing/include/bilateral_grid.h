@@ -0,0 +1,22 @@
+#ifndef IMAGE_PROCESSING_BILATERAL_GRID_H
+#define IMAGE_PROCESSING_BILATERAL_GRID_H
+
+#include <opencv2/core.hpp>
+
+// Approximate bilateral filter using a bilateral grid (Paris and Durand).
+//
+// Pixels are accumulated into a coarse 3D grid over (x, y, intensity), the
+// grid is blurred with a small Gaussian, then each pixel reads its result
+// back out by trilinear interpolation. The grid has cells of
+// sampling*sigma_space pixels and sampling*sigma_color intensity levels, so
+// the blur is the same few taps whatever the sigmas, and the cost is about
+// constant per pixel however large sigma_space gets. Smaller sampling is
+// more accurate but slower, 1 is the usual choice.
+//
+// 8 bit images with 1 or 3 channels. Colour images use their luminance for
+// the intensity axis, rather than a distance in colour space like
+// cv::bilateralFilter.
+void bilateralGridFilter(const cv::Mat& src, cv::Mat& dst, double sigma_space,
+                         double sigma_color, double sampling = 1);
+
+#endif
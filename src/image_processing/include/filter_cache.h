@@ -0,0 +1,44 @@
+#ifndef IMAGE_PROCESSING_FILTER_CACHE_H
+#define IMAGE_PROCESSING_FILTER_CACHE_H
+
+#include <opencv2/core.hpp>
+#include <list>
+#include <map>
+#include <mutex>
+
+// Filtered images keyed by (filter function, slider value, source), with
+// the least recently used ones thrown away once the total size goes over
+// max_bytes. Safe to use from several threads.
+class FilterCache{
+public:
+    typedef void (*filterFunction_t)(double, const cv::Mat&, cv::Mat&);
+
+    explicit FilterCache(std::size_t max_bytes): max_bytes(max_bytes), total_bytes(0) {}
+
+    bool get(filterFunction_t filterFunction, int slider_value, const cv::Mat* src,
+             cv::Mat& result);
+    void put(filterFunction_t filterFunction, int slider_value, const cv::Mat* src,
+             const cv::Mat& result);
+    // Forget everything computed from src, eg: because it has changed
+    void invalidate(const cv::Mat* src);
+    std::size_t getBytes()const;
+
+private:
+    struct Key{
+        filterFunction_t filterFunction;
+        int slider_value;
+        const cv::Mat* src;
+        bool operator<(const Key& other)const;
+    };
+    typedef std::list<std::pair<Key, cv::Mat>> Entries;
+
+    void erase(Entries::iterator it);
+
+    Entries entries; // Most recently used first
+    std::map<Key, Entries::iterator> index;
+    const std::size_t max_bytes;
+    std::size_t total_bytes;
+    mutable std::mutex mutex;
+};
+
+#endif
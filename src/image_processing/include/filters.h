@@ -0,0 +1,25 @@
+#ifndef IMAGE_PROCESSING_FILTERS_H
+#define IMAGE_PROCESSING_FILTERS_H
+
+#include <opencv2/core.hpp>
+
+// Filter functions for TrackbarData. level goes from 0 to 1 and sets the
+// kernel size.
+
+void applyHomogeneousBlur(double level, const cv::Mat& src, cv::Mat& dst);
+void applyGaussianBlur(double level, const cv::Mat& src, cv::Mat& dst);
+void applyMedianBlur(double level, const cv::Mat& src, cv::Mat& dst);
+// Same result as applyMedianBlur, in about constant time per pixel
+void applyMedianO1(double level, const cv::Mat& src, cv::Mat& dst);
+void applyBilateralBlur(double level, const cv::Mat& src, cv::Mat& dst);
+// Same sigmas as applyBilateralBlur, approximated with a bilateral grid
+void applyBilateralGrid(double level, const cv::Mat& src, cv::Mat& dst);
+
+// Rectangular morphology, with a cost that doesn't depend on the size
+void applyErosion(double level, const cv::Mat& src, cv::Mat& dst);
+void applyDilation(double level, const cv::Mat& src, cv::Mat& dst);
+void applyOpening(double level, const cv::Mat& src, cv::Mat& dst);
+void applyClosing(double level, const cv::Mat& src, cv::Mat& dst);
+void applyMorphGradient(double level, const cv::Mat& src, cv::Mat& dst);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef IMAGE_PROCESSING_MEDIAN_H
+#define IMAGE_PROCESSING_MEDIAN_H
+
+#include <opencv2/core.hpp>
+
+// Median filter with a ksize x ksize window, giving the same result as
+// cv::medianBlur (replicated border), for 8 bit images with 1 or 3 channels.
+//
+// Uses Perreault and Hébert's constant time median. A histogram is kept
+// for each column of the window and updated by one pixel in and one out as
+// the window moves down. The window's histogram is then updated by one
+// column histogram in and one out as it moves along. Histograms are split
+// into 16 coarse and 256 fine bins. The coarse ones are updated every step
+// and say which 16 fine bins hold the median; those are brought up to date
+// only when they are needed. The cost per pixel hardly depends on ksize.
+//
+// The image is split into tiles which are filtered in parallel.
+void medianFilterO1(const cv::Mat& src, cv::Mat& dst, int ksize);
+
+#endif
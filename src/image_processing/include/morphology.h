@@ -0,0 +1,60 @@
+#ifndef IMAGE_PROCESSING_MORPHOLOGY_H
+#define IMAGE_PROCESSING_MORPHOLOGY_H
+
+#include <opencv2/core.hpp>
+
+enum RectMorphType{ RECT_ERODE, RECT_DILATE };
+
+// Erosion/dilation by a (2*radius.width + 1) x (2*radius.height + 1)
+// rectangle, giving the same result as cv::erode/cv::dilate with a
+// MORPH_RECT element and the default border, for 8 bit images with any
+// number of channels.
+//
+// Uses the van Herk/Gil-Werman running min/max, which costs about 3
+// comparisons per pixel whatever the rectangle size. The passes run down
+// the columns, so neighbouring pixels (and channels) are handled together
+// with SIMD, and strips of columns run in parallel. Rows are done the same
+// way on a transposed copy.
+//
+// Keeps scratch buffers between calls, so an instance shouldn't be used
+// from several threads at once.
+class RectMorphology{
+public:
+    RectMorphology(): last_used(0) {}
+
+    void apply(RectMorphType type, const cv::Mat& src, cv::Mat& dst, cv::Size radius);
+    void erode(const cv::Mat& src, cv::Mat& dst, cv::Size radius){
+        apply(RECT_ERODE, src, dst, radius); }
+    void dilate(const cv::Mat& src, cv::Mat& dst, cv::Size radius){
+        apply(RECT_DILATE, src, dst, radius); }
+    void open(const cv::Mat& src, cv::Mat& dst, cv::Size radius);
+    void close(const cv::Mat& src, cv::Mat& dst, cv::Size radius);
+    // Dilation minus erosion
+    void gradient(const cv::Mat& src, cv::Mat& dst, cv::Size radius);
+
+    // Same result as apply(). If an earlier applyIncremental() call had an
+    // identical src, the same type and a radius no bigger than this one, its
+    // result is grown by the difference (erosion by a then b is erosion by
+    // a + b), which for slider steps of 1 is just a 3x3 pass.
+    // Two earlier calls are remembered, so a preview and a full size image
+    // can take turns without starting over each time.
+    void applyIncremental(RectMorphType type, const cv::Mat& src, cv::Mat& dst,
+                          cv::Size radius);
+
+private:
+    void grow(RectMorphType type, cv::Mat& image, cv::Size radius);
+
+    cv::Mat g, h;
+    cv::Mat transposed, temp, opened;
+
+    struct History{
+        cv::Mat src; // A copy, compared against new sources
+        RectMorphType type;
+        cv::Size radius;
+        cv::Mat result;
+    };
+    History history[2];
+    int last_used;
+};
+
+#endif
@@ -2,29 +2,80 @@
 #define IMAGE_PROCESSING_TRACKBAR_DATA_H
 
 #include <opencv2/core.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
+#include "filter_cache.h"
+
+// Filtering happens on a background thread, so dragging the slider doesn't
+// freeze the window. Slider events are coalesced (only the latest level is
+// worked on), a reduced resolution preview is shown first, and results are
+// cached so going back to a previous level is instant.
+//
+// Results are handed back to the GUI thread by present(), which needs
+// calling regularly, eg: through waitForKey().
 class TrackbarData{
 private:
     typedef void (*filterFunction_t)(double, const cv::Mat&, cv::Mat&);
     double level;
     const int max_value;
+    int slider_value;
     const cv::Mat* src;
     cv::Mat* dst;
     filterFunction_t filterFunction;
+
+    // Fraction of the full resolution used for previews
+    const double preview_scale;
+    FilterCache cache;
+
+    struct Request{
+        const cv::Mat* src;
+        filterFunction_t filterFunction;
+        int slider_value;
+        double level;
+        int generation;
+    };
+
+    // Protected by mutex. Every new request bumps generation, which makes
+    // anything the worker is still doing for older ones stale.
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    bool has_request;
+    Request request;
+    int generation;
+    bool has_result;
+    cv::Mat result;
+
+    std::thread worker;
+    void workerLoop();
+    void requestFilter();
+    bool isStale(int generation);
+    void publish(const cv::Mat& image, int generation);
+
 public:
     TrackbarData(int max_value, const cv::Mat& src, cv::Mat& dst,
-                 filterFunction_t filterFunction):
-        level(0), max_value(max_value), src(&src), dst(&dst),
-        filterFunction(filterFunction) {}
+                 filterFunction_t filterFunction,
+                 std::size_t cache_bytes = 256 << 20, double preview_scale = 0.25);
+    ~TrackbarData();
+    TrackbarData(const TrackbarData&) = delete;
+    TrackbarData& operator=(const TrackbarData&) = delete;
 
-    void setSrc(const cv::Mat& src){ this->src = &src; }
-    void setFilterFunction(filterFunction_t filterFunction){
-        this->filterFunction  = filterFunction; }
+    // Both refilter at the current slider value. setSrc also drops cached
+    // results for src, in case it has changed since they were computed.
+    void setSrc(const cv::Mat& src);
+    void setFilterFunction(filterFunction_t filterFunction);
     void applyFilter(int slider_value);
+    // Copies the newest finished result into dst, returns true if there was one
+    bool present();
     const cv::Mat& getDst()const{ return *dst; }
     int getMaxValue()const{ return max_value; }
+    int* getSliderValue(){ return &slider_value; }
 };
 
 void createTrackbarWindow(TrackbarData* trackbarData);
+// Like cv::waitKey(0), but shows filter results as they finish
+int waitForKey(TrackbarData* trackbarData);
 
 #endif
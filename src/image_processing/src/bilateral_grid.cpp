@@ -0,0 +1,176 @@
+#include "bilateral_grid.h"
+
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace{
+
+// Grid of cells with channels floats each: the sums of each channel,
+// followed by the number of pixels (the homogeneous coordinate).
+// z (intensity) varies fastest, so trilinear lookups read neighbouring
+// intensities from the same cache lines.
+struct Grid{
+    int width, height, depth, channels;
+    std::vector<float> data;
+
+    Grid(int width, int height, int depth, int channels):
+        width(width), height(height), depth(depth), channels(channels),
+        data((std::size_t)width*height*depth*channels, 0.0f) {}
+
+    std::size_t stride(int axis)const{
+        switch(axis){
+            case 0: return (std::size_t)depth*channels;          // x
+            case 1: return (std::size_t)width*depth*channels;    // y
+            default: return channels;                            // z
+        }
+    }
+    int size(int axis)const{ return axis == 0 ? width : axis == 1 ? height : depth; }
+    float* cell(int x, int y, int z){
+        return &data[(((std::size_t)y*width + x)*depth + z)*channels];
+    }
+};
+
+// Blurs every line of the grid along one axis. The grid is padded by the
+// kernel radius on every side, so zeros past the ends are correct.
+void blurAxis(Grid& grid, int axis, const std::vector<float>& kernel){
+    const int radius = (int)kernel.size()/2;
+    const int n = grid.size(axis);
+    const std::size_t step = grid.stride(axis);
+    const int channels = grid.channels;
+    // The lines run along axis, one for each cell of the other two
+    const int a = axis == 0 ? 1 : 0, b = axis == 2 ? 1 : 2;
+    const int lines = grid.size(a)*grid.size(b);
+
+    cv::parallel_for_(cv::Range(0, lines), [&](const cv::Range& range){
+        std::vector<float> line((std::size_t)n*channels);
+        for(int i = range.start; i < range.end; i++){
+            int ia = i % grid.size(a), ib = i / grid.size(a);
+            float* start = &grid.data[ia*grid.stride(a) + ib*grid.stride(b)];
+            for(int k = 0; k < n; k++){
+                std::copy(start + k*step, start + k*step + channels, &line[k*channels]);
+            }
+            for(int k = 0; k < n; k++){
+                float* out = start + k*step;
+                std::fill(out, out + channels, 0.0f);
+                int t0 = std::max(-radius, -k), t1 = std::min(radius, n - 1 - k);
+                for(int t = t0; t <= t1; t++){
+                    const float w = kernel[t + radius];
+                    const float* in = &line[(k + t)*channels];
+                    for(int c = 0; c < channels; c++) out[c] += w*in[c];
+                }
+            }
+        }
+    });
+}
+
+}
+
+void bilateralGridFilter(const cv::Mat& src, cv::Mat& dst, double sigma_space,
+                         double sigma_color, double sampling){
+    CV_Assert(src.depth() == CV_8U && (src.channels() == 1 || src.channels() == 3));
+    CV_Assert(sampling > 0);
+    if(sigma_space <= 0 || sigma_color <= 0 || src.empty()){
+        src.copyTo(dst);
+        return;
+    }
+    const int cn = src.channels();
+    cv::Mat guide;
+    if(cn == 1){
+        guide = src;
+    }else{
+        cv::cvtColor(src, guide, cv::COLOR_BGR2GRAY);
+    }
+
+    // Cell sizes, in pixels and intensity levels. Below a pixel the grid
+    // would just be a slow copy of the image.
+    const double cell_space = std::max(1.0, sigma_space*sampling);
+    const double cell_color = std::max(1.0, sigma_color*sampling);
+
+    // The remaining blur, in cells, cut off at 2 sigma
+    const double blur_sigma = 1.0/sampling;
+    const int radius = std::max(1, (int)std::ceil(2*blur_sigma));
+    std::vector<float> kernel(2*radius + 1);
+    float kernel_sum = 0;
+    for(int t = -radius; t <= radius; t++){
+        kernel[t + radius] = (float)std::exp(-0.5*t*t/(blur_sigma*blur_sigma));
+        kernel_sum += kernel[t + radius];
+    }
+    for(float& w: kernel) w /= kernel_sum;
+
+    // Padded by the blur radius, plus one for the upper trilinear neighbour
+    Grid grid((int)((src.cols - 1)/cell_space) + 2 + 2*radius,
+              (int)((src.rows - 1)/cell_space) + 2 + 2*radius,
+              (int)(255/cell_color) + 2 + 2*radius,
+              cn + 1);
+
+    // Splat each pixel into its nearest cell. Threads take bands of grid
+    // rows, so no two write to the same cell.
+    auto gridRow = [&](int y){ return (int)(y/cell_space + 0.5); };
+    const int grid_rows = gridRow(src.rows - 1) + 1;
+    cv::parallel_for_(cv::Range(0, grid_rows), [&](const cv::Range& range){
+        int y = std::max(0, (int)((range.start - 0.5)*cell_space) - 1);
+        for(; y < src.rows; y++){
+            int gy = gridRow(y);
+            if(gy < range.start) continue;
+            if(gy >= range.end) break;
+            const uchar* s = src.ptr<uchar>(y);
+            const uchar* g = guide.ptr<uchar>(y);
+            for(int x = 0; x < src.cols; x++){
+                float* cell = grid.cell((int)(x/cell_space + 0.5) + radius, gy + radius,
+                                        (int)(g[x]/cell_color + 0.5) + radius);
+                for(int c = 0; c < cn; c++) cell[c] += s[x*cn + c];
+                cell[cn] += 1;
+            }
+        }
+    });
+
+    for(int axis = 0; axis < 3; axis++) blurAxis(grid, axis, kernel);
+
+    // Slice: trilinear interpolation at each pixel's position in the grid
+    std::vector<int> x0s(src.cols);
+    std::vector<float> wxs(src.cols);
+    for(int x = 0; x < src.cols; x++){
+        double fx = x/cell_space + radius;
+        x0s[x] = (int)fx;
+        wxs[x] = (float)(fx - x0s[x]);
+    }
+    dst.create(src.size(), src.type());
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range){
+        float sum[4];
+        for(int y = range.start; y < range.end; y++){
+            double fy = y/cell_space + radius;
+            const int y0 = (int)fy;
+            const float wy = (float)(fy - y0);
+            const uchar* s = src.ptr<uchar>(y);
+            const uchar* g = guide.ptr<uchar>(y);
+            uchar* d = dst.ptr<uchar>(y);
+            for(int x = 0; x < src.cols; x++){
+                double fz = g[x]/cell_color + radius;
+                const int x0 = x0s[x], z0 = (int)fz;
+                const float wx = wxs[x], wz = (float)(fz - z0);
+                std::fill(sum, sum + cn + 1, 0.0f);
+                for(int j = 0; j < 2; j++){
+                    const float wyj = j ? wy : 1 - wy;
+                    for(int i = 0; i < 2; i++){
+                        const float wxy = wyj*(i ? wx : 1 - wx);
+                        // The two z neighbours are next to each other
+                        const float* cell = grid.cell(x0 + i, y0 + j, z0);
+                        const float w_lo = wxy*(1 - wz), w_hi = wxy*wz;
+                        for(int c = 0; c <= cn; c++){
+                            sum[c] += w_lo*cell[c] + w_hi*cell[cn + 1 + c];
+                        }
+                    }
+                }
+                if(sum[cn] > 1e-6f){
+                    for(int c = 0; c < cn; c++){
+                        d[x*cn + c] = cv::saturate_cast<uchar>(sum[c]/sum[cn]);
+                    }
+                }else{
+                    for(int c = 0; c < cn; c++) d[x*cn + c] = s[x*cn + c];
+                }
+            }
+        }
+    });
+}
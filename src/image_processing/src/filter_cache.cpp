@@ -0,0 +1,68 @@
+#include "filter_cache.h"
+
+#include <functional>
+#include <iterator>
+
+bool FilterCache::Key::operator<(const Key& other)const{
+    if(filterFunction != other.filterFunction){
+        return std::less<filterFunction_t>()(filterFunction, other.filterFunction);
+    }
+    if(src != other.src){
+        return std::less<const cv::Mat*>()(src, other.src);
+    }
+    return slider_value < other.slider_value;
+}
+
+static std::size_t matBytes(const cv::Mat& mat){
+    return mat.total()*mat.elemSize();
+}
+
+bool FilterCache::get(filterFunction_t filterFunction, int slider_value,
+                      const cv::Mat* src, cv::Mat& result){
+    std::lock_guard<std::mutex> lock(mutex);
+    Key key = {filterFunction, slider_value, src};
+    auto found = index.find(key);
+    if(found == index.end()) return false;
+    // Move to the front, it's now the most recently used
+    entries.splice(entries.begin(), entries, found->second);
+    result = found->second->second;
+    return true;
+}
+
+void FilterCache::put(filterFunction_t filterFunction, int slider_value,
+                      const cv::Mat* src, const cv::Mat& result){
+    std::size_t bytes = matBytes(result);
+    if(bytes > max_bytes) return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Key key = {filterFunction, slider_value, src};
+    auto found = index.find(key);
+    if(found != index.end()) erase(found->second);
+
+    entries.push_front(std::make_pair(key, result));
+    index[key] = entries.begin();
+    total_bytes += bytes;
+    while(total_bytes > max_bytes){
+        erase(std::prev(entries.end()));
+    }
+}
+
+void FilterCache::invalidate(const cv::Mat* src){
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto it = entries.begin(); it != entries.end();){
+        auto next = std::next(it);
+        if(it->first.src == src) erase(it);
+        it = next;
+    }
+}
+
+std::size_t FilterCache::getBytes()const{
+    std::lock_guard<std::mutex> lock(mutex);
+    return total_bytes;
+}
+
+void FilterCache::erase(Entries::iterator it){
+    total_bytes -= matBytes(it->second);
+    index.erase(it->first);
+    entries.erase(it);
+}
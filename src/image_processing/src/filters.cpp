@@ -0,0 +1,72 @@
+#include "filters.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include "bilateral_grid.h"
+#include "median.h"
+#include "morphology.h"
+
+void applyHomogeneousBlur(double level, const cv::Mat& src, cv::Mat& dst){
+    int kernel_size = 1 + 2*(int)(level*20);
+    cv::blur(src, dst, cv::Size(kernel_size, kernel_size), cv::Point(-1,-1));
+}
+
+void applyGaussianBlur(double level, const cv::Mat& src, cv::Mat& dst){
+    int kernel_size = 1 + 2*(int)(level*20);
+    cv::GaussianBlur(src, dst, cv::Size(kernel_size, kernel_size), 0, 0);
+}
+
+void applyMedianBlur(double level, const cv::Mat& src, cv::Mat& dst){
+    int kernel_size = 1 + 2*(int)(level*20);
+    cv::medianBlur(src, dst, kernel_size);
+}
+
+void applyMedianO1(double level, const cv::Mat& src, cv::Mat& dst){
+    int kernel_size = 1 + 2*(int)(level*20);
+    medianFilterO1(src, dst, kernel_size);
+}
+
+void applyBilateralBlur(double level, const cv::Mat& src, cv::Mat& dst){
+    int kernel_size = 1 + 2*(int)(level*20);
+    cv::bilateralFilter(src, dst, kernel_size, kernel_size*2, kernel_size/2);
+}
+
+void applyBilateralGrid(double level, const cv::Mat& src, cv::Mat& dst){
+    int kernel_size = 1 + 2*(int)(level*20);
+    bilateralGridFilter(src, dst, kernel_size/2, kernel_size*2);
+}
+
+// RectMorphology keeps scratch buffers and earlier results, so each thread
+// calling these gets its own
+
+void applyErosion(double level, const cv::Mat& src, cv::Mat& dst){
+    static thread_local RectMorphology morphology;
+    int size = 1 + (int)(level*5);
+    morphology.applyIncremental(RECT_ERODE, src, dst, cv::Size(size, size));
+}
+
+void applyDilation(double level, const cv::Mat& src, cv::Mat& dst){
+    static thread_local RectMorphology morphology;
+    int size = 1 + (int)(level*5);
+    morphology.applyIncremental(RECT_DILATE, src, dst, cv::Size(size, size));
+}
+
+// Cheap at any size now, so these go up to much bigger rectangles
+
+void applyOpening(double level, const cv::Mat& src, cv::Mat& dst){
+    static thread_local RectMorphology morphology;
+    int size = 1 + (int)(level*30);
+    morphology.open(src, dst, cv::Size(size, size));
+}
+
+void applyClosing(double level, const cv::Mat& src, cv::Mat& dst){
+    static thread_local RectMorphology morphology;
+    int size = 1 + (int)(level*30);
+    morphology.close(src, dst, cv::Size(size, size));
+}
+
+void applyMorphGradient(double level, const cv::Mat& src, cv::Mat& dst){
+    static thread_local RectMorphology morphology;
+    int size = 1 + (int)(level*30);
+    morphology.gradient(src, dst, cv::Size(size, size));
+}
@@ -4,48 +4,101 @@
 #include <iostream>
 
 #include "trackbar_data.h"
-
-void applyHomogeneousBlur(double level, const cv::Mat& src, cv::Mat& dst){
-    int kernel_size = 1 + 2*(int)(level*20);
-    cv::blur(src, dst, cv::Size(kernel_size, kernel_size), cv::Point(-1,-1));
-}
-
-void applyGaussianBlur(double level, const cv::Mat& src, cv::Mat& dst){
-    int kernel_size = 1 + 2*(int)(level*20);
-    cv::GaussianBlur(src, dst, cv::Size(kernel_size, kernel_size), 0, 0);
-}
-
-void applyMedianBlur(double level, const cv::Mat& src, cv::Mat& dst){
-    int kernel_size = 1 + 2*(int)(level*20);
-    cv::medianBlur(src, dst, kernel_size);
-}
-
-void applyBilateralBlur(double level, const cv::Mat& src, cv::Mat& dst){
-    int kernel_size = 1 + 2*(int)(level*20);
-    cv::bilateralFilter(src, dst, kernel_size, kernel_size*2, kernel_size/2);
-}
-
-void applyErosion(double level, const cv::Mat& src, cv::Mat& dst){
-    int size = 1 + (int)(level*5);
-    cv::Mat element = cv::getStructuringElement(
-        cv::MORPH_RECT,
-        cv::Size(2*size + 1, 2*size+1),
-        cv::Point(size, size));
-    cv::erode(src, dst, element);
+#include "filters.h"
+#include "bilateral_grid.h"
+#include "median.h"
+
+// Prints the time and PSNR of the bilateral grid, at a few sampling rates,
+// against cv::bilateralFilter with the same sigmas. The reference window
+// reaches 2 sigma, like the grid's blur, rather than the slider's d.
+static int compareBilateral(){
+    for(const char* name: { "lena.jpg", "baboon.jpg" }){
+        cv::Mat image = cv::imread(cv::samples::findFile(name));
+        if(image.empty()){
+            std::cout << "Could not read " << name << std::endl;
+            return 1;
+        }
+        std::cout << name << " (" << image.cols << "x" << image.rows << ")" << std::endl;
+        for(int kernel_size: { 5, 11, 21, 41 }){
+            double sigma_space = kernel_size/2, sigma_color = kernel_size*2;
+            cv::Mat reference, approx;
+
+            int64 start = cv::getTickCount();
+            cv::bilateralFilter(image, reference, 2*(int)(2*sigma_space) + 1,
+                                sigma_color, sigma_space);
+            double reference_ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency();
+
+            std::cout << "  sigma space " << sigma_space << ", color " << sigma_color
+                      << ": cv::bilateralFilter " << reference_ms << " ms" << std::endl;
+            for(double sampling: { 2.0, 1.0, 0.5 }){
+                const int repeats = 5;
+                bilateralGridFilter(image, approx, sigma_space, sigma_color, sampling);
+                start = cv::getTickCount();
+                for(int k = 0; k < repeats; k++){
+                    bilateralGridFilter(image, approx, sigma_space, sigma_color, sampling);
+                }
+                double grid_ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency()/repeats;
+                std::cout << "    grid, sampling " << sampling << ": " << grid_ms << " ms ("
+                          << reference_ms/grid_ms << "x), PSNR "
+                          << cv::PSNR(reference, approx) << " dB" << std::endl;
+            }
+        }
+    }
+    return 0;
 }
 
-void applyDilation(double level, const cv::Mat& src, cv::Mat& dst){
-    int size = 1 + (int)(level*5);
-    cv::Mat element = cv::getStructuringElement(
-        cv::MORPH_RECT,
-        cv::Size(2*size + 1, 2*size+1),
-        cv::Point(size, size));
-    cv::dilate(src, dst, element);
+// Checks the constant time median gives exactly the same result as
+// cv::medianBlur, on colour and grey images, and compares their times
+static int compareMedian(){
+    for(const char* name: { "lena.jpg", "baboon.jpg" }){
+        cv::Mat color = cv::imread(cv::samples::findFile(name));
+        if(color.empty()){
+            std::cout << "Could not read " << name << std::endl;
+            return 1;
+        }
+        cv::Mat gray;
+        cv::cvtColor(color, gray, cv::COLOR_BGR2GRAY);
+        for(const cv::Mat* image: { &gray, &color }){
+            std::cout << name << ", " << image->channels() << " channel(s)" << std::endl;
+            for(int kernel_size: { 3, 5, 11, 21, 41 }){
+                cv::Mat reference, custom;
+                const int repeats = 3;
+                int64 start = cv::getTickCount();
+                for(int k = 0; k < repeats; k++){
+                    cv::medianBlur(*image, reference, kernel_size);
+                }
+                double reference_ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency()/repeats;
+                start = cv::getTickCount();
+                for(int k = 0; k < repeats; k++){
+                    medianFilterO1(*image, custom, kernel_size);
+                }
+                double custom_ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency()/repeats;
+                cv::Mat difference = (reference != custom).reshape(1);
+                std::cout << "  ksize " << kernel_size << ": cv::medianBlur " << reference_ms
+                          << " ms, O(1) " << custom_ms << " ms (" << reference_ms/custom_ms
+                          << "x), values different " << cv::countNonZero(difference)
+                          << std::endl;
+            }
+        }
+    }
+    return 0;
 }
 
 int main(int argc, char** argv){
+    cv::CommandLineParser parser(argc, argv,
+        "{help h||}"
+        "{compare||time the custom filters against OpenCV's, check their output and exit}");
+    if(parser.has("help")){
+        parser.printMessage();
+        return 0;
+    }
     cv::Mat dst;
     cv::samples::addSamplesDataSearchPath("data");
+    if(parser.has("compare")){
+        int result = compareMedian();
+        if(result != 0) return result;
+        return compareBilateral();
+    }
     cv::Mat src = cv::imread(cv::samples::findFile("lena.jpg"));
     cv::Mat src2 = cv::imread(cv::samples::findFile("LinuxLogo.jpg"));
 
@@ -53,34 +106,49 @@ int main(int argc, char** argv){
 
     TrackbarData trackbarData(100, src, dst, applyHomogeneousBlur);
     createTrackbarWindow(&trackbarData);
-    cv::waitKey(0);
+    waitForKey(&trackbarData);
 
     trackbarData.setFilterFunction(applyGaussianBlur);
-    cv::waitKey(0);
+    waitForKey(&trackbarData);
 
     trackbarData.setFilterFunction(applyMedianBlur);
-    cv::waitKey(0);
+    waitForKey(&trackbarData);
+
+    trackbarData.setFilterFunction(applyMedianO1);
+    waitForKey(&trackbarData);
 
     trackbarData.setFilterFunction(applyBilateralBlur);
-    cv::waitKey(0);
+    waitForKey(&trackbarData);
+
+    trackbarData.setFilterFunction(applyBilateralGrid);
+    waitForKey(&trackbarData);
 
     // Dilation and erosion on linux logo
 
     trackbarData.setSrc(src2);
     trackbarData.setFilterFunction(applyErosion);
-    cv::waitKey(0);
+    waitForKey(&trackbarData);
 
     trackbarData.setFilterFunction(applyDilation);
-    cv::waitKey(0);
+    waitForKey(&trackbarData);
+
+    trackbarData.setFilterFunction(applyOpening);
+    waitForKey(&trackbarData);
+
+    trackbarData.setFilterFunction(applyClosing);
+    waitForKey(&trackbarData);
+
+    trackbarData.setFilterFunction(applyMorphGradient);
+    waitForKey(&trackbarData);
 
     // Dilation and erosion on lena
 
     trackbarData.setSrc(src);
     trackbarData.setFilterFunction(applyErosion);
-    cv::waitKey(0);
+    waitForKey(&trackbarData);
 
     trackbarData.setFilterFunction(applyDilation);
-    cv::waitKey(0);
+    waitForKey(&trackbarData);
 
     return 0;
 }
@@ -0,0 +1,181 @@
+#include "median.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace{
+
+typedef unsigned short count_t;
+
+// a += b and a -= b over a block of 16 bins
+inline void addBins(count_t* a, const count_t* b){
+#if CV_SIMD
+    if(cv::v_uint16::nlanes <= 16){
+        for(int i = 0; i < 16; i += cv::v_uint16::nlanes){
+            cv::v_store(a + i, cv::vx_load(a + i) + cv::vx_load(b + i));
+        }
+        return;
+    }
+#endif
+    for(int i = 0; i < 16; i++) a[i] += b[i];
+}
+
+inline void subBins(count_t* a, const count_t* b){
+#if CV_SIMD
+    if(cv::v_uint16::nlanes <= 16){
+        for(int i = 0; i < 16; i += cv::v_uint16::nlanes){
+            cv::v_store(a + i, cv::vx_load(a + i) - cv::vx_load(b + i));
+        }
+        return;
+    }
+#endif
+    for(int i = 0; i < 16; i++) a[i] -= b[i];
+}
+
+// Tiles are about this many columns wide, so the column histograms of one
+// tile (2*256 bytes each for the fine bins) stay in L2
+const int tile_cols = 256;
+
+struct Tile{
+    int x0, x1, y0, y1;
+};
+
+class MedianTile{
+public:
+    MedianTile(const cv::Mat& src, cv::Mat& dst, int radius):
+        src(src), dst(dst), radius(radius), cn(src.channels()) {}
+
+    void filter(const Tile& tile){
+        const int cols = tile.x1 - tile.x0 + 2*radius;
+        coarse_cols.resize((std::size_t)cols*16);
+        fine_cols.resize((std::size_t)cols*256);
+        xs.resize(cols);
+        // Column j of the histograms is image column x0 - radius + j,
+        // replicated past the edges
+        for(int j = 0; j < cols; j++){
+            xs[j] = std::min(std::max(tile.x0 - radius + j, 0), src.cols - 1)*cn;
+        }
+        for(int c = 0; c < cn; c++){
+            filterChannel(tile, c);
+        }
+    }
+
+private:
+    int clampRow(int y)const{ return std::min(std::max(y, 0), src.rows - 1); }
+
+    void updateColumns(int y, int c, int delta){
+        const uchar* row = src.ptr<uchar>(clampRow(y)) + c;
+        const int cols = (int)xs.size();
+        for(int j = 0; j < cols; j++){
+            const uchar v = row[xs[j]];
+            coarse_cols[j*16 + (v >> 4)] += delta;
+            fine_cols[j*256 + v] += delta;
+        }
+    }
+
+    void filterChannel(const Tile& tile, int c){
+        const int cols = (int)xs.size();
+        const int k = 2*radius + 1;
+        // 0 based rank of the median in the window
+        const int target = k*k/2;
+
+        std::fill(coarse_cols.begin(), coarse_cols.end(), 0);
+        std::fill(fine_cols.begin(), fine_cols.end(), 0);
+        for(int y = tile.y0 - radius; y <= tile.y0 + radius; y++){
+            updateColumns(y, c, 1);
+        }
+
+        for(int y = tile.y0; y < tile.y1; y++){
+            if(y > tile.y0){
+                updateColumns(y - radius - 1, c, -1);
+                updateColumns(y + radius, c, 1);
+            }
+
+            count_t coarse[16] = {0};
+            for(int j = 0; j < k; j++) addBins(coarse, &coarse_cols[j*16]);
+            // Window position each block of fine bins is valid for. Nothing
+            // is valid yet, anything at least k behind gets rebuilt.
+            int valid_at[16];
+            std::fill(valid_at, valid_at + 16, -k);
+
+            uchar* out = dst.ptr<uchar>(y) + tile.x0*cn + c;
+            for(int x = 0; x < cols - 2*radius; x++){
+                // Window covers columns [x, x + 2*radius]
+                if(x > 0){
+                    addBins(coarse, &coarse_cols[(x + 2*radius)*16]);
+                    subBins(coarse, &coarse_cols[(x - 1)*16]);
+                }
+
+                int b = 0, sum = 0;
+                while(sum + coarse[b] <= target){
+                    sum += coarse[b];
+                    b++;
+                }
+
+                count_t* fine_b = fine[b];
+                if(x - valid_at[b] >= k){
+                    std::memset(fine_b, 0, 16*sizeof(count_t));
+                    for(int j = x; j < x + k; j++){
+                        addBins(fine_b, &fine_cols[j*256 + b*16]);
+                    }
+                }else{
+                    for(int j = valid_at[b]; j < x; j++){
+                        subBins(fine_b, &fine_cols[j*256 + b*16]);
+                        addBins(fine_b, &fine_cols[(j + k)*256 + b*16]);
+                    }
+                }
+                valid_at[b] = x;
+
+                int i = 0;
+                while(sum + fine_b[i] <= target){
+                    sum += fine_b[i];
+                    i++;
+                }
+                out[x*cn] = (uchar)(b*16 + i);
+            }
+        }
+    }
+
+    const cv::Mat& src;
+    cv::Mat& dst;
+    const int radius, cn;
+    std::vector<count_t> coarse_cols, fine_cols;
+    std::vector<int> xs;
+    count_t fine[16][16];
+};
+
+}
+
+void medianFilterO1(const cv::Mat& src, cv::Mat& dst, int ksize){
+    CV_Assert(src.depth() == CV_8U && (src.channels() == 1 || src.channels() == 3));
+    CV_Assert(ksize % 2 == 1 && ksize > 0 && ksize*ksize < 65536);
+    if(ksize == 1 || src.empty()){
+        src.copyTo(dst);
+        return;
+    }
+    // Reads whole windows of src after parts of dst are written
+    cv::Mat input = src.data == dst.data ? src.clone() : src;
+    dst.create(input.size(), input.type());
+
+    // Starting a tile costs about ksize rows of histogram updates, so tiles
+    // are kept a good deal taller than that
+    const int radius = ksize/2;
+    const int tile_rows = std::max(64, 8*ksize);
+    std::vector<Tile> tiles;
+    for(int y = 0; y < input.rows; y += tile_rows){
+        for(int x = 0; x < input.cols; x += tile_cols){
+            Tile tile = { x, std::min(x + tile_cols, input.cols),
+                          y, std::min(y + tile_rows, input.rows) };
+            tiles.push_back(tile);
+        }
+    }
+
+    cv::parallel_for_(cv::Range(0, (int)tiles.size()), [&](const cv::Range& range){
+        MedianTile median(input, dst, radius);
+        for(int t = range.start; t < range.end; t++){
+            median.filter(tiles[t]);
+        }
+    });
+}
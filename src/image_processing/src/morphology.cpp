@@ -0,0 +1,256 @@
+#include "morphology.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+struct MinOp{
+    enum{ identity = 255 };
+    static uchar apply(uchar a, uchar b){ return std::min(a, b); }
+#if CV_SIMD
+    static cv::v_uint8 apply(const cv::v_uint8& a, const cv::v_uint8& b){
+        return cv::v_min(a, b); }
+#endif
+};
+
+struct MaxOp{
+    enum{ identity = 0 };
+    static uchar apply(uchar a, uchar b){ return std::max(a, b); }
+#if CV_SIMD
+    static cv::v_uint8 apply(const cv::v_uint8& a, const cv::v_uint8& b){
+        return cv::v_max(a, b); }
+#endif
+};
+
+// out[j] = op(a[j], b[j])
+template <typename Op>
+static inline void combine(const uchar* a, const uchar* b, uchar* out, int n){
+    int j = 0;
+#if CV_SIMD
+    const int lanes = cv::v_uint8::nlanes;
+    for(; j <= n - lanes; j += lanes){
+        cv::v_store(out + j, Op::apply(cv::vx_load(a + j), cv::vx_load(b + j)));
+    }
+#endif
+    for(; j < n; j++) out[j] = Op::apply(a[j], b[j]);
+}
+
+// out[j] = op(a[j], b[j], c[j])
+template <typename Op>
+static inline void combine3(const uchar* a, const uchar* b, const uchar* c, uchar* out, int n){
+    int j = 0;
+#if CV_SIMD
+    const int lanes = cv::v_uint8::nlanes;
+    for(; j <= n - lanes; j += lanes){
+        cv::v_store(out + j, Op::apply(Op::apply(cv::vx_load(a + j), cv::vx_load(b + j)),
+                                       cv::vx_load(c + j)));
+    }
+#endif
+    for(; j < n; j++) out[j] = Op::apply(Op::apply(a[j], b[j]), c[j]);
+}
+
+// Bytes of each row handled by one parallel strip
+static const int strip_bytes = 512;
+
+// van Herk/Gil-Werman down the columns, over windows of 2*r + 1 rows.
+// Rows outside the image are the identity, so never win, which matches
+// OpenCV's default morphology border. dst may be src.
+template <typename Op>
+static void verticalPass(const cv::Mat& src, cv::Mat& dst, int r, cv::Mat& g, cv::Mat& h){
+    const int rows = src.rows, width = src.cols*src.channels();
+    const int k = 2*r + 1, padded = rows + 2*r;
+    g.create(padded, width, CV_8U);
+    h.create(padded, width, CV_8U);
+    dst.create(src.size(), src.type());
+
+    std::vector<uchar> identity(width, (uchar)Op::identity);
+    // p is the row index in the image padded by r rows at each end
+    auto row = [&](int p) -> const uchar* {
+        int y = p - r;
+        return (y >= 0 && y < rows) ? src.ptr<uchar>(y) : identity.data();
+    };
+
+    // Each strip reads all of its columns before writing any of them, and
+    // no other strip touches them, which is why dst may be src
+    int nstrips = (width + strip_bytes - 1)/strip_bytes;
+    cv::parallel_for_(cv::Range(0, nstrips), [&](const cv::Range& range){
+        for(int s = range.start; s < range.end; s++){
+            int x0 = s*strip_bytes;
+            int n = std::min(width - x0, strip_bytes);
+            // g: running op from the start of each block of k rows
+            for(int p = 0; p < padded; p++){
+                uchar* gp = g.ptr<uchar>(p) + x0;
+                if(p % k == 0){
+                    std::memcpy(gp, row(p) + x0, n);
+                }else{
+                    combine<Op>(g.ptr<uchar>(p - 1) + x0, row(p) + x0, gp, n);
+                }
+            }
+            // h: running op back from the end of each block
+            for(int p = padded - 1; p >= 0; p--){
+                uchar* hp = h.ptr<uchar>(p) + x0;
+                if(p % k == k - 1 || p == padded - 1){
+                    std::memcpy(hp, row(p) + x0, n);
+                }else{
+                    combine<Op>(h.ptr<uchar>(p + 1) + x0, row(p) + x0, hp, n);
+                }
+            }
+            // The window of row y is padded rows [y, y + 2r], which spans at
+            // most one block boundary, so one h and one g value cover it
+            for(int y = 0; y < rows; y++){
+                combine<Op>(h.ptr<uchar>(y) + x0, g.ptr<uchar>(y + 2*r) + x0,
+                            dst.ptr<uchar>(y) + x0, n);
+            }
+        }
+    });
+}
+
+// 3 row window, for growing by one step. dst must not be src.
+template <typename Op>
+static void verticalPass3(const cv::Mat& src, cv::Mat& dst){
+    const int rows = src.rows, width = src.cols*src.channels();
+    dst.create(src.size(), src.type());
+    std::vector<uchar> identity(width, (uchar)Op::identity);
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& range){
+        for(int y = range.start; y < range.end; y++){
+            const uchar* above = y > 0 ? src.ptr<uchar>(y - 1) : identity.data();
+            const uchar* below = y < rows - 1 ? src.ptr<uchar>(y + 1) : identity.data();
+            combine3<Op>(above, src.ptr<uchar>(y), below, dst.ptr<uchar>(y), width);
+        }
+    });
+}
+
+// 3 pixel window along the rows. Neighbouring pixels are cn bytes apart,
+// so the SIMD loads are just offset. dst must not be src.
+template <typename Op>
+static void horizontalPass3(const cv::Mat& src, cv::Mat& dst){
+    const int cn = src.channels(), width = src.cols*cn;
+    dst.create(src.size(), src.type());
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range){
+        for(int y = range.start; y < range.end; y++){
+            const uchar* s = src.ptr<uchar>(y);
+            uchar* d = dst.ptr<uchar>(y);
+            if(src.cols == 1){
+                std::memcpy(d, s, width);
+                continue;
+            }
+            // The first and last pixels only have one neighbour
+            for(int c = 0; c < cn; c++){
+                d[c] = Op::apply(s[c], s[c + cn]);
+                d[width - cn + c] = Op::apply(s[width - cn + c], s[width - 2*cn + c]);
+            }
+            combine3<Op>(s, s + cn, s + 2*cn, d + cn, width - 2*cn);
+        }
+    });
+}
+
+template <typename Op>
+static void rectPass(const cv::Mat& src, cv::Mat& dst, cv::Size radius,
+                     cv::Mat& g, cv::Mat& h, cv::Mat& transposed){
+    if(radius.height > 0){
+        verticalPass<Op>(src, dst, radius.height, g, h);
+    }else{
+        src.copyTo(dst);
+    }
+    if(radius.width > 0){
+        // Rows are columns of the transpose
+        cv::transpose(dst, transposed);
+        verticalPass<Op>(transposed, transposed, radius.width, g, h);
+        cv::transpose(transposed, dst);
+    }
+}
+
+void RectMorphology::apply(RectMorphType type, const cv::Mat& src, cv::Mat& dst,
+                           cv::Size radius){
+    CV_Assert(src.depth() == CV_8U);
+    CV_Assert(radius.width >= 0 && radius.height >= 0);
+    if(type == RECT_ERODE){
+        rectPass<MinOp>(src, dst, radius, g, h, transposed);
+    }else{
+        rectPass<MaxOp>(src, dst, radius, g, h, transposed);
+    }
+}
+
+void RectMorphology::open(const cv::Mat& src, cv::Mat& dst, cv::Size radius){
+    apply(RECT_ERODE, src, opened, radius);
+    apply(RECT_DILATE, opened, dst, radius);
+}
+
+void RectMorphology::close(const cv::Mat& src, cv::Mat& dst, cv::Size radius){
+    apply(RECT_DILATE, src, opened, radius);
+    apply(RECT_ERODE, opened, dst, radius);
+}
+
+void RectMorphology::gradient(const cv::Mat& src, cv::Mat& dst, cv::Size radius){
+    apply(RECT_ERODE, src, opened, radius);
+    apply(RECT_DILATE, src, dst, radius);
+    cv::subtract(dst, opened, dst);
+}
+
+template <typename Op>
+static void growPass(cv::Mat& image, cv::Size radius, cv::Mat& temp,
+                     cv::Mat& g, cv::Mat& h, cv::Mat& transposed){
+    if(radius.height == 1){
+        verticalPass3<Op>(image, temp);
+        cv::swap(image, temp);
+    }else if(radius.height > 1){
+        verticalPass<Op>(image, image, radius.height, g, h);
+    }
+    if(radius.width == 1){
+        horizontalPass3<Op>(image, temp);
+        cv::swap(image, temp);
+    }else if(radius.width > 1){
+        rectPass<Op>(image, image, cv::Size(radius.width, 0), g, h, transposed);
+    }
+}
+
+void RectMorphology::grow(RectMorphType type, cv::Mat& image, cv::Size radius){
+    if(type == RECT_ERODE){
+        growPass<MinOp>(image, radius, temp, g, h, transposed);
+    }else{
+        growPass<MaxOp>(image, radius, temp, g, h, transposed);
+    }
+}
+
+static bool sameImage(const cv::Mat& a, const cv::Mat& b){
+    if(a.size() != b.size() || a.type() != b.type()) return false;
+    const std::size_t row_bytes = a.cols*a.elemSize();
+    for(int y = 0; y < a.rows; y++){
+        if(std::memcmp(a.ptr(y), b.ptr(y), row_bytes) != 0) return false;
+    }
+    return true;
+}
+
+void RectMorphology::applyIncremental(RectMorphType type, const cv::Mat& src, cv::Mat& dst,
+                                      cv::Size radius){
+    // Comparing against a copy costs a pass over the image, but unlike
+    // matching data pointers it can't be fooled by a reused buffer
+    int slot = -1;
+    for(int i = 0; i < 2; i++){
+        const History& entry = history[i];
+        if(!entry.result.empty() && entry.type == type &&
+           radius.width >= entry.radius.width && radius.height >= entry.radius.height &&
+           sameImage(entry.src, src)){
+            slot = i;
+            break;
+        }
+    }
+
+    if(slot >= 0){
+        History& entry = history[slot];
+        grow(type, entry.result, radius - entry.radius);
+        entry.radius = radius;
+    }else{
+        // Replace whichever wasn't used last
+        slot = 1 - last_used;
+        History& entry = history[slot];
+        src.copyTo(entry.src);
+        entry.type = type;
+        entry.radius = radius;
+        apply(type, src, entry.result, radius);
+    }
+    last_used = slot;
+    // The result gets grown in place next time, so dst needs its own copy
+    history[slot].result.copyTo(dst);
+}
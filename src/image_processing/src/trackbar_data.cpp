@@ -3,28 +3,151 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 
+static const char* window_name = "Image Processing";
+
+TrackbarData::TrackbarData(int max_value, const cv::Mat& src, cv::Mat& dst,
+                           filterFunction_t filterFunction,
+                           std::size_t cache_bytes, double preview_scale):
+    level(0), max_value(max_value), slider_value(0), src(&src), dst(&dst),
+    filterFunction(filterFunction), preview_scale(preview_scale), cache(cache_bytes),
+    stopping(false), has_request(false), generation(0), has_result(false)
+{
+    worker = std::thread(&TrackbarData::workerLoop, this);
+}
+
+TrackbarData::~TrackbarData(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void TrackbarData::setSrc(const cv::Mat& src){
+    this->src = &src;
+    cache.invalidate(&src);
+    applyFilter(slider_value);
+}
+
+void TrackbarData::setFilterFunction(filterFunction_t filterFunction){
+    this->filterFunction = filterFunction;
+    applyFilter(slider_value);
+}
 
 void TrackbarData::applyFilter(int slider_value){
+    this->slider_value = slider_value;
     level = (double)slider_value/max_value;
-    filterFunction(level, *src, *dst);
+
+    cv::Mat cached;
+    if(cache.get(filterFunction, slider_value, src, cached)){
+        // Nothing for the worker to do, and whatever it's doing now is stale
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+        has_request = false;
+        result = cached;
+        has_result = true;
+        return;
+    }
+    requestFilter();
+}
+
+void TrackbarData::requestFilter(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+        request.src = src;
+        request.filterFunction = filterFunction;
+        request.slider_value = slider_value;
+        request.level = level;
+        request.generation = generation;
+        // Replaces any request the worker hasn't picked up yet
+        has_request = true;
+    }
+    wake.notify_one();
+}
+
+bool TrackbarData::isStale(int request_generation){
+    std::lock_guard<std::mutex> lock(mutex);
+    return stopping || request_generation != generation;
+}
+
+void TrackbarData::publish(const cv::Mat& image, int request_generation){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(request_generation != generation) return;
+    result = image;
+    has_result = true;
+}
+
+void TrackbarData::workerLoop(){
+    cv::Mat small, small_filtered;
+    while(true){
+        Request current;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]{ return stopping || has_request; });
+            if(stopping) return;
+            current = request;
+            has_request = false;
+        }
+        const cv::Mat& source = *current.src;
+
+        // Quick preview first. The level is scaled down with the image, so
+        // the kernels cover roughly the same part of the picture.
+        if(preview_scale < 1){
+            cv::resize(source, small, cv::Size(), preview_scale, preview_scale, cv::INTER_AREA);
+            current.filterFunction(current.level*preview_scale, small, small_filtered);
+            // New each time, since it's handed over to the GUI thread
+            cv::Mat preview;
+            cv::resize(small_filtered, preview, source.size(), 0, 0, cv::INTER_LINEAR);
+            publish(preview, current.generation);
+            if(isStale(current.generation)) continue;
+        }
+
+        cv::Mat full;
+        current.filterFunction(current.level, source, full);
+        // Worth keeping even if the slider has moved on, it may come back
+        cache.put(current.filterFunction, current.slider_value, current.src, full);
+        publish(full, current.generation);
+    }
+}
+
+bool TrackbarData::present(){
+    cv::Mat image;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!has_result) return false;
+        image = result;
+        has_result = false;
+    }
+    *dst = image;
+    cv::imshow(window_name, *dst);
+    return true;
 }
 
 static void trackbarCallback(int slider_value, void* trackbarData_vp){
     TrackbarData& data = *(TrackbarData*)(trackbarData_vp);
     data.applyFilter(slider_value);
-    cv::imshow("Image Processing", data.getDst());
+    data.present();
 }
 
 // I think you need to use a pointer to the base class TrackbarData in order
 // for it to dynamically cast the object and allow polymorphism.
 void createTrackbarWindow(TrackbarData* trackbarData){
-    int slider_value = 0;
-    cv::namedWindow("Image Processing", cv::WINDOW_AUTOSIZE);
+    cv::namedWindow(window_name, cv::WINDOW_AUTOSIZE);
     char trackbarName[50];
 
     std::sprintf(trackbarName, "Level x %d", trackbarData->getMaxValue());
-    cv::createTrackbar(trackbarName, "Image Processing", &slider_value,
+    cv::createTrackbar(trackbarName, window_name, trackbarData->getSliderValue(),
                        trackbarData->getMaxValue(), trackbarCallback, trackbarData);
 
-    trackbarCallback(slider_value, trackbarData);
+    trackbarCallback(*trackbarData->getSliderValue(), trackbarData);
+}
+
+int waitForKey(TrackbarData* trackbarData){
+    while(true){
+        int key = cv::waitKey(10);
+        trackbarData->present();
+        if(key != -1) return key;
+    }
 }
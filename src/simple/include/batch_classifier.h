@@ -0,0 +1,99 @@
+#ifndef SIMPLE_BATCH_CLASSIFIER_H
+#define SIMPLE_BATCH_CLASSIFIER_H
+
+#include <opencv2/core.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Classifiers which take a whole batch of samples at once, one sample per
+// row of a CV_32F matrix, with labels from 0 up.
+class BatchClassifier {
+public:
+    virtual ~BatchClassifier() {}
+    virtual void train(const cv::Mat &samples, const std::vector<int> &labels)=0;
+    // Fills labels with one label per row of samples
+    virtual void predict(const cv::Mat &samples, std::vector<int> &labels)const=0;
+    virtual std::string describe()const=0;
+};
+
+// Brute force k nearest neighbours, by squared euclidean distance.
+//
+// The training samples are kept in one matrix with the rows padded to a
+// multiple of the SIMD width. Distances come from |q|^2 + |t|^2 - 2 q.t,
+// with the dot products done 4 queries at a time, so each training row
+// loaded is used 4 times. Queries are taken in blocks and the training
+// rows in blocks small enough to stay in cache while every query of the
+// block goes past them. Each query keeps its k best in a sorted array,
+// and the blocks of queries run in parallel.
+class KnnClassifier: public BatchClassifier {
+public:
+    explicit KnnClassifier(int k = 5);
+
+    void train(const cv::Mat &samples, const std::vector<int> &labels);
+    // Majority vote of the k nearest, ties going to the label with the
+    // nearest sample
+    void predict(const cv::Mat &samples, std::vector<int> &labels)const;
+    std::string describe()const;
+
+    // CV_32S indices into the training samples and CV_32F squared
+    // distances, samples.rows x k, nearest first
+    void findNearest(const cv::Mat &samples, cv::Mat &indices, cv::Mat &distances)const;
+
+private:
+    int k;
+    int features;
+    cv::Mat train_samples; // Padded rows
+    std::vector<float> train_norms;
+    std::vector<int> train_labels;
+    int num_classes;
+};
+
+// One against the rest linear SVMs, trained with Pegasos (stochastic
+// sub-gradient descent on the primal), one class per thread.
+//
+// Features are standardised while training, and the scaling is folded
+// into the weights afterwards, so predicting is just a dot product with
+// each class's weights, done with the same SIMD kernel as KnnClassifier.
+class LinearSvmClassifier: public BatchClassifier {
+public:
+    struct Settings {
+        double lambda; // Regularisation
+        int epochs;
+        int seed;      // For the order samples are visited in
+
+        Settings(): lambda(1e-4), epochs(20), seed(1) {}
+    };
+
+    explicit LinearSvmClassifier(const Settings &settings = Settings());
+
+    void train(const cv::Mat &samples, const std::vector<int> &labels);
+    // The class with the highest score
+    void predict(const cv::Mat &samples, std::vector<int> &labels)const;
+    std::string describe()const;
+
+private:
+    Settings settings;
+    int features;
+    cv::Mat weights;           // One padded row per class
+    std::vector<float> biases;
+};
+
+struct ClassifierReport {
+    std::string name;
+    int train_samples, test_samples;
+    double train_ms, predict_ms;
+    double accuracy;           // Fraction of the test samples labelled correctly
+};
+
+// Trains the classifier, then predicts the test samples batch_size rows at
+// a time (all at once for 0), timing both
+ClassifierReport evaluateClassifier(BatchClassifier &classifier,
+                                    const cv::Mat &train_samples,
+                                    const std::vector<int> &train_labels,
+                                    const cv::Mat &test_samples,
+                                    const std::vector<int> &test_labels, int batch_size = 0);
+// Samples per second for training and predicting, and the accuracy
+void printReport(std::ostream &os, const ClassifierReport &report);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef SIMPLE_BLOCK_MATCHER_H
+#define SIMPLE_BLOCK_MATCHER_H
+
+#include <opencv2/core.hpp>
+
+// Disparity from a rectified pair of 8 bit gray images, by the sum of
+// absolute differences over a block, as cv::StereoBM does.
+//
+// Both images are first put through a horizontal Sobel clamped to
+// [-prefilter_cap, prefilter_cap], which takes out brightness differences
+// between the cameras. For each row, the absolute differences for every
+// disparity are kept as column sums over the block height, updated as the
+// block moves down, and summed across the block width. Costs are stored
+// disparity-fastest, with the right image flipped, so all the disparities
+// for a pixel are one contiguous load.
+//
+// With use_sgm the block costs are aggregated semi-globally along five
+// paths (left, right, up, and the two upper diagonals), which fills in
+// textureless areas much better, at a few times the cost. The path costs
+// are 16 bit, so with big blocks the costs and penalties are scaled down
+// to keep their sum from saturating.
+//
+// Rows are processed in parallel strips. The SGM paths from above can't
+// cross strips, so they are started sgm_overlap rows above each strip.
+class BlockMatcher {
+public:
+    struct Settings {
+        int num_disparities; // Multiple of 16
+        int block_size;      // Odd, 3 to 21
+        int prefilter_cap;   // 1 to 63
+        int uniqueness;      // Percent the best cost must beat the others by
+        bool use_sgm;
+        int P1, P2;          // SGM penalties, 0 for 8 and 32 per block pixel
+        int strip_rows;
+        int sgm_overlap;
+
+        Settings():
+            num_disparities(128), block_size(9), prefilter_cap(31), uniqueness(10),
+            use_sgm(false), P1(0), P2(0), strip_rows(32), sgm_overlap(24) {}
+    };
+
+    // Invalid pixels are given this, disparities are in 1/16 pixel
+    static const short invalid_disparity = -16;
+
+    explicit BlockMatcher(const Settings &settings = Settings());
+
+    // Disparity of each left pixel as CV_16S, scaled by 16 (as StereoBM)
+    void compute(const cv::Mat &left, const cv::Mat &right, cv::Mat &disparity);
+
+    const Settings &get_settings()const{ return settings; }
+
+private:
+    Settings settings;
+    cv::Mat left_filtered, right_filtered, right_flipped;
+    cv::Mat sobel;
+};
+
+#endif
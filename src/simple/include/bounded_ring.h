@@ -0,0 +1,180 @@
+#ifndef SIMPLE_BOUNDED_RING_H
+#define SIMPLE_BOUNDED_RING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+// Fixed size lock-free queue (Vyukov's bounded MPMC queue) for passing
+// frames between pipeline stages.
+//
+// Items are swapped in and out rather than copied, so whatever was in the
+// slot goes back to the caller. With cv::Mat members this means the same
+// few buffers keep circulating, and nothing is allocated once every slot
+// has been used.
+//
+// When the ring is full, push() either waits (BLOCK), or throws away the
+// oldest item to make space (DROP_OLDEST), which keeps a live camera from
+// falling behind. DROP_OLDEST expects a single producer.
+template <typename T>
+class BoundedRing {
+public:
+    enum Policy { BLOCK, DROP_OLDEST };
+
+    // Capacity is rounded up to a power of two
+    BoundedRing(std::size_t capacity, Policy policy):
+        policy(policy), closed(false), enqueue_pos(0), dequeue_pos(0),
+        pushed(0), popped(0), dropped(0), max_depth(0), depth_sum(0)
+    {
+        std::size_t size = 2;
+        while (size < capacity) size *= 2;
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (std::size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns false if the ring was closed, in which case item is untouched
+    bool push(T &item){
+        for (int attempt = 0; ; attempt++) {
+            if (closed.load(std::memory_order_acquire)) return false;
+            if (tryPush(item)) {
+                std::size_t d = depth();
+                pushed.fetch_add(1, std::memory_order_relaxed);
+                depth_sum.fetch_add(d, std::memory_order_relaxed);
+                if (d > max_depth.load(std::memory_order_relaxed)) {
+                    max_depth.store(d, std::memory_order_relaxed);
+                }
+                return true;
+            }
+            if (policy == DROP_OLDEST && tryPop(spare)) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            backoff(attempt);
+        }
+    }
+
+    // Waits for an item. Returns false once the ring is closed and empty.
+    bool pop(T &item){
+        for (int attempt = 0; ; attempt++) {
+            if (tryPop(item)) {
+                popped.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            if (closed.load(std::memory_order_acquire)) {
+                // Something may have been pushed just before closing
+                if (tryPop(item)) {
+                    popped.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                return false;
+            }
+            backoff(attempt);
+        }
+    }
+
+    // Wakes up everyone waiting. Items already queued can still be popped.
+    void close(){ closed.store(true, std::memory_order_release); }
+    bool isClosed()const{ return closed.load(std::memory_order_acquire); }
+
+    std::size_t capacity()const{ return mask + 1; }
+    // Approximate while other threads are using the ring
+    std::size_t depth()const{
+        std::size_t in = enqueue_pos.load(std::memory_order_relaxed);
+        std::size_t out = dequeue_pos.load(std::memory_order_relaxed);
+        return in > out ? in - out : 0;
+    }
+
+    std::size_t get_pushed()const{ return pushed.load(); }
+    std::size_t get_popped()const{ return popped.load(); }
+    std::size_t get_dropped()const{ return dropped.load(); }
+    std::size_t get_max_depth()const{ return max_depth.load(); }
+    double get_mean_depth()const{
+        std::size_t n = pushed.load();
+        return n == 0 ? 0 : (double)depth_sum.load()/n;
+    }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T data;
+    };
+
+    bool tryPush(T &item){
+        Cell *cell;
+        std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells[pos & mask];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            std::intptr_t diff = (std::intptr_t)seq - (std::intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // Full
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        std::swap(cell->data, item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T &item){
+        Cell *cell;
+        std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells[pos & mask];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            std::intptr_t diff = (std::intptr_t)seq - (std::intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // Empty
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        std::swap(item, cell->data);
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Spin briefly, then give the core away
+    static void backoff(int attempt){
+        if (attempt < 64) return;
+        if (attempt < 256) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    std::unique_ptr<Cell[]> cells;
+    std::size_t mask;
+    Policy policy;
+    T spare; // Where DROP_OLDEST puts the item it throws away
+    std::atomic<bool> closed;
+
+    // Kept on separate cache lines, producer and consumer both hammer them
+    alignas(64) std::atomic<std::size_t> enqueue_pos;
+    alignas(64) std::atomic<std::size_t> dequeue_pos;
+
+    alignas(64) std::atomic<std::size_t> pushed;
+    std::atomic<std::size_t> popped;
+    std::atomic<std::size_t> dropped;
+    std::atomic<std::size_t> max_depth;
+    std::atomic<std::size_t> depth_sum;
+};
+
+#endif
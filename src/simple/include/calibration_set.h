@@ -0,0 +1,82 @@
+#ifndef SIMPLE_CALIBRATION_SET_H
+#define SIMPLE_CALIBRATION_SET_H
+
+#include <opencv2/core.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+// One image of the chessboard
+struct CalibrationView {
+    std::string path;
+    std::string hash;  // Of the file contents
+    cv::Size image_size;
+    bool found;
+    std::vector<cv::Point2f> corners;
+};
+
+// Finds chessboard corners in sets of images, and calibrates cameras from
+// them.
+//
+// Images are read, hashed and searched in parallel. The corners found are
+// kept in a cache file, keyed by the hash of the image file, so running
+// again (after renaming, copying, or adding a few images) only searches
+// the images it hasn't seen.
+//
+// The cache also keeps each camera's last calibration, with the views it
+// used. Calibrating from the same views again just returns it, and
+// calibrating from more views starts from it.
+class CalibrationSet {
+public:
+    struct Settings {
+        cv::Size pattern_size;  // Interior corners
+        float square_size;
+        bool parallel;
+        bool use_cache;
+
+        Settings(): pattern_size(9, 6), square_size(0.025f), parallel(true), use_cache(true) {}
+    };
+
+    explicit CalibrationSet(const std::string &cache_path, const Settings &settings = Settings());
+
+    // Views of each image, in the same order. Images which can't be read
+    // have an empty size.
+    void detect(const std::vector<std::string> &paths, std::vector<CalibrationView> &views);
+
+    // Calibrates the camera from the views where the board was found.
+    // Returns the RMS reprojection error, or -1 if there were too few.
+    double calibrate(const std::string &camera, const std::vector<CalibrationView> &views,
+                     cv::Mat &camera_matrix, cv::Mat &dist_coeffs);
+
+    bool save()const;
+
+    // From the last detect() and calibrate()
+    int get_searched()const{ return searched; }
+    int get_cached()const{ return cached; }
+    bool get_reused()const{ return reused; }
+    bool get_incremental()const{ return incremental; }
+
+private:
+    struct Corners {
+        cv::Size image_size;
+        bool found;
+        std::vector<cv::Point2f> corners;
+    };
+    struct Result {
+        std::vector<std::string> hashes;  // Sorted
+        cv::Size image_size;
+        cv::Mat camera_matrix, dist_coeffs;
+        double rms;
+    };
+
+    void load();
+
+    std::string cache_path;
+    Settings settings;
+    std::map<std::string, Corners> corners;
+    std::map<std::string, Result> results;
+    int searched, cached;
+    bool reused, incremental;
+};
+
+#endif
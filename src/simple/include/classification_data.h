@@ -0,0 +1,37 @@
+#ifndef SIMPLE_CLASSIFICATION_DATA_H
+#define SIMPLE_CLASSIFICATION_DATA_H
+
+#include <opencv2/core.hpp>
+#include <string>
+#include <vector>
+
+// Cuts a sheet of digits like data/digits.png into its cells, read along
+// each row of cells. The sheet has rows_per_class rows of each digit in
+// turn, from 0. False if it couldn't be read.
+bool loadDigitSheet(const std::string &path, std::vector<cv::Mat> &digits,
+                    std::vector<int> &labels, int cell_size = 20, int rows_per_class = 5);
+
+// Shears the digit so that its second order moments say it's upright
+cv::Mat deskewDigit(const cv::Mat &digit);
+
+// Histograms of gradient directions, 16 bins weighted by magnitude, over
+// each quarter of the (optionally deskewed) digit, so 64 CV_32F features a
+// row. Each row is L1 normalised then square rooted (the Hellinger kernel),
+// so euclidean distance and dot products compare histograms sensibly.
+//
+// Digits are done in parallel batches, each writing straight into its rows
+// of the one matrix.
+cv::Mat digitHogFeatures(const std::vector<cv::Mat> &digits, bool deskew = true);
+
+// The UCI letter recognition data: a capital letter then 16 integer
+// features per line. Letters are labelled 0 for A up to 25.
+bool loadLetterData(const std::string &path, cv::Mat &samples, std::vector<int> &labels);
+
+// Shuffles the samples with the seed and puts test_fraction of them in the
+// test set
+void splitSamples(const cv::Mat &samples, const std::vector<int> &labels,
+                  double test_fraction, int seed,
+                  cv::Mat &train_samples, std::vector<int> &train_labels,
+                  cv::Mat &test_samples, std::vector<int> &test_labels);
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef SIMPLE_EDGE_OPERATIONS_H
+#define SIMPLE_EDGE_OPERATIONS_H
+
+#include "image_operation.h"
+#include "separable_filter.h"
+
+#include <vector>
+
+class SmoothOperation: public ImageOperation {
+public:
+    SmoothOperation(int ksize, double sigma);
+    void apply(const cv::Mat &gray);
+    void applyScaleSpace(const GaussianScaleSpace &scale_space);
+    int rowHalo()const{ return kernel.rows/2; }
+    void applyRows(const cv::Mat &src, cv::Mat &dst)const;
+private:
+    double sigma;
+    cv::Mat kernel;
+    FixedPointFilter filter;
+    cv::Mat upsampled;
+};
+
+// Gradient of gaussian, non-maximum suppression and hysteresis.
+// The gradient is scale normalised (multiplied by sigma), so a step edge
+// of height h gives a magnitude of roughly 0.4*h whatever the sigma, and
+// the thresholds mean the same thing at every scale.
+// Output is 255 on edges, 0 elsewhere.
+class CannyEdgeDetectorCustom: public ImageOperation {
+public:
+    CannyEdgeDetectorCustom(int ksize, double sigma,
+                            float low_threshold=8, float high_threshold=20);
+    void apply(const cv::Mat &gray);
+    // Takes the gradient from the smoothed level for this sigma. Levels
+    // which were decimated have their gradient upsampled, so the edges are
+    // still thinned at full resolution.
+    void applyScaleSpace(const GaussianScaleSpace &scale_space);
+    // The gradient kernels and non-maximum suppression. Hysteresis can
+    // follow an edge further than this.
+    int stencilRadius()const{ return kernel_smooth.rows/2 + 1; }
+
+    const cv::Mat &get_dsdx()const{ return dsdx; }
+    const cv::Mat &get_dsdy()const{ return dsdy; }
+    float get_low_threshold()const{ return low_threshold; }
+    float get_high_threshold()const{ return high_threshold; }
+private:
+    // Everything after the gradient: magnitude, NMS and hysteresis
+    void detect();
+    void suppressNonMaxima();
+    void hysteresis();
+
+    double sigma;
+    cv::Mat kernel_smooth;
+    cv::Mat kernel_deriv;
+    FixedPointFilter filter_x, filter_y;
+    float low_threshold, high_threshold;
+
+    cv::Mat dsdx, dsdy;
+    cv::Mat level_dx, level_dy;
+    // Both have a 1 pixel border of zeros, so the neighbourhood lookups in
+    // the inner loops never need bounds checks
+    cv::Mat ds_mag_padded;
+    cv::Mat edge_class_padded; // 0 = none, 1 = weak, 2 = strong
+    // Strong pixels found by each block of rows, used to seed hysteresis
+    std::vector<std::vector<uchar*>> seeds;
+    std::vector<uchar*> stack;
+};
+
+// Zero crossings of the laplacian of gaussian. A pixel is an edge if its
+// 3x3 neighbourhood has both positive and negative values. With min_swing
+// above 0, values within +-min_swing count as zero, which drops the weak
+// crossings that come from noise. Output is 255 on edges, 0 elsewhere.
+class MarrHildrethDetectorCustom: public ImageOperation {
+public:
+    MarrHildrethDetectorCustom(int ksize, double sigma, int min_swing=0);
+    void apply(const cv::Mat &gray);
+    // Uses the (scale normalised) 2D laplacian of the smoothed level for
+    // this sigma, upsampled if the level was decimated
+    void applyScaleSpace(const GaussianScaleSpace &scale_space);
+    // The laplacian kernel and the 3x3 zero crossing test
+    int stencilRadius()const{ return kernel.rows/2 + 1; }
+private:
+    void findZeroCrossings();
+
+    double sigma;
+    cv::Mat kernel;
+    cv::Mat d2s;
+    cv::Mat laplacian, laplacian_upsampled;
+    int min_swing;
+    // Per pixel sign of d2s, 1 = positive, 2 = negative, with a border of
+    // zeros (no sign) so the 3x3 lookups don't need bounds checks
+    cv::Mat signs_padded;
+};
+
+// Gaussian kernel size covering most of the weight for the given sigma,
+// capped at 31
+int gaussian_ksize(double sigma);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef SIMPLE_FNV_HASH_H
+#define SIMPLE_FNV_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 64 bit FNV-1a, for naming and keying caches by their contents
+std::uint64_t fnv1a64(const void *data, std::size_t size);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef SIMPLE_FRAME_ARENA_H
+#define SIMPLE_FRAME_ARENA_H
+
+#include <opencv2/core.hpp>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// A cv::MatAllocator which keeps the buffers of released Mats and hands
+// them out again for the next Mat of the same size. A loop which makes the
+// same images every frame (outputs, scratch images, and the temporaries
+// inside OpenCV functions) stops going to the heap once it has been round
+// once. The UMatData headers are recycled too.
+//
+// Use it for particular Mats by calling attach() before they are first
+// created, or for every Mat made on any thread with ScopedArena.
+//
+// Only cv::Mat buffers go through it. std::vectors and OpenCV's internal
+// AutoBuffers still use the heap.
+//
+// Releasing a Mat gives its buffer back to the arena it came from, so the
+// arena has to outlive every Mat it hands out. shared() is never destroyed
+// for that reason.
+class FrameArena: public cv::MatAllocator {
+public:
+    struct Counters {
+        std::size_t heap_allocations;  // Buffers which had to come from the heap
+        std::size_t reuses;            // Buffers handed out again
+        std::size_t bytes_held;        // In use or waiting to be reused
+        std::size_t bytes_in_use;
+        std::size_t peak_bytes_in_use;
+    };
+
+    FrameArena();
+    ~FrameArena();
+    static FrameArena &shared();
+
+    void attach(cv::Mat &mat){ mat.allocator = this; }
+    Counters get_counters()const;
+    // Gives the buffers nobody is using back to the heap
+    void trim();
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usage)const CV_OVERRIDE;
+    bool allocate(cv::UMatData *data, cv::AccessFlag flags,
+                  cv::UMatUsageFlags usage)const CV_OVERRIDE;
+    void deallocate(cv::UMatData *data)const CV_OVERRIDE;
+
+private:
+    mutable std::mutex mutex;
+    // Released buffers, by size in bytes
+    mutable std::map<std::size_t, std::vector<uchar*>> free_buffers;
+    // Memory for UMatData headers
+    mutable std::vector<void*> free_headers;
+    mutable Counters counters;
+};
+
+// Makes arena the allocator of every cv::Mat created until it is destroyed
+class ScopedArena {
+public:
+    explicit ScopedArena(FrameArena &arena);
+    ~ScopedArena();
+private:
+    ScopedArena(const ScopedArena&);
+    ScopedArena &operator=(const ScopedArena&);
+
+    cv::MatAllocator *previous;
+};
+
+#endif
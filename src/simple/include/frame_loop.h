@@ -0,0 +1,107 @@
+#ifndef SIMPLE_FRAME_LOOP_H
+#define SIMPLE_FRAME_LOOP_H
+
+#include "frame_arena.h"
+#include "frame_source.h"
+#include "pipeline.h"
+#include "trace.h"
+#include "undistort_operation.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Drives the capture loop of the demos. In the normal mode it behaves like
+// the old imshow/waitKey loop. In headless mode show() and waitKey() do
+// nothing, so the loop runs as fast as the processing allows, and the
+// time between getting a frame and "showing" the result is recorded.
+//
+//   FrameLoop loop(parser, "camera:0");
+//   while(loop.next(frame)){
+//       ... process ...
+//       loop.show("Frame", output);
+//       if((char)loop.waitKey(10) == 27) ...
+//   }
+//   loop.report(std::cout);
+//
+// Loops which can be written as "frame in, image out" can use run()
+// instead, which also supports running capture, processing and display on
+// separate threads (--pipeline).
+//
+// Capture, display, waitKey and each whole frame are timed with Trace,
+// alongside any TRACE_SCOPEs in the processing. --overlay draws their
+// rolling percentiles over the image, report() prints them, and --trace
+// writes everything out for chrome://tracing.
+//
+// With --undistort, frames are undistorted as they are read, using the
+// camera matrix and distortion from the given file.
+//
+// With --arena, every cv::Mat is allocated from FrameArena::shared(), and
+// report() says how many heap allocations each frame needed after the
+// first few.
+class FrameLoop {
+public:
+    // Command line keys understood by the constructor, for use with
+    // cv::CommandLineParser. Demos append their own keys to this.
+    static const char *const keys;
+
+    FrameLoop(const cv::CommandLineParser &parser, const std::string &default_source);
+    // Reads from the given source instead of --source
+    FrameLoop(const cv::CommandLineParser &parser, std::unique_ptr<FrameSource> source);
+
+    bool isOpened()const{ return source && source->isOpened(); }
+    bool isHeadless()const{ return headless; }
+    const FrameSource &getSource()const{ return *source; }
+
+    bool next(cv::Mat &frame);
+    void show(const std::string &window, const cv::Mat &image);
+    int waitKey(int delay);
+
+    typedef Pipeline::ProcessFunction ProcessFunction;
+    // Gets the key pressed after each frame (-1 if none), returns false to stop
+    typedef std::function<bool(int key)> KeyFunction;
+    // Runs process on every frame and shows the result. With --pipeline,
+    // process is called from a worker thread, so anything it shares with
+    // on_key needs to be thread safe.
+    void run(const std::string &window, int delay,
+             const ProcessFunction &process, const KeyFunction &on_key);
+
+    int getFrameCount()const{ return frame_count; }
+    void report(std::ostream &os)const;
+
+private:
+    bool read(cv::Mat &frame);
+    void finishFrame();
+    void display(const std::string &window, const cv::Mat &image);
+    void undistortFrame(cv::Mat &frame);
+    void countAllocations();
+
+    std::unique_ptr<FrameSource> source;
+    bool headless;
+    bool loop;
+    int max_frames;
+    bool pipelined;
+    int ring_size;
+    bool drop;
+    bool overlay;
+    std::string trace_path;
+    std::unique_ptr<Pipeline> pipeline;
+    cv::Mat overlay_image;
+    std::string intrinsics_path;
+    std::unique_ptr<UndistortOperation> undistorter;
+    cv::Mat distorted;
+    std::unique_ptr<ScopedArena> arena_scope;
+    // Heap allocations by the arena, as each frame finished
+    std::vector<std::size_t> arena_allocations;
+
+    int frame_count;
+    bool frame_open;
+    int64 start_ticks;
+    int64 end_ticks;
+    int64 frame_ticks;
+    double read_ms;
+    std::vector<double> latencies_ms;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef SIMPLE_FRAME_SOURCE_H
+#define SIMPLE_FRAME_SOURCE_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Anything that can hand out frames. read() returns false once the source
+// is exhausted (or the device fails), which replaces the old
+// "video >> frame; if(frame.empty()) break;" pattern.
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+    virtual bool read(cv::Mat &frame)=0;
+    virtual bool isOpened()const=0;
+    // Cameras and the synthetic generator never run out by themselves
+    virtual bool isBounded()const=0;
+    // Go back to the first frame, if the source supports it
+    virtual bool rewind(){ return false; }
+    virtual std::string describe()const=0;
+};
+
+// Live camera or video file, both go through cv::VideoCapture
+class VideoCaptureSource: public FrameSource {
+public:
+    explicit VideoCaptureSource(int device);
+    explicit VideoCaptureSource(const std::string &filename);
+    bool read(cv::Mat &frame);
+    bool isOpened()const{ return video.isOpened(); }
+    bool isBounded()const{ return bounded; }
+    bool rewind();
+    std::string describe()const{ return name; }
+private:
+    cv::VideoCapture video;
+    bool bounded;
+    std::string name;
+};
+
+// Still images matched by a glob, eg: data/left*.jpg
+// Decoded images are kept, so replaying the sequence doesn't pay for
+// decoding again.
+class ImageSequenceSource: public FrameSource {
+public:
+    explicit ImageSequenceSource(const std::string &pattern);
+    bool read(cv::Mat &frame);
+    bool isOpened()const{ return !files.empty(); }
+    bool isBounded()const{ return true; }
+    bool rewind(){ index = 0; return true; }
+    std::string describe()const;
+private:
+    std::string pattern;
+    std::vector<cv::String> files;
+    std::vector<cv::Mat> images;
+    std::size_t index;
+};
+
+// Generated frames (gradient background, moving shapes and noise), so the
+// demos can run on machines without a camera or data files.
+class SyntheticSource: public FrameSource {
+public:
+    explicit SyntheticSource(cv::Size size);
+    bool read(cv::Mat &frame);
+    bool isOpened()const{ return true; }
+    bool isBounded()const{ return false; }
+    bool rewind(){ count = 0; return true; }
+    std::string describe()const;
+private:
+    cv::Size size;
+    cv::Mat background;
+    cv::Mat noise;
+    int count;
+};
+
+// Two sources read together and packed side by side into one frame, so a
+// stereo pair stays paired however frames are dropped later on. Both have
+// to give frames of the same size and type. Runs out when either does.
+class SideBySideSource: public FrameSource {
+public:
+    SideBySideSource(std::unique_ptr<FrameSource> left, std::unique_ptr<FrameSource> right);
+    bool read(cv::Mat &frame);
+    bool isOpened()const{ return left->isOpened() && right->isOpened(); }
+    bool isBounded()const{ return left->isBounded() || right->isBounded(); }
+    bool rewind(){ return left->rewind() && right->rewind(); }
+    std::string describe()const;
+private:
+    std::unique_ptr<FrameSource> left, right;
+    cv::Mat left_frame, right_frame;
+};
+
+// Spec is one of:
+//   camera:N        (or just N)
+//   video:PATH      (or a path to a video file)
+//   images:GLOB     (or a path containing '*')
+//   synthetic:WxH   (or just "synthetic" for 640x480)
+// Relative paths are also looked up in the "data" directory.
+// Returns an empty pointer if the spec can't be parsed.
+std::unique_ptr<FrameSource> openFrameSource(const std::string &spec);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef SIMPLE_HAMMING_MATCHER_H
+#define SIMPLE_HAMMING_MATCHER_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+// Nearest neighbour matching of binary descriptors (eg: ORB, 32 bytes a
+// row) by Hamming distance.
+//
+// Without an index, every query is compared with every reference
+// descriptor, 128 bits at a time (XOR, per byte popcount, then a sum).
+// Queries are matched in parallel, and the caller can hand over as many
+// at once as it likes.
+//
+// With use_index, the reference set gets a multi-index hash: each
+// descriptor is split into 16 bit pieces, with a table per piece. Two
+// descriptors within distance d have at least one piece within
+// d/pieces of each other, so probing each table at the query's piece and
+// the keys differing from it by up to probe_bits bits finds every match
+// closer than pieces*(probe_bits + 1), and usually the further ones too,
+// while only comparing against a small fraction of the set.
+class HammingMatcher {
+public:
+    struct Settings {
+        bool use_index;
+        int probe_bits;    // 0 or 1
+        double ratio;      // Lowe's ratio test, 0 to turn it off
+        bool cross_check;  // Keep matches which are mutual best matches
+
+        Settings(): use_index(false), probe_bits(1), ratio(0.8), cross_check(false) {}
+    };
+
+    // Best and second best reference descriptor for a query. Indexes are
+    // -1 and distances INT_MAX when there aren't that many candidates.
+    struct Neighbours {
+        int best, second;
+        int best_distance, second_distance;
+    };
+
+    explicit HammingMatcher(const Settings &settings = Settings());
+
+    // Rows of descriptors, 8 bit. Keeps a reference, not a copy.
+    void train(const cv::Mat &descriptors);
+    void knn2(const cv::Mat &queries, std::vector<Neighbours> &neighbours)const;
+    // Nearest neighbours filtered by the ratio test and cross check.
+    // queryIdx is the query row, trainIdx the reference row.
+    void match(const cv::Mat &queries, std::vector<cv::DMatch> &matches)const;
+
+    // Average number of reference descriptors compared per query in the
+    // last knn2(), to see how much the index saves
+    double get_candidates_per_query()const{ return candidates_per_query; }
+
+private:
+    void knnBrute(const cv::Mat &queries, std::vector<Neighbours> &neighbours)const;
+    void knnIndex(const cv::Mat &queries, std::vector<Neighbours> &neighbours)const;
+
+    Settings settings;
+    cv::Mat train_descriptors;
+
+    // One table per 16 bit piece, as buckets of reference rows:
+    // bucket k of table t is ids[t][offsets[t][k] .. offsets[t][k + 1])
+    int pieces;
+    std::vector<std::vector<int>> offsets, ids;
+
+    mutable double candidates_per_query;
+};
+
+int hammingDistance(const uchar *a, const uchar *b, int bytes);
+
+// RANSAC homography from matched keypoints. Returns an empty matrix if
+// there are fewer than 4 matches, otherwise fills inliers with the matches
+// it agrees with.
+cv::Mat matchedHomography(const std::vector<cv::KeyPoint> &query_keypoints,
+                          const std::vector<cv::KeyPoint> &train_keypoints,
+                          const std::vector<cv::DMatch> &matches,
+                          std::vector<cv::DMatch> &inliers, double threshold = 3);
+
+#endif
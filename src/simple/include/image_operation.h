@@ -0,0 +1,49 @@
+#ifndef SIMPLE_IMAGE_OPERATION_H
+#define SIMPLE_IMAGE_OPERATION_H
+
+#include "scale_space.h"
+
+#include <opencv2/core.hpp>
+
+class ImageOperation {
+public:
+    virtual ~ImageOperation() {}
+    virtual void apply(const cv::Mat &gray)=0;
+    // Same as apply(), but operations which start by smoothing can take the
+    // smoothed image from a scale space shared with other operations
+    virtual void applyScaleSpace(const GaussianScaleSpace &scale_space){
+        apply(scale_space.get_source());
+    }
+    const cv::Mat &get_output()const{ return output; }
+
+    // Operations where each output row only depends on a few input rows
+    // either side can also be run a band of rows at a time, which lets
+    // OperationChain fuse them. Returns how many rows either side are
+    // needed, or -1 for operations which need the whole image.
+    virtual int rowHalo()const{ return -1; }
+    // How far, in pixels, a change to the input can reach in the output,
+    // for IncrementalChain. -1 if it can reach anywhere. The same as
+    // rowHalo() unless an operation overrides it.
+    virtual int stencilRadius()const{ return rowHalo(); }
+    // Output type for the given input type, for row operations
+    virtual int outputType(int input_type)const{ return input_type; }
+    // For row operations: fills dst, which is already allocated with the
+    // same rows as src and outputType(). src may be a view of a bigger
+    // image, in which case the rows either side of it are used instead of
+    // the border (cv::filter2D and friends already do this). Called from
+    // several threads at once.
+    virtual void applyRows(const cv::Mat &src, cv::Mat &dst)const{
+        CV_Error(cv::Error::StsNotImplemented, "Operation can't be run a band at a time");
+    }
+
+protected:
+    // apply() for row operations
+    void applyAllRows(const cv::Mat &src){
+        output.create(src.size(), outputType(src.type()));
+        applyRows(src, output);
+    }
+
+    cv::Mat output;
+};
+
+#endif
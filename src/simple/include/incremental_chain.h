@@ -0,0 +1,84 @@
+#ifndef SIMPLE_INCREMENTAL_CHAIN_H
+#define SIMPLE_INCREMENTAL_CHAIN_H
+
+#include "image_operation.h"
+
+#include <cstddef>
+#include <vector>
+
+// Runs operations one after another like OperationChain, but only
+// recomputes the parts of the image which changed, for cameras looking at
+// mostly static scenes.
+//
+// The image is split into square tiles. Each frame is shrunk by
+// settings.downsample and compared with the shrunk frame each tile was
+// last computed from, and tiles whose mean absolute difference is over
+// settings.threshold are marked as changed. Comparing with the last
+// computed frame rather than the previous one means slow changes still add
+// up to a recompute.
+//
+// Each operation then recomputes the tiles which changed in its input,
+// grown by its stencilRadius(), from the previous operation's output, and
+// keeps its earlier output everywhere else. An operation with a radius of
+// -1 recomputes the whole image if anything changed.
+//
+// Results away from the changed tiles come from older frames, and
+// operations like Canny's hysteresis reach further than their radius, so
+// every settings.refresh_interval frames everything is recomputed.
+//
+// The chain doesn't own the operations. They are run on views of parts of
+// the image, so mustn't be shared with anything that needs their outputs
+// to be whole frames.
+class IncrementalChain: public ImageOperation {
+public:
+    struct Settings {
+        int tile_size;        // In pixels, a multiple of downsample
+        int downsample;
+        double threshold;     // Mean absolute grey level difference of a tile
+        int refresh_interval; // 0 = only the first frame
+
+        Settings(): tile_size(32), downsample(4), threshold(3), refresh_interval(30) {}
+    };
+
+    explicit IncrementalChain(const Settings &settings = Settings());
+
+    IncrementalChain &add(ImageOperation &operation);
+    void apply(const cv::Mat &image);
+    // The next frame is computed in full
+    void refresh(){ refreshing = true; }
+
+    // CV_8U, one pixel per tile, 255 where the last frame changed
+    const cv::Mat &get_change_mask()const{ return change_mask; }
+    // Fraction of the tiles which changed in the last frame
+    double get_changed_fraction()const{ return changed_fraction; }
+    // Pixels run through each operation in the last frame, including the
+    // borders around the tiles, as a fraction of running every operation
+    // on the whole image
+    double get_computed_fraction()const{ return computed_fraction; }
+    bool was_full_frame()const{ return full_frame; }
+
+private:
+    void findChanges(const cv::Mat &image);
+    // Recomputes the tiles set in dirty for operation i, from input
+    void applyTiles(std::size_t i, const cv::Mat &input, const cv::Mat &dirty, int radius);
+
+    Settings settings;
+    std::vector<ImageOperation*> operations;
+    // Full size output of each operation, kept between frames
+    std::vector<cv::Mat> outputs;
+
+    cv::Size size;
+    int type;
+    cv::Size tiles;
+    cv::Mat small, reference; // Shrunk grey frames, now and as last computed
+    cv::Mat difference;
+    cv::Mat change_mask;
+    int frames_since_refresh;
+    bool refreshing;
+
+    double changed_fraction;
+    double computed_fraction;
+    bool full_frame;
+};
+
+#endif
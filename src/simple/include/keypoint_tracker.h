@@ -0,0 +1,85 @@
+#ifndef SIMPLE_KEYPOINT_TRACKER_H
+#define SIMPLE_KEYPOINT_TRACKER_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+// Detects keypoints on keyframes and tracks them in between, instead of
+// detecting on every frame.
+//
+// The image is divided into a grid. Keypoints are tracked from frame to
+// frame with pyramidal Lucas-Kanade, reusing the pyramid built for the
+// previous frame. Cells left with too few keypoints (things moved out of
+// view, or tracks were lost) are detected in again, and only those cells.
+// Cells are detected in parallel, each keeping its strongest responses,
+// which spreads keypoints evenly over the image rather than letting a few
+// textured areas take them all. Every keyframe_interval frames everything
+// is detected again from scratch, so drift doesn't build up.
+class KeypointTracker {
+public:
+    typedef std::function<cv::Ptr<cv::Feature2D>()> DetectorFactory;
+
+    struct Settings {
+        int grid_cols, grid_rows;
+        int max_per_cell;
+        int min_per_cell;       // Fewer than this and the cell is detected in again
+        double min_distance;    // Between a new keypoint and the ones already in the cell
+        int border;             // Extra pixels detected in around each cell
+        int keyframe_interval;  // 0 = only the first frame
+        cv::Size window;
+        int pyramid_levels;
+
+        Settings():
+            grid_cols(8), grid_rows(6), max_per_cell(10), min_per_cell(3),
+            min_distance(8), border(16), keyframe_interval(60),
+            window(21, 21), pyramid_levels(3) {}
+    };
+
+    // Detectors aren't safe to share between threads, so the factory is
+    // used to make one for each thread
+    KeypointTracker(const DetectorFactory &factory, const Settings &settings = Settings());
+
+    // Takes the next frame, 8 bit grey
+    void update(const cv::Mat &gray);
+    // Makes the next frame a keyframe, eg: after frames were skipped
+    void restart(){ restarting = true; }
+    const std::vector<cv::KeyPoint> &get_keypoints()const{ return keypoints; }
+    // Frames tracked (since the last detection) of each keypoint
+    const std::vector<int> &get_ages()const{ return ages; }
+
+    // Keypoints per second of update() time, the fraction of keypoints
+    // surviving each tracked frame, and how many were detected
+    void report(std::ostream &os)const;
+    double get_keypoints_per_second()const;
+    double get_survival()const;
+
+private:
+    void track(const cv::Mat &gray);
+    void detect(const cv::Mat &gray, bool keyframe);
+    cv::Rect cell(int col, int row, cv::Size size)const;
+
+    DetectorFactory factory;
+    Settings settings;
+    std::vector<cv::Ptr<cv::Feature2D>> detectors;
+
+    std::vector<cv::Mat> pyramid, prev_pyramid;
+    std::vector<cv::KeyPoint> keypoints;
+    std::vector<int> ages;
+    cv::Size size;
+    int frame;
+    bool restarting;
+
+    std::vector<cv::Point2f> prev_points, next_points;
+    std::vector<uchar> status;
+    std::vector<float> errors;
+
+    // Statistics
+    double total_ms;
+    std::size_t keypoints_out, tracked_in, tracked_out, detected;
+    int detection_frames;
+};
+
+#endif
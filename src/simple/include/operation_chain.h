@@ -0,0 +1,58 @@
+#ifndef SIMPLE_OPERATION_CHAIN_H
+#define SIMPLE_OPERATION_CHAIN_H
+
+#include "image_operation.h"
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Runs operations one after another, each on the output of the one before.
+//
+// Consecutive row operations (rowHalo() >= 0) are fused. The image is cut
+// into strips of rows, and each strip goes through every operation of the
+// run using band buffers small enough to stay in cache, so only the run's
+// input and final output travel to and from memory. Each stage also
+// computes the extra rows the stages after it need (the sum of their
+// halos), so a strip never needs anything from its neighbours, and the
+// strips are run in parallel. Operations which need the whole image run on
+// their own in between runs.
+//
+// The chain doesn't own the operations, and an operation can be part of
+// several chains.
+class OperationChain: public ImageOperation {
+public:
+    // With strip_rows = 0 every operation runs on the whole image, which
+    // is only useful for comparison
+    explicit OperationChain(int strip_rows = 32);
+
+    OperationChain &add(ImageOperation &operation);
+    void set_strip_rows(int strip_rows){ this->strip_rows = strip_rows; }
+
+    void apply(const cv::Mat &image);
+    // The sum of the operations' radii
+    int stencilRadius()const;
+
+    // Estimated bytes read and written by the last apply(), counting full
+    // size images and the strips read from them, on the assumption that
+    // the band buffers never leave the cache
+    std::size_t get_bytes_moved()const{ return bytes_moved; }
+
+private:
+    // Runs operations [begin, end), which are all row operations
+    void applyFused(std::size_t begin, std::size_t end, const cv::Mat &src, cv::Mat &dst);
+
+    std::vector<ImageOperation*> operations;
+    int strip_rows;
+    std::size_t bytes_moved;
+    // Full size output of each fused run, in the order they are run
+    std::vector<cv::Mat> run_outputs;
+};
+
+// Times the chain on image, fused and then every operation on the whole
+// image, and prints the time and bytes moved per frame for each
+void compareChainModes(std::ostream &os, const std::string &name, OperationChain &chain,
+                       const cv::Mat &image, int repeats = 10);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SIMPLE_PIPELINE_H
+#define SIMPLE_PIPELINE_H
+
+#include "bounded_ring.h"
+
+#include <opencv2/core.hpp>
+#include <functional>
+#include <iostream>
+
+struct PipelineFrame {
+    cv::Mat frame;  // As captured
+    cv::Mat result; // Filled in by the processing stage
+    int index;
+    int64 capture_ticks;
+};
+
+// Runs capture, processing and presentation on separate threads, connected
+// by bounded rings, so capture I/O, processing and GUI latency overlap
+// instead of adding up:
+//
+//   capture thread -> [capture ring] -> process thread -> [result ring]
+//       -> calling thread (present)
+//
+// Presentation stays on the calling thread, since HighGUI wants to be
+// driven from the main thread.
+class Pipeline {
+public:
+    typedef BoundedRing<PipelineFrame> Ring;
+    // Fill in the frame, return false when there are no more
+    typedef std::function<bool(cv::Mat &frame)> CaptureFunction;
+    typedef std::function<void(const cv::Mat &frame, cv::Mat &result)> ProcessFunction;
+    // Return false to stop the pipeline
+    typedef std::function<bool(const PipelineFrame &frame)> PresentFunction;
+
+    Pipeline(std::size_t capacity, Ring::Policy policy);
+
+    // Returns once capture runs out or present returns false
+    void run(const CaptureFunction &capture, const ProcessFunction &process,
+             const PresentFunction &present);
+
+    // Queue depth and drop counters for each ring
+    void report(std::ostream &os)const;
+
+private:
+    Ring capture_ring;
+    Ring result_ring;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef SIMPLE_ROW_OPERATIONS_H
+#define SIMPLE_ROW_OPERATIONS_H
+
+#include "image_operation.h"
+
+#include <algorithm>
+
+// Small operations for building OperationChains. All but NormalizeOperation
+// can be run a band of rows at a time.
+
+// cv::cvtColor. output_type has to be given, since it depends on the code.
+class ColorConvertOperation: public ImageOperation {
+public:
+    ColorConvertOperation(int code, int output_type);
+    void apply(const cv::Mat &image){ applyAllRows(image); }
+    int rowHalo()const{ return 0; }
+    int outputType(int)const{ return output_type; }
+    void applyRows(const cv::Mat &src, cv::Mat &dst)const;
+private:
+    int code;
+    int output_type;
+};
+
+// Flips left to right, like a mirror
+class MirrorOperation: public ImageOperation {
+public:
+    void apply(const cv::Mat &image){ applyAllRows(image); }
+    int rowHalo()const{ return 0; }
+    // Pixels move from one side to the other
+    int stencilRadius()const{ return -1; }
+    void applyRows(const cv::Mat &src, cv::Mat &dst)const;
+};
+
+class GaussianBlurOperation: public ImageOperation {
+public:
+    GaussianBlurOperation(int ksize, double sigma);
+    void apply(const cv::Mat &image){ applyAllRows(image); }
+    int rowHalo()const{ return ksize/2; }
+    void applyRows(const cv::Mat &src, cv::Mat &dst)const;
+private:
+    int ksize;
+    double sigma;
+};
+
+// cv::filter2D, with the anchor in the middle of the kernel
+class Filter2DOperation: public ImageOperation {
+public:
+    Filter2DOperation(const cv::Mat &kernel, int ddepth = -1);
+    void apply(const cv::Mat &image){ applyAllRows(image); }
+    int rowHalo()const{ return kernel.rows/2; }
+    int stencilRadius()const{ return std::max(kernel.rows, kernel.cols)/2; }
+    int outputType(int input_type)const;
+    void applyRows(const cv::Mat &src, cv::Mat &dst)const;
+private:
+    cv::Mat kernel;
+    int ddepth;
+};
+
+// Magnitude of the 3x3 Sobel gradient, for 8 bit single channel images.
+// Each component is saturated to 8 bits first, as when calling cv::Sobel
+// with CV_8U, so only rising edges (left to right, top to bottom) show.
+// Does the two Sobels, the magnitude and the conversion back to 8 bits in
+// one pass per band.
+class SobelMagnitudeOperation: public ImageOperation {
+public:
+    void apply(const cv::Mat &image){ applyAllRows(image); }
+    int rowHalo()const{ return 1; }
+    void applyRows(const cv::Mat &src, cv::Mat &dst)const;
+};
+
+// Stretches the values to [0, 255] (cv::NORM_MINMAX). Needs the minimum
+// and maximum of the whole image, so can't be run by rows.
+class NormalizeOperation: public ImageOperation {
+public:
+    explicit NormalizeOperation(int dtype = -1): dtype(dtype) {}
+    void apply(const cv::Mat &image);
+private:
+    int dtype;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef SIMPLE_SCALE_SPACE_H
+#define SIMPLE_SCALE_SPACE_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+struct ScaleLevel {
+    double sigma;     // In full resolution pixels
+    int octave;       // The image is downsampled by 2^octave
+    cv::Mat smoothed; // CV_32F
+
+    double scale()const{ return (double)(1 << octave); }
+    // Sigma in the pixels of this level
+    double octave_sigma()const{ return sigma/scale(); }
+};
+
+// Gaussian smoothed copies of a frame at a fixed set of sigmas, built once
+// per frame so a bank of detectors at different scales can share them.
+//
+// Each level is blurred from the one below it, using
+//   sigma_k^2 = sigma_(k-1)^2 + sigma_increment^2
+// so the kernels stay small. With decimate set, once the increment needs a
+// kernel bigger than max_ksize the image is halved first, so large sigmas
+// don't need huge kernels (or the 31 tap cap of gaussian_ksize).
+class GaussianScaleSpace {
+public:
+    GaussianScaleSpace(const std::vector<double> &sigmas, bool decimate=false,
+                       int max_ksize=31);
+    void build(const cv::Mat &gray);
+
+    const cv::Mat &get_source()const{ return source; }
+    const std::vector<ScaleLevel> &get_levels()const{ return levels; }
+    // The level for one of the sigmas passed to the constructor
+    const ScaleLevel &find(double sigma)const;
+
+private:
+    std::vector<ScaleLevel> levels; // Ascending sigma
+    bool decimate;
+    int max_ksize;
+
+    cv::Mat source;
+    cv::Mat base;
+    cv::Mat anti_alias;
+    std::vector<cv::Mat> octaves;
+};
+
+// Kernel size covering most of a gaussian's weight, without a cap
+int gaussian_ksize_uncapped(double sigma);
+
+#endif
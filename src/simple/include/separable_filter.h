@@ -0,0 +1,51 @@
+#ifndef SIMPLE_SEPARABLE_FILTER_H
+#define SIMPLE_SEPARABLE_FILTER_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+// Separable filtering of CV_8UC1 images in fixed point, for the small
+// gaussian and derivative of gaussian kernels the edge operations use.
+//
+// One of the two kernels must be non-negative and sum to at most 1 (a
+// smoothing kernel). That pass goes first, with 8 bit taps, into 16 bit
+// rows rounded to 7 bits, so 255*128 fits in a short. The other kernel
+// can have any sign and goes second, with 12 bit taps and 32 bit sums,
+// which are then rounded to CV_8U or scaled to CV_32F.
+//
+// Both passes are instantiated for each radius up to max_radius (a
+// gaussian with sigma 3, from gaussian_ksize()), so the taps are fully
+// unrolled. Anything else (longer or mismatched kernels, neither kernel
+// smoothing, other depths) falls back to cv::sepFilter2D.
+//
+// Borders are the same as cv::sepFilter2D's default: if src is a view of a
+// bigger image the pixels around it are used, and BORDER_REFLECT_101 at
+// the edges of that image. The rows are done in parallel strips.
+class FixedPointFilter {
+public:
+    static const int max_radius = 11;
+
+    // Takes the generic path with empty kernels, until assigned
+    FixedPointFilter(): radius(0), rows_first(true) {}
+    // Kernels as from cv::getGaussianKernel, any float type and either
+    // orientation
+    FixedPointFilter(const cv::Mat &row_kernel, const cv::Mat &column_kernel);
+
+    // ddepth is CV_8U or CV_32F. The result is multiplied by scale.
+    void apply(const cv::Mat &src, cv::Mat &dst, int ddepth, double scale = 1)const;
+
+    // False if apply() always takes the generic path
+    bool isFixedPoint()const{ return radius > 0; }
+    int get_radius()const{ return radius; }
+
+private:
+    void applyStrip(const cv::Mat &src, cv::Mat &dst, int begin, int end, float scale)const;
+
+    cv::Mat row_kernel, column_kernel; // CV_32F, for the generic path
+    int radius;                        // 0 if the kernels aren't supported
+    bool rows_first;                   // The row kernel is the smoothing one
+    std::vector<ushort> first_taps;    // Q8
+    std::vector<short> second_taps;    // Q12
+};
+
+#endif
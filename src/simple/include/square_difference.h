@@ -0,0 +1,20 @@
+#ifndef SIMPLE_SQUARE_DIFFERENCE_H
+#define SIMPLE_SQUARE_DIFFERENCE_H
+
+#include <opencv2/core.hpp>
+
+// dest(p) = sum over the window of window(d)*(src(p + d - anchor) - src(p))^2
+//
+// src must be single channel CV_8U. Taps falling outside the image are
+// skipped. ddepth picks the output depth: CV_8U or CV_32S (both saturate),
+// or CV_32F.
+//
+// How it's computed depends on the window:
+// - Uniform (eg: cv::Mat::ones): expands to box sums of src and src^2,
+//   which come from integral images in O(1) per pixel for any window size.
+// - Separable (rank 1): the same expansion, with three separable filters.
+// - Anything else: directly, O(window area) per pixel.
+void weightedSquareDifference(const cv::Mat& src, cv::Mat& dest, const cv::Mat& window,
+                              cv::Point anchor = cv::Point(-1, -1), int ddepth = CV_8U);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef SIMPLE_STEREO_RECTIFIER_H
+#define SIMPLE_STEREO_RECTIFIER_H
+
+#include <opencv2/core.hpp>
+#include <string>
+#include <vector>
+
+// Intrinsics of both cameras, and the pose of the right camera relative
+// to the left
+struct StereoCalibration {
+    cv::Mat M1, D1, M2, D2;
+    cv::Mat R, T;
+    cv::Size size;
+
+    // Reads M1, D1, M2 and D2, as written by OpenCV's stereo_calib sample
+    bool readIntrinsics(const std::string &path);
+    // Finds the chessboard in each left/right pair of image_list (left
+    // first) and solves for R and T, keeping the intrinsics fixed. Returns
+    // the RMS reprojection error, or -1 if too few pairs were usable.
+    double calibrateExtrinsics(const std::vector<std::string> &image_list,
+                               cv::Size pattern_size, float square_size);
+};
+
+// Rectifies stereo pairs, so matching pixels lie on the same row.
+//
+// The remap tables are computed once, and kept in the fixed point form
+// (CV_16SC2 integer coordinates plus a CV_16UC1 interpolation table index)
+// which cv::remap handles fastest, at 6 bytes a pixel rather than 8 for two
+// float maps.
+class StereoRectifier {
+public:
+    StereoRectifier() {}
+    // alpha as for cv::stereoRectify: 0 crops to valid pixels, 1 keeps all
+    void init(const StereoCalibration &calibration, double alpha = 0);
+    bool empty()const{ return left_maps[0].empty(); }
+    cv::Size get_size()const{ return size; }
+
+    void rectify(const cv::Mat &left, const cv::Mat &right,
+                 cv::Mat &left_rectified, cv::Mat &right_rectified)const;
+
+    // Reprojects disparities to depth, see cv::reprojectImageTo3D
+    const cv::Mat &get_Q()const{ return Q; }
+    std::size_t get_map_bytes()const;
+
+private:
+    cv::Mat left_maps[2], right_maps[2];
+    cv::Mat Q;
+    cv::Size size;
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef SIMPLE_TEMPLATE_MATCHER_H
+#define SIMPLE_TEMPLATE_MATCHER_H
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+struct TemplateMatch {
+    cv::Point location; // Top left corner of the best window, (-1, -1) if none
+    double score;       // As from cv::matchTemplate with TM_SQDIFF or TM_CCOEFF_NORMED
+};
+
+// Finds the best window of a frame for each of a set of templates, like
+// taking the min or max of cv::matchTemplate, but searching coarse to fine.
+//
+// Frames and templates are made grey and CV_8U, and put into pyramids with
+// cv::pyrDown. Each template is searched for in full at the coarsest level
+// where it's still settings.min_size pixels across, keeping its
+// settings.candidates best windows (apart from each other). Each candidate
+// is then followed down the pyramid, searching settings.refine_radius
+// pixels around it at each level, and the best at full size wins.
+//
+// Most windows are ruled out without finishing them, using the sums of the
+// frame and its square over each window, from integral images made once per
+// frame and shared by all the templates:
+// - SSD: the window's sum of squared differences is at least
+//   (|I| - |T|)^2 and (sum I - sum T)^2/n, so it's skipped if either is
+//   worse than the candidates so far (successive elimination). Otherwise
+//   the rows are added up, stopping once the partial sum is worse.
+// - NCC: after each row, the correlation of the template (less its mean)
+//   with the remaining rows is at most |I_rest - mean_I||T'_rest| plus
+//   mean_I times the sum of T'_rest (Cauchy-Schwarz), which bounds the
+//   final score, and the window is dropped once that can't beat the
+//   candidates.
+// Neither drops a window which would have been kept, so the pruning
+// doesn't change what's found.
+//
+// Templates are matched in parallel. Missing the best window is possible
+// when it doesn't stand out at the coarse levels, hence the candidates.
+//
+// match() keeps the frame's pyramid and the stats between calls, so each
+// thread needs its own matcher.
+class TemplateMatcher {
+public:
+    enum Method { SSD, NCC };
+
+    struct Settings {
+        Method method;
+        int max_levels;    // Pyramid levels above full size
+        int min_size;      // Smallest template side at the coarsest level
+        int candidates;    // Windows followed down from the coarsest level
+        int refine_radius; // Pixels searched around each at the next level
+
+        Settings(): method(NCC), max_levels(4), min_size(12), candidates(4), refine_radius(2) {}
+    };
+
+    // Windows looked at over the last frame, for all the templates
+    struct Stats {
+        long long windows;        // All that were started
+        long long bound_pruned;   // Skipped from the integral images alone
+        long long partial_pruned; // Stopped part way through
+    };
+
+    explicit TemplateMatcher(const Settings &settings = Settings());
+
+    // Returns the template's index in the matches
+    int add(const cv::Mat &templ);
+    // One match per template, in the order they were added. Templates
+    // bigger than the frame get location (-1, -1).
+    void match(const cv::Mat &frame, std::vector<TemplateMatch> &matches);
+
+    const Stats &get_stats()const{ return stats; }
+    int num_templates()const{ return (int)templates.size(); }
+
+private:
+    // One level of a template's pyramid
+    struct Level {
+        cv::Mat image;
+        double sum, mean;
+        double norm; // Of the pixels, or for NCC of them less the mean
+        // Sum and squared norm of rows r onwards (less the mean for NCC)
+        std::vector<double> rest_sum, rest_sq;
+    };
+    // One level of the frame's pyramid
+    struct FrameLevel {
+        cv::Mat image, sum, sqsum;
+    };
+    struct Candidate {
+        cv::Point location;
+        double cost;
+    };
+
+    // Keeps best sorted by cost and at most keep long, with none closer
+    // than spacing to a better one
+    static void insertCandidate(std::vector<Candidate> &best, const Candidate &candidate,
+                                int keep, int spacing);
+    // Lower is better: SSD, or 1 - NCC. Returns at least threshold if the
+    // window can't beat it.
+    double cost(const FrameLevel &frame, const Level &level, cv::Point p, double threshold,
+                Stats &counts)const;
+    void search(const FrameLevel &frame, const Level &level, cv::Rect positions,
+                std::vector<Candidate> &best, int keep, int spacing, Stats &counts)const;
+
+    Settings settings;
+    std::vector<std::vector<Level>> templates;
+    std::vector<FrameLevel> pyramid;
+    Stats stats;
+};
+
+#endif
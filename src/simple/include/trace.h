@@ -0,0 +1,80 @@
+#ifndef SIMPLE_TRACE_H
+#define SIMPLE_TRACE_H
+
+#include <opencv2/core.hpp>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Per stage timing for the demos.
+//
+//   TRACE_SCOPE("detect");
+//
+// records how long the rest of the enclosing scope takes, under that
+// name. Each thread records into a buffer of its own (a ring of the most
+// recent events), so recording is a couple of tick reads and relaxed
+// stores, without locks. Readers copy events out of the rings and throw
+// away any which were overwritten while they read.
+//
+// Building with SIMPLE_TRACE=0 (cmake -DSIMPLE_TRACE=OFF) turns the macros
+// into nothing, and Trace reports no events.
+#ifndef SIMPLE_TRACE
+#define SIMPLE_TRACE 1
+#endif
+
+struct TraceEvent {
+    const char *name; // Must be a string literal, or otherwise live forever
+    int64 start_ticks;
+    int64 end_ticks;
+    int thread;
+};
+
+struct StageStats {
+    std::string name;
+    std::size_t count;
+    double mean_ms, p50_ms, p95_ms, p99_ms, max_ms;
+};
+
+class Trace {
+public:
+    static void record(const char *name, int64 start_ticks, int64 end_ticks);
+
+    // Every event still held in the buffers, oldest first
+    static std::vector<TraceEvent> events();
+    // Statistics for each name over events ending in the last window_seconds,
+    // or over every event held if window_seconds <= 0
+    static std::vector<StageStats> stats(double window_seconds = 0);
+    static void report(std::ostream &os);
+
+    // Draws rolling statistics and the rate of "frame" events over the
+    // top left of image, converting it to BGR if needed
+    static void drawOverlay(cv::Mat &image, double window_seconds = 2);
+
+    // Writes the buffered events in Chrome's trace event format, for
+    // chrome://tracing or https://ui.perfetto.dev
+    static bool writeChromeTrace(const std::string &path);
+};
+
+class ScopedTrace {
+public:
+    explicit ScopedTrace(const char *name): name(name), start(cv::getTickCount()) {}
+    ~ScopedTrace(){ Trace::record(name, start, cv::getTickCount()); }
+    ScopedTrace(const ScopedTrace&) = delete;
+    ScopedTrace &operator=(const ScopedTrace&) = delete;
+private:
+    const char *name;
+    int64 start;
+};
+
+#if SIMPLE_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) ScopedTrace TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_RECORD(name, start_ticks, end_ticks) Trace::record(name, start_ticks, end_ticks)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_RECORD(name, start_ticks, end_ticks) ((void)0)
+#endif
+
+#endif
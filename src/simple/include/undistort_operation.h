@@ -0,0 +1,60 @@
+#ifndef SIMPLE_UNDISTORT_OPERATION_H
+#define SIMPLE_UNDISTORT_OPERATION_H
+
+#include "image_operation.h"
+
+#include <opencv2/core.hpp>
+#include <memory>
+#include <string>
+
+struct MappedFile;
+
+// Removes lens distortion with cv::remap, using maps in the fixed point
+// form (CV_16SC2 coordinates and a CV_16UC1 interpolation table index).
+//
+// initUndistortRectifyMap takes tens of ms at 1080p, so the maps are only
+// built the first time for a given camera matrix, distortion and
+// resolution. They are written to a versioned binary file in cache_dir,
+// named by a hash of those, and later launches memory map the file and
+// use the maps straight from it. The header repeats the key, so a hash
+// collision or an old version just means building the maps again.
+//
+// Output pixels can come from anywhere in the input, so this isn't a row
+// operation. The remap is run in parallel over tiles instead, which keeps
+// the source rows each one reads close together.
+class UndistortOperation: public ImageOperation {
+public:
+    UndistortOperation(const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs, cv::Size size,
+                       const std::string &cache_dir = ".");
+
+    // Reads a camera matrix and distortion, as M1/D1 (intrinsics.yml and
+    // calibration's output) or camera_matrix/distortion_coefficients
+    // (OpenCV's calibration sample). The camera matrix is scaled if the
+    // file gives a different image size.
+    static bool readIntrinsics(const std::string &path, cv::Size size,
+                               cv::Mat &camera_matrix, cv::Mat &dist_coeffs);
+
+    void apply(const cv::Mat &image){ undistort(image, output); }
+    // Same as apply(), into dst, which mustn't be image
+    void undistort(const cv::Mat &image, cv::Mat &dst)const;
+
+    cv::Size get_size()const{ return size; }
+    bool was_cached()const{ return cached; }
+    // Time to build or map the maps
+    double get_startup_ms()const{ return startup_ms; }
+    const std::string &get_cache_path()const{ return cache_path; }
+
+private:
+    bool mapCache(const cv::Mat &key);
+    void writeCache(const cv::Mat &key)const;
+
+    cv::Size size;
+    std::string cache_path;
+    // Keeps the file mapped while the maps point into it
+    std::shared_ptr<MappedFile> mapping;
+    cv::Mat map_xy, map_table;
+    bool cached;
+    double startup_ms;
+};
+
+#endif
@@ -0,0 +1,355 @@
+#include "batch_classifier.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+
+static const int simd_width = 4;
+// Queries handled together by one thread, and training rows gone through
+// at a time (64 KB of 64 float rows)
+static const int query_block = 32;
+static const int train_block = 256;
+
+static int paddedCols(int cols) {
+    return (cols + simd_width - 1)/simd_width*simd_width;
+}
+
+static int numClasses(const std::vector<int> &labels) {
+    return *std::max_element(labels.begin(), labels.end()) + 1;
+}
+
+// Rows [begin, end) of samples, padded with zeros to cols floats each
+static void copyPadded(const cv::Mat &samples, int begin, int end, int cols, float *dst) {
+    for (int i = begin; i < end; i++, dst += cols) {
+        std::memcpy(dst, samples.ptr<float>(i), samples.cols*sizeof(float));
+        std::fill(dst + samples.cols, dst + cols, 0.0f);
+    }
+}
+
+// Dot products of 4 rows with one other row, cols long (a multiple of
+// simd_width)
+static inline void dot4(const float *const *rows, const float *other, int cols, float *dots) {
+#if CV_SIMD128
+    cv::v_float32x4 s0 = cv::v_setzero_f32(), s1 = s0, s2 = s0, s3 = s0;
+    for (int j = 0; j < cols; j += simd_width) {
+        cv::v_float32x4 o = cv::v_load(other + j);
+        s0 = cv::v_fma(cv::v_load(rows[0] + j), o, s0);
+        s1 = cv::v_fma(cv::v_load(rows[1] + j), o, s1);
+        s2 = cv::v_fma(cv::v_load(rows[2] + j), o, s2);
+        s3 = cv::v_fma(cv::v_load(rows[3] + j), o, s3);
+    }
+    dots[0] = cv::v_reduce_sum(s0);
+    dots[1] = cv::v_reduce_sum(s1);
+    dots[2] = cv::v_reduce_sum(s2);
+    dots[3] = cv::v_reduce_sum(s3);
+#else
+    for (int m = 0; m < 4; m++) {
+        float sum = 0;
+        for (int j = 0; j < cols; j++) {
+            sum += rows[m][j]*other[j];
+        }
+        dots[m] = sum;
+    }
+#endif
+}
+
+static float squaredNorm(const float *row, int cols) {
+    float sum = 0;
+    for (int j = 0; j < cols; j++) {
+        sum += row[j]*row[j];
+    }
+    return sum;
+}
+
+KnnClassifier::KnnClassifier(int k):
+    k(std::max(1, k)), features(0), num_classes(0)
+{
+}
+
+std::string KnnClassifier::describe()const {
+    return "KnnClassifier(k=" + std::to_string(k) + ")";
+}
+
+void KnnClassifier::train(const cv::Mat &samples, const std::vector<int> &labels) {
+    CV_Assert(samples.type() == CV_32FC1 && samples.rows > 0 &&
+              samples.rows == (int)labels.size());
+    features = samples.cols;
+    int cols = paddedCols(features);
+    train_samples.create(samples.rows, cols, CV_32F);
+    copyPadded(samples, 0, samples.rows, cols, train_samples.ptr<float>());
+    train_norms.resize(samples.rows);
+    for (int i = 0; i < samples.rows; i++) {
+        train_norms[i] = squaredNorm(train_samples.ptr<float>(i), cols);
+    }
+    train_labels = labels;
+    num_classes = numClasses(labels);
+}
+
+void KnnClassifier::findNearest(const cv::Mat &samples, cv::Mat &indices,
+                                cv::Mat &distances)const {
+    CV_Assert(!train_samples.empty() && samples.type() == CV_32FC1 && samples.cols == features);
+    const int n = train_samples.rows, cols = train_samples.cols;
+    const int kk = std::min(k, n);
+    indices.create(samples.rows, kk, CV_32S);
+    distances.create(samples.rows, kk, CV_32F);
+
+    const int blocks = (samples.rows + query_block - 1)/query_block;
+    cv::parallel_for_(cv::Range(0, blocks), [&](const cv::Range &range) {
+        std::vector<float> queries(query_block*cols), query_norms(query_block);
+        std::vector<float> best(query_block*kk);
+        std::vector<int> best_index(query_block*kk);
+        for (int b = range.start; b < range.end; b++) {
+            const int q0 = b*query_block, nq = std::min(query_block, samples.rows - q0);
+            copyPadded(samples, q0, q0 + nq, cols, queries.data());
+            for (int r = 0; r < nq; r++) {
+                query_norms[r] = squaredNorm(queries.data() + r*cols, cols);
+            }
+            std::fill(best.begin(), best.end(), std::numeric_limits<float>::max());
+            std::fill(best_index.begin(), best_index.end(), -1);
+
+            for (int t0 = 0; t0 < n; t0 += train_block) {
+                const int t1 = std::min(n, t0 + train_block);
+                for (int s = 0; s < nq; s += 4) {
+                    // A short last group repeats its last query
+                    const float *q[4];
+                    for (int m = 0; m < 4; m++) {
+                        q[m] = queries.data() + std::min(s + m, nq - 1)*cols;
+                    }
+                    const int valid = std::min(4, nq - s);
+                    for (int t = t0; t < t1; t++) {
+                        float dots[4];
+                        dot4(q, train_samples.ptr<float>(t), cols, dots);
+                        for (int m = 0; m < valid; m++) {
+                            float d = query_norms[s + m] + train_norms[t] - 2*dots[m];
+                            float *bd = &best[(s + m)*kk];
+                            if (d >= bd[kk - 1]) continue;
+                            int *bi = &best_index[(s + m)*kk];
+                            int p = kk - 1;
+                            while (p > 0 && bd[p - 1] > d) {
+                                bd[p] = bd[p - 1];
+                                bi[p] = bi[p - 1];
+                                p--;
+                            }
+                            bd[p] = d;
+                            bi[p] = t;
+                        }
+                    }
+                }
+            }
+            for (int r = 0; r < nq; r++) {
+                std::copy(&best[r*kk], &best[(r + 1)*kk], distances.ptr<float>(q0 + r));
+                std::copy(&best_index[r*kk], &best_index[(r + 1)*kk], indices.ptr<int>(q0 + r));
+            }
+        }
+    });
+}
+
+void KnnClassifier::predict(const cv::Mat &samples, std::vector<int> &labels)const {
+    cv::Mat indices, distances;
+    findNearest(samples, indices, distances);
+    labels.resize(samples.rows);
+    std::vector<int> votes(num_classes);
+    for (int i = 0; i < samples.rows; i++) {
+        const int *nearest = indices.ptr<int>(i);
+        std::fill(votes.begin(), votes.end(), 0);
+        int most = 0;
+        for (int j = 0; j < indices.cols; j++) {
+            most = std::max(most, ++votes[train_labels[nearest[j]]]);
+        }
+        // Neighbours are nearest first
+        for (int j = 0; j < indices.cols; j++) {
+            if (votes[train_labels[nearest[j]]] == most) {
+                labels[i] = train_labels[nearest[j]];
+                break;
+            }
+        }
+    }
+}
+
+LinearSvmClassifier::LinearSvmClassifier(const Settings &settings):
+    settings(settings), features(0)
+{
+}
+
+std::string LinearSvmClassifier::describe()const {
+    return cv::format("LinearSvmClassifier(lambda=%g, epochs=%d)", settings.lambda,
+                      settings.epochs);
+}
+
+void LinearSvmClassifier::train(const cv::Mat &samples, const std::vector<int> &labels) {
+    CV_Assert(samples.type() == CV_32FC1 && samples.rows > 0 &&
+              samples.rows == (int)labels.size() && settings.lambda > 0);
+    const int n = samples.rows, d = samples.cols;
+    features = d;
+    const int num_classes = numClasses(labels);
+
+    std::vector<double> mean(d, 0), scale(d, 0);
+    for (int i = 0; i < n; i++) {
+        const float *x = samples.ptr<float>(i);
+        for (int j = 0; j < d; j++) {
+            mean[j] += x[j];
+            scale[j] += (double)x[j]*x[j];
+        }
+    }
+    for (int j = 0; j < d; j++) {
+        mean[j] /= n;
+        double sd = std::sqrt(std::max(0.0, scale[j]/n - mean[j]*mean[j]));
+        scale[j] = sd > 1e-6 ? 1/sd : 1;
+    }
+    cv::Mat x(n, d, CV_32F);
+    for (int i = 0; i < n; i++) {
+        const float *src = samples.ptr<float>(i);
+        float *dst = x.ptr<float>(i);
+        for (int j = 0; j < d; j++) {
+            dst[j] = (float)((src[j] - mean[j])*scale[j]);
+        }
+    }
+
+    weights = cv::Mat::zeros(num_classes, paddedCols(d), CV_32F);
+    biases.assign(num_classes, 0);
+    const double lambda = settings.lambda;
+    const double radius = 1/std::sqrt(lambda);
+    const long total_steps = (long)n*settings.epochs;
+    cv::parallel_for_(cv::Range(0, num_classes), [&](const cv::Range &range) {
+        std::vector<int> order(n);
+        std::vector<double> w(d), w_sum(d);
+        for (int c = range.start; c < range.end; c++) {
+            // The bias is a weight on a constant feature of 1
+            std::fill(w.begin(), w.end(), 0.0);
+            std::fill(w_sum.begin(), w_sum.end(), 0.0);
+            double b = 0, b_sum = 0;
+            long averaged = 0, t = 0;
+            std::iota(order.begin(), order.end(), 0);
+            cv::RNG rng(settings.seed + c);
+            for (int epoch = 0; epoch < settings.epochs; epoch++) {
+                for (int i = n - 1; i > 0; i--) {
+                    std::swap(order[i], order[rng.uniform(0, i + 1)]);
+                }
+                for (int i: order) {
+                    t++;
+                    const double eta = 1/(lambda*t);
+                    const float *xi = x.ptr<float>(i);
+                    const double y = labels[i] == c ? 1 : -1;
+                    double score = b;
+                    for (int j = 0; j < d; j++) {
+                        score += w[j]*xi[j];
+                    }
+                    const double shrink = 1 - eta*lambda;
+                    double norm = 0;
+                    for (int j = 0; j < d; j++) {
+                        w[j] *= shrink;
+                        if (y*score < 1) w[j] += eta*y*xi[j];
+                        norm += w[j]*w[j];
+                    }
+                    b *= shrink;
+                    if (y*score < 1) b += eta*y;
+                    // Pegasos' projection onto the ball the optimum is in
+                    norm = std::sqrt(norm + b*b);
+                    if (norm > radius) {
+                        for (int j = 0; j < d; j++) {
+                            w[j] *= radius/norm;
+                        }
+                        b *= radius/norm;
+                    }
+                    // The average over the second half is steadier than
+                    // the last step
+                    if (2*t > total_steps) {
+                        for (int j = 0; j < d; j++) {
+                            w_sum[j] += w[j];
+                        }
+                        b_sum += b;
+                        averaged++;
+                    }
+                }
+            }
+
+            // Standardising folded in: w.((x - mean)*scale) + b
+            float *row = weights.ptr<float>(c);
+            double bias = b_sum/averaged;
+            for (int j = 0; j < d; j++) {
+                double wj = w_sum[j]/averaged*scale[j];
+                row[j] = (float)wj;
+                bias -= wj*mean[j];
+            }
+            biases[c] = (float)bias;
+        }
+    });
+}
+
+void LinearSvmClassifier::predict(const cv::Mat &samples, std::vector<int> &labels)const {
+    CV_Assert(!weights.empty() && samples.type() == CV_32FC1 && samples.cols == features);
+    const int cols = weights.cols, num_classes = weights.rows;
+    labels.resize(samples.rows);
+    const int blocks = (samples.rows + query_block - 1)/query_block;
+    cv::parallel_for_(cv::Range(0, blocks), [&](const cv::Range &range) {
+        std::vector<float> queries(query_block*cols);
+        for (int b = range.start; b < range.end; b++) {
+            const int q0 = b*query_block, nq = std::min(query_block, samples.rows - q0);
+            copyPadded(samples, q0, q0 + nq, cols, queries.data());
+            for (int s = 0; s < nq; s += 4) {
+                const float *q[4];
+                for (int m = 0; m < 4; m++) {
+                    q[m] = queries.data() + std::min(s + m, nq - 1)*cols;
+                }
+                float best[4];
+                int best_class[4] = { 0, 0, 0, 0 };
+                std::fill(best, best + 4, -std::numeric_limits<float>::max());
+                for (int c = 0; c < num_classes; c++) {
+                    float dots[4];
+                    dot4(q, weights.ptr<float>(c), cols, dots);
+                    for (int m = 0; m < 4; m++) {
+                        if (dots[m] + biases[c] > best[m]) {
+                            best[m] = dots[m] + biases[c];
+                            best_class[m] = c;
+                        }
+                    }
+                }
+                for (int m = 0; m < 4 && s + m < nq; m++) {
+                    labels[q0 + s + m] = best_class[m];
+                }
+            }
+        }
+    });
+}
+
+ClassifierReport evaluateClassifier(BatchClassifier &classifier,
+                                    const cv::Mat &train_samples,
+                                    const std::vector<int> &train_labels,
+                                    const cv::Mat &test_samples,
+                                    const std::vector<int> &test_labels, int batch_size) {
+    ClassifierReport report;
+    report.name = classifier.describe();
+    report.train_samples = train_samples.rows;
+    report.test_samples = test_samples.rows;
+
+    int64 start = cv::getTickCount();
+    classifier.train(train_samples, train_labels);
+    report.train_ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency();
+
+    std::vector<int> predicted(test_samples.rows), batch_labels;
+    const int step = batch_size > 0 ? batch_size : std::max(1, test_samples.rows);
+    start = cv::getTickCount();
+    for (int b = 0; b < test_samples.rows; b += step) {
+        int end = std::min(test_samples.rows, b + step);
+        classifier.predict(test_samples.rowRange(b, end), batch_labels);
+        std::copy(batch_labels.begin(), batch_labels.end(), predicted.begin() + b);
+    }
+    report.predict_ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency();
+
+    int correct = 0;
+    for (int i = 0; i < test_samples.rows; i++) {
+        if (predicted[i] == test_labels[i]) correct++;
+    }
+    report.accuracy = test_samples.rows > 0 ? (double)correct/test_samples.rows : 0;
+    return report;
+}
+
+void printReport(std::ostream &os, const ClassifierReport &report) {
+    os << report.name << ": train " << 1000.0*report.train_samples/report.train_ms
+       << " samples/s (" << report.train_ms << " ms), predict "
+       << 1000.0*report.test_samples/report.predict_ms << " samples/s ("
+       << report.predict_ms << " ms), accuracy " << 100*report.accuracy << "%" << std::endl;
+}
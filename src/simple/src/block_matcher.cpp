@@ -0,0 +1,389 @@
+#include "block_matcher.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <vector>
+
+BlockMatcher::BlockMatcher(const Settings &settings):
+    settings(settings)
+{
+}
+
+// Horizontal Sobel clamped to [-cap, cap], shifted up to [0, 2*cap]
+static void prefilter(const cv::Mat &src, cv::Mat &sobel, cv::Mat &dst, int cap) {
+    cv::Sobel(src, sobel, CV_16S, 1, 0, 3);
+    cv::min(sobel, cap, sobel);
+    cv::max(sobel, -cap, sobel);
+    sobel.convertTo(dst, CV_8U, 1, cap);
+}
+
+// Adds (or takes away) the absolute differences of one row to the column
+// sums. right_flipped is the right row mirrored and padded, so the pixel
+// matching left x at disparity d is right_flipped[width - 1 - x + d].
+static void accumulateRow(const uchar *left, const uchar *right_flipped, int width, int D,
+                          ushort *sums, bool add) {
+    for (int x = 0; x < width; x++) {
+        const uchar *right = right_flipped + width - 1 - x;
+        ushort *sum = sums + (std::size_t)x*D;
+        int d = 0;
+#if CV_SIMD128
+        cv::v_uint8x16 l = cv::v_setall_u8(left[x]);
+        for (; d < D; d += 16) {
+            cv::v_uint16x8 lo, hi;
+            cv::v_expand(cv::v_absdiff(l, cv::v_load(right + d)), lo, hi);
+            cv::v_uint16x8 s0 = cv::v_load(sum + d), s1 = cv::v_load(sum + d + 8);
+            if (add) {
+                s0 += lo;
+                s1 += hi;
+            } else {
+                s0 -= lo;
+                s1 -= hi;
+            }
+            cv::v_store(sum + d, s0);
+            cv::v_store(sum + d + 8, s1);
+        }
+#endif
+        for (; d < D; d++) {
+            int diff = std::abs(left[x] - right[d]);
+            sum[d] = (ushort)(add ? sum[d] + diff : sum[d] - diff);
+        }
+    }
+}
+
+// dst = a + b - c, saturating at 16 bits
+static inline void addSubtract(const ushort *a, const ushort *b, const ushort *c,
+                               ushort *dst, int n) {
+    int i = 0;
+#if CV_SIMD128
+    for (; i + 8 <= n; i += 8) {
+        cv::v_store(dst + i, (cv::v_load(a + i) + cv::v_load(b + i)) - cv::v_load(c + i));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = cv::saturate_cast<ushort>(std::min(a[i] + b[i], USHRT_MAX) - c[i]);
+    }
+}
+
+// dst = a + b, saturating at 16 bits
+static inline void addRows(const ushort *a, const ushort *b, ushort *dst, int n) {
+    int i = 0;
+#if CV_SIMD128
+    for (; i + 8 <= n; i += 8) {
+        cv::v_store(dst + i, cv::v_load(a + i) + cv::v_load(b + i));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = cv::saturate_cast<ushort>(a[i] + b[i]);
+    }
+}
+
+// Block costs for successive rows, starting from first_row. Rows and
+// columns past the edges of the image repeat the edge.
+class RowCosts {
+public:
+    RowCosts(const cv::Mat &left, const cv::Mat &right_flipped, int D, int block_size,
+             int first_row):
+        left(left), right_flipped(right_flipped), D(D), radius(block_size/2), y(first_row),
+        started(false), sums((std::size_t)left.cols*D, 0), costs((std::size_t)left.cols*D)
+    {
+        for (int k = -radius; k <= radius; k++) {
+            accumulate(first_row + k, true);
+        }
+    }
+
+    // Costs of the next row, the cost of left x at disparity d is [x*D + d]
+    const ushort *next() {
+        if (started) {
+            accumulate(y - radius, false);
+            y++;
+            accumulate(y + radius, true);
+        }
+        started = true;
+
+        int width = left.cols;
+        const ushort *s = sums.data();
+        ushort *c = costs.data();
+        std::fill(c, c + D, 0);
+        for (int k = -radius; k <= radius; k++) {
+            addRows(c, s + (std::size_t)column(k)*D, c, D);
+        }
+        for (int x = 1; x < width; x++) {
+            addSubtract(c + (std::size_t)(x - 1)*D, s + (std::size_t)column(x + radius)*D,
+                        s + (std::size_t)column(x - radius - 1)*D, c + (std::size_t)x*D, D);
+        }
+        return c;
+    }
+
+private:
+    int column(int x)const{ return std::min(std::max(x, 0), left.cols - 1); }
+
+    void accumulate(int row, bool add) {
+        row = std::min(std::max(row, 0), left.rows - 1);
+        accumulateRow(left.ptr<uchar>(row), right_flipped.ptr<uchar>(row), left.cols, D,
+                      sums.data(), add);
+    }
+
+    const cv::Mat &left, &right_flipped;
+    int D, radius, y;
+    bool started;
+    std::vector<ushort> sums;  // Column sums over the block height
+    std::vector<ushort> costs;
+};
+
+// Lowest of n costs, and the first disparity with it
+static inline int lowestCost(const ushort *c, int n, int &best) {
+    int d = 0, best_cost = INT_MAX;
+    best = 0;
+#if CV_SIMD128
+    if (n % 8 == 0) {
+        cv::v_uint16x8 lowest = cv::v_setall_u16(USHRT_MAX), lowest_index = cv::v_setzero_u16();
+        cv::v_uint16x8 index(0, 1, 2, 3, 4, 5, 6, 7), step = cv::v_setall_u16(8);
+        for (; d < n; d += 8) {
+            cv::v_uint16x8 v = cv::v_load(c + d);
+            cv::v_uint16x8 lower = v < lowest;
+            lowest = cv::v_select(lower, v, lowest);
+            lowest_index = cv::v_select(lower, index, lowest_index);
+            index += step;
+        }
+        best_cost = cv::v_reduce_min(lowest);
+        cv::v_uint16x8 is_best = lowest == cv::v_setall_u16((ushort)best_cost);
+        best = cv::v_reduce_min(cv::v_select(is_best, lowest_index, cv::v_setall_u16(USHRT_MAX)));
+        return best_cost;
+    }
+#endif
+    for (; d < n; d++) {
+        if (c[d] < best_cost) {
+            best_cost = c[d];
+            best = d;
+        }
+    }
+    return best_cost;
+}
+
+// How many of n costs are no more than threshold
+static inline int countAtMost(const ushort *c, int n, int threshold) {
+    int d = 0, count = 0;
+    threshold = std::min(threshold, USHRT_MAX);
+#if CV_SIMD128
+    cv::v_uint16x8 limit = cv::v_setall_u16((ushort)threshold), one = cv::v_setall_u16(1);
+    cv::v_uint16x8 counts = cv::v_setzero_u16();
+    for (; d + 8 <= n; d += 8) {
+        counts += (cv::v_load(c + d) <= limit) & one;
+    }
+    count = (int)cv::v_reduce_sum(counts);
+#endif
+    for (; d < n; d++) {
+        if (c[d] <= threshold) count++;
+    }
+    return count;
+}
+
+// Picks the lowest cost disparity for each pixel of a row, rejects it if
+// another disparity (other than its neighbours) comes within uniqueness
+// percent, and refines it to 1/16 pixel with a parabola through the
+// neighbouring costs. Disparities that would look past the left edge of
+// the right image aren't considered.
+static void selectDisparities(const ushort *costs, int width, int D, int uniqueness,
+                              short *disparity) {
+    for (int x = 0; x < width; x++) {
+        const ushort *c = costs + (std::size_t)x*D;
+        int n = std::min(D, x + 1);
+        int best;
+        int best_cost = lowestCost(c, n, best);
+
+        if (uniqueness > 0) {
+            int threshold = best_cost + best_cost*uniqueness/100;
+            int close = countAtMost(c, n, threshold);
+            for (int d = std::max(best - 1, 0); d <= std::min(best + 1, n - 1); d++) {
+                if (c[d] <= threshold) close--;
+            }
+            if (close > 0) {
+                disparity[x] = BlockMatcher::invalid_disparity;
+                continue;
+            }
+        }
+
+        int d16 = best*16;
+        if (best > 0 && best < n - 1) {
+            int before = c[best - 1], after = c[best + 1];
+            int denominator = std::max(before + after - 2*best_cost, 1);
+            d16 += cvRound(8.0*(before - after)/denominator);
+        }
+        disparity[x] = (short)d16;
+    }
+}
+
+static void matchStrip(const cv::Mat &left, const cv::Mat &right_flipped, int y0, int y1,
+                       const BlockMatcher::Settings &settings, cv::Mat &disparity) {
+    RowCosts costs(left, right_flipped, settings.num_disparities, settings.block_size, y0);
+    for (int y = y0; y < y1; y++) {
+        selectDisparities(costs.next(), left.cols, settings.num_disparities,
+                          settings.uniqueness, disparity.ptr<short>(y));
+    }
+}
+
+// One step along an SGM path, from the previous pixel's path costs to the
+// current pixel's:
+//   L(d) = C(d) + min(L'(d), L'(d - 1) + P1, L'(d + 1) + P1, min L' + P2) - min L'
+// prev[-1] and prev[D] must be USHRT_MAX. Returns the minimum of L.
+static inline ushort pathStep(const ushort *cost, const ushort *prev, ushort prev_min,
+                              ushort *path, int D, ushort P1, ushort P2) {
+    int d = 0, path_min = USHRT_MAX;
+#if CV_SIMD128
+    cv::v_uint16x8 p1 = cv::v_setall_u16(P1);
+    cv::v_uint16x8 jump = cv::v_setall_u16(cv::saturate_cast<ushort>(prev_min + P2));
+    cv::v_uint16x8 base = cv::v_setall_u16(prev_min);
+    cv::v_uint16x8 lowest = cv::v_setall_u16(USHRT_MAX);
+    for (; d + 8 <= D; d += 8) {
+        cv::v_uint16x8 step = cv::v_min(cv::v_min(cv::v_load(prev + d), jump),
+                                        cv::v_min(cv::v_load(prev + d - 1) + p1,
+                                                  cv::v_load(prev + d + 1) + p1));
+        cv::v_uint16x8 l = cv::v_load(cost + d) + (step - base);
+        cv::v_store(path + d, l);
+        lowest = cv::v_min(lowest, l);
+    }
+    path_min = cv::v_reduce_min(lowest);
+#endif
+    for (; d < D; d++) {
+        int step = std::min(std::min((int)prev[d], prev_min + P2),
+                            std::min((int)prev[d - 1], (int)prev[d + 1]) + P1);
+        int l = std::min(cost[d] + step - prev_min, USHRT_MAX);
+        path[d] = (ushort)l;
+        path_min = std::min(path_min, l);
+    }
+    return (ushort)path_min;
+}
+
+// Semi-global matching over rows [y0, y1). The paths from above start
+// sgm_overlap rows higher, so they have settled by the time they reach
+// the strip. The block costs are shifted right by shift bits first, so the
+// sum of the five paths fits in 16 bits.
+static void matchStripSgm(const cv::Mat &left, const cv::Mat &right_flipped, int y0, int y1,
+                          const BlockMatcher::Settings &settings, ushort P1, ushort P2,
+                          int shift, cv::Mat &disparity) {
+    const int width = left.cols, D = settings.num_disparities;
+    // Each pixel's path costs sit between USHRT_MAX sentinels, and each row
+    // has a pixel of zeros either side, which starts the paths afresh
+    const int slot = D + 2;
+    const std::size_t row = (std::size_t)(width + 2)*slot;
+    auto initPaths = [&](std::vector<ushort> &paths, int rows) {
+        paths.assign(rows*row, 0);
+        for (int r = 0; r < rows; r++) {
+            for (int x = 1; x <= width; x++) {
+                ushort *p = paths.data() + r*row + (std::size_t)x*slot;
+                p[0] = p[D + 1] = USHRT_MAX;
+            }
+        }
+    };
+
+    // Up-left, up and up-right paths for the previous and current rows
+    std::vector<ushort> vertical[2], vertical_min[2];
+    for (int i = 0; i < 2; i++) {
+        initPaths(vertical[i], 3);
+        vertical_min[i].assign(3*(width + 2), 0);
+    }
+    // Left to right, then reused for right to left
+    std::vector<ushort> horizontal, horizontal_min(width + 2, 0);
+    initPaths(horizontal, 1);
+    std::vector<ushort> total((std::size_t)width*D);
+    std::vector<ushort> scaled(shift > 0 ? (std::size_t)width*D : 0);
+
+    int start = std::max(0, y0 - settings.sgm_overlap);
+    RowCosts costs(left, right_flipped, D, settings.block_size, start);
+    int current = 0;
+    for (int y = start; y < y1; y++, current ^= 1) {
+        const ushort *cost = costs.next();
+        if (shift > 0) {
+            for (std::size_t i = 0; i < scaled.size(); i++) {
+                scaled[i] = cost[i] >> shift;
+            }
+            cost = scaled.data();
+        }
+        const ushort *prev_paths = vertical[current ^ 1].data();
+        const ushort *prev_mins = vertical_min[current ^ 1].data();
+        ushort *paths = vertical[current].data();
+        ushort *mins = vertical_min[current].data();
+
+        for (int x = 0; x < width; x++) {
+            const ushort *c = cost + (std::size_t)x*D;
+            ushort *t = total.data() + (std::size_t)x*D;
+            ushort *path[3];
+            for (int k = 0; k < 3; k++) {
+                int from = x + k; // Slot of x - 1, x and x + 1 in the previous row
+                path[k] = paths + k*row + (std::size_t)(x + 1)*slot + 1;
+                mins[k*(width + 2) + x + 1] = pathStep(
+                    c, prev_paths + k*row + (std::size_t)from*slot + 1,
+                    prev_mins[k*(width + 2) + from], path[k], D, P1, P2);
+            }
+            ushort *h = horizontal.data() + (std::size_t)(x + 1)*slot + 1;
+            horizontal_min[x + 1] = pathStep(c, h - slot, horizontal_min[x], h, D, P1, P2);
+
+            addRows(path[0], path[1], t, D);
+            addRows(t, path[2], t, D);
+            addRows(t, h, t, D);
+        }
+        for (int x = width - 1; x >= 0; x--) {
+            const ushort *c = cost + (std::size_t)x*D;
+            ushort *h = horizontal.data() + (std::size_t)(x + 1)*slot + 1;
+            horizontal_min[x + 1] = pathStep(c, h + slot, horizontal_min[x + 2], h, D, P1, P2);
+            ushort *t = total.data() + (std::size_t)x*D;
+            addRows(t, h, t, D);
+        }
+
+        if (y >= y0) {
+            selectDisparities(total.data(), width, D, settings.uniqueness,
+                              disparity.ptr<short>(y));
+        }
+    }
+}
+
+void BlockMatcher::compute(const cv::Mat &left, const cv::Mat &right, cv::Mat &disparity) {
+    CV_Assert(left.type() == CV_8UC1 && right.type() == CV_8UC1 && left.size() == right.size());
+    CV_Assert(settings.num_disparities > 0 && settings.num_disparities % 16 == 0);
+    CV_Assert(settings.block_size % 2 == 1 && settings.block_size >= 3 &&
+              settings.block_size <= 21);
+    CV_Assert(settings.prefilter_cap >= 1 && settings.prefilter_cap <= 63);
+
+    prefilter(left, sobel, left_filtered, settings.prefilter_cap);
+    prefilter(right, sobel, right_filtered, settings.prefilter_cap);
+    // Mirrored, then padded by the largest disparity so every load for a
+    // pixel's disparities stays inside the row
+    cv::flip(right_filtered, right_filtered, 1);
+    cv::copyMakeBorder(right_filtered, right_flipped, 0, 0, 0, settings.num_disparities,
+                       cv::BORDER_REPLICATE);
+
+    int area = settings.block_size*settings.block_size;
+    ushort P1 = cv::saturate_cast<ushort>(settings.P1 > 0 ? settings.P1 : 8*area);
+    ushort P2 = cv::saturate_cast<ushort>(settings.P2 > 0 ? settings.P2 : 32*area);
+    P2 = std::max(P2, P1);
+    // Each SGM path cost is at most the block cost plus P2, and the five are
+    // summed in 16 bits, so big blocks have their costs and penalties scaled
+    // down until that can't saturate
+    int shift = 0;
+    if (settings.use_sgm) {
+        int max_cost = 2*settings.prefilter_cap*area;
+        while (5*((max_cost >> shift) + std::max(P2 >> shift, 1)) > USHRT_MAX) shift++;
+        P1 = (ushort)std::max(P1 >> shift, 1);
+        P2 = (ushort)std::max(P2 >> shift, (int)P1);
+        CV_Assert(5*((max_cost >> shift) + P2) <= USHRT_MAX);
+    }
+
+    disparity.create(left.size(), CV_16S);
+    int strip_rows = std::max(settings.strip_rows, 1);
+    int strips = (left.rows + strip_rows - 1)/strip_rows;
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            int y0 = i*strip_rows;
+            int y1 = std::min(y0 + strip_rows, left.rows);
+            if (settings.use_sgm) {
+                matchStripSgm(left_filtered, right_flipped, y0, y1, settings, P1, P2, shift,
+                              disparity);
+            } else {
+                matchStrip(left_filtered, right_flipped, y0, y1, settings, disparity);
+            }
+        }
+    });
+}
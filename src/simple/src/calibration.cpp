@@ -1,73 +1,198 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
-#include <opencv2/features2d.hpp>
 #include <opencv2/calib3d.hpp>
-#include <opencv2/core/types_c.h>
-#include <opencv2/calib3d/calib3d_c.h>
 #include <iostream>
+#include <string>
+#include <vector>
 
-int main(int argc, char** argv){
-    cv::VideoCapture video;
-    video.open(0);
-    if(!video.isOpened()){
-        std::cout << "Could not open video capture." << std::endl;
-        return 1;
-    }
-    cv::Mat frame, gray;
-    cv::Mat corners;
-    bool result = false;
+#include "calibration_set.h"
+#include "frame_loop.h"
 
-    cv::Size pattern_size(4, 4); // Interior number of corners
-    int chessboard_flags = cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE;
+static double msSince(int64 start){
+    return 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency();
+}
 
-    char c = 0;
-    while(c != 27 && !result){
-        video >> frame;
-        cv::cvtColor(frame, gray, cv::COLOR_RGB2GRAY);
-        result = cv::findChessboardCorners(gray, pattern_size, corners, chessboard_flags);
-        cv::imshow("Frame", frame);
-        c = (char)cv::waitKey(25);
+// In the layout of data/intrinsics.yml: M1 and D1, then M2 and D2 if there
+// is a second camera
+static bool writeIntrinsics(const std::string &path, const std::vector<cv::Mat> &camera_matrices,
+                            const std::vector<cv::Mat> &dist_coeffs){
+    cv::FileStorage fs(path, cv::FileStorage::WRITE);
+    if(!fs.isOpened()) return false;
+    for(std::size_t i = 0; i < camera_matrices.size(); i++){
+        std::string n = std::to_string(i + 1);
+        fs << "M" + n << camera_matrices[i];
+        fs << "D" + n << dist_coeffs[i];
     }
+    return true;
+}
+
+// Time to find the corners of every image, without the cache
+static double timeDetection(const std::vector<std::string> &files,
+                            CalibrationSet::Settings settings, bool parallel){
+    settings.parallel = parallel;
+    settings.use_cache = false;
+    CalibrationSet set("", settings);
+    std::vector<CalibrationView> views;
+    int64 start = cv::getTickCount();
+    set.detect(files, views);
+    return msSince(start);
+}
 
-    if (!result) return 1;
+// Calibrates each camera from its image set, reusing whatever the cache
+// has from earlier runs, and writes the intrinsics out
+static int calibrateBatch(const cv::CommandLineParser &parser,
+                          const CalibrationSet::Settings &settings){
+    std::vector<std::string> names = { "left", "right" };
+    std::vector<std::string> patterns = {
+        parser.get<std::string>("left"), parser.get<std::string>("right") };
+    if(patterns[1].empty()){
+        names.pop_back();
+        patterns.pop_back();
+    }
 
-    cv::TermCriteria criteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.1);
-    cv::cornerSubPix(gray, corners, cv::Size(11, 11), cv::Size(-1, -1), criteria);
-    cv::drawChessboardCorners(frame, pattern_size, corners, result);
-    cv::imshow("Result", frame);
+    CalibrationSet set(parser.get<std::string>("cache"), settings);
+    std::vector<cv::Mat> camera_matrices, dist_coeffs;
+    std::vector<std::vector<std::string>> image_sets;
+    for(std::size_t c = 0; c < names.size(); c++){
+        std::vector<cv::String> found;
+        cv::glob(patterns[c], found, false);
+        std::vector<std::string> files(found.begin(), found.end());
+        if(files.empty()){
+            std::cout << "No images match " << patterns[c] << std::endl;
+            return 1;
+        }
+        image_sets.push_back(files);
 
-    std::cout << corners << std::endl;
+        std::vector<CalibrationView> views;
+        int64 start = cv::getTickCount();
+        set.detect(files, views);
+        double detect_ms = msSince(start);
+        int boards = 0;
+        for(const CalibrationView &view: views){
+            if(view.found) boards++;
+        }
+        std::cout << names[c] << ": " << files.size() << " images, board found in " << boards
+                  << ", " << set.get_searched() << " searched and " << set.get_cached()
+                  << " from the cache in " << detect_ms << " ms" << std::endl;
 
-    std::vector<std::vector<cv::Point2f>> image_points;
-    image_points.push_back(std::vector<cv::Point2f>());
-    for (std::size_t i = 0; i < corners.rows; i++) {
-        double *ptr = corners.ptr<double>(i);
-        image_points[0].push_back(cv::Point2f(ptr[0], ptr[1]));
+        cv::Mat camera_matrix, coeffs;
+        start = cv::getTickCount();
+        double rms = set.calibrate(names[c], views, camera_matrix, coeffs);
+        if(rms < 0){
+            std::cout << "Not enough views of the board to calibrate " << names[c] << std::endl;
+            return 1;
+        }
+        const char *how = set.get_reused() ? "same views as last time" :
+            set.get_incremental() ? "started from the last calibration" : "from scratch";
+        std::cout << "  calibrated (" << how << ") in " << msSince(start)
+                  << " ms, RMS error " << rms << " px" << std::endl
+                  << "  camera matrix " << camera_matrix.reshape(1, 1) << std::endl
+                  << "  distortion " << coeffs << std::endl;
+        camera_matrices.push_back(camera_matrix);
+        dist_coeffs.push_back(coeffs);
     }
 
-    std::vector<std::vector<cv::Point3f>> object_points;
+    std::string output = parser.get<std::string>("output");
+    if(!writeIntrinsics(output, camera_matrices, dist_coeffs)){
+        std::cout << "Could not write " << output << std::endl;
+        return 1;
+    }
+    if(!set.save()){
+        std::cout << "Could not write the cache " << parser.get<std::string>("cache") << std::endl;
+    }
 
-    object_points.push_back(std::vector<cv::Point3f>());
-    for (int x = 0; x < pattern_size.width; x++) {
-        for (int y = 0; y < pattern_size.height; y++) {
-            object_points[0].push_back(cv::Point3f(0.03f*x, 0.03f*y, 0));
+    if(parser.has("compare")){
+        for(std::size_t c = 0; c < names.size(); c++){
+            double serial_ms = timeDetection(image_sets[c], settings, false);
+            double parallel_ms = timeDetection(image_sets[c], settings, true);
+            std::vector<CalibrationView> views;
+            int64 start = cv::getTickCount();
+            set.detect(image_sets[c], views);
+            double cached_ms = msSince(start);
+            std::cout << names[c] << " detection: serial " << serial_ms << " ms, parallel "
+                      << parallel_ms << " ms (" << serial_ms/parallel_ms << "x), cached "
+                      << cached_ms << " ms (" << serial_ms/cached_ms << "x)" << std::endl;
         }
     }
+    return 0;
+}
 
-    cv::Mat camera_matrix = cv::Mat::eye(3, 3, CV_64F);
-    cv::Mat dist_coeffs = cv::Mat::zeros(8, 1, CV_64F);
-    std::vector<cv::Mat> rvecs, tvecs;
-    double rms = cv::calibrateCamera(
-        object_points, image_points, cv::Size(frame.cols, frame.rows), camera_matrix,
-        dist_coeffs, rvecs, tvecs);
-    std::cout << "Average reprojection error: " << rms << std::endl;
-    std::cout << "Camera projection matrix:" << std::endl << camera_matrix << std::endl;
-    // Getting bad rms with this. Probably need to do something extra.
+int main(int argc, char** argv){
+    cv::CommandLineParser parser(argc, argv, std::string(FrameLoop::keys) +
+        "{batch||calibrate from image sets instead of the camera}"
+        "{left|data/left??.jpg|images of the first camera, for --batch}"
+        "{right|data/right??.jpg|images of the second camera, for --batch (empty for none)}"
+        "{cache|calibration_cache.yml|where --batch keeps the corners found and the last results}"
+        "{output|intrinsics.yml|where --batch writes the intrinsics}"
+        "{compare||with --batch, also time the corner search serially, in parallel and cached}"
+        "{board_width|9|interior corners along the board}"
+        "{board_height|6|interior corners down the board}"
+        "{square|0.025|size of the board's squares}"
+        "{views|10|views of the board to collect from the camera}");
+    if(parser.has("help")){
+        parser.printMessage();
+        return 0;
+    }
+    CalibrationSet::Settings settings;
+    settings.pattern_size = cv::Size(parser.get<int>("board_width"),
+                                     parser.get<int>("board_height"));
+    settings.square_size = parser.get<float>("square");
+    if(parser.has("batch")){
+        return calibrateBatch(parser, settings);
+    }
+
+    FrameLoop loop(parser, "camera:0");
+    if(!loop.isOpened()){
+        std::cout << "Could not open frame source." << std::endl;
+        return 1;
+    }
+    cv::Mat frame, gray;
+    std::vector<CalibrationView> views;
+    int num_views = parser.get<int>("views");
+    int chessboard_flags = cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE |
+        cv::CALIB_CB_FAST_CHECK;
+    cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.1);
 
+    // One view can't pin down the intrinsics, so keep collecting, leaving
+    // some frames between views for the board to move
+    const int frames_between_views = 15;
+    int since_last_view = frames_between_views;
+    char c = 0;
+    while(c != 27 && (int)views.size() < num_views && loop.next(frame)){
+        cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+        std::vector<cv::Point2f> corners;
+        if(++since_last_view >= frames_between_views &&
+                cv::findChessboardCorners(gray, settings.pattern_size, corners, chessboard_flags)){
+            cv::cornerSubPix(gray, corners, cv::Size(11, 11), cv::Size(-1, -1), criteria);
+            cv::drawChessboardCorners(frame, settings.pattern_size, corners, true);
+            CalibrationView view;
+            view.path = "frame " + std::to_string(loop.getFrameCount());
+            view.hash = view.path;
+            view.image_size = gray.size();
+            view.found = true;
+            view.corners = corners;
+            views.push_back(view);
+            since_last_view = 0;
+        }
+        cv::putText(frame, std::to_string(views.size()) + "/" + std::to_string(num_views) +
+                    " views", cv::Point(10, 30), cv::FONT_HERSHEY_SIMPLEX, 0.8,
+                    cv::Scalar(0, 255, 0), 2);
+        loop.show("Frame", frame);
+        c = (char)loop.waitKey(25);
+    }
+    loop.report(std::cout);
 
-    c = 0;
-    while (c!=27) {
-        c = (char)cv::waitKey(25);
+    settings.use_cache = false;
+    CalibrationSet set("", settings);
+    cv::Mat camera_matrix, dist_coeffs;
+    double rms = set.calibrate("camera", views, camera_matrix, dist_coeffs);
+    if(rms < 0){
+        std::cout << "Need at least 3 views of the board, got " << views.size() << std::endl;
+        return 1;
     }
+    std::cout << "Average reprojection error: " << rms << std::endl;
+    std::cout << "Camera projection matrix:" << std::endl << camera_matrix << std::endl;
+    std::cout << "Distortion coefficients: " << dist_coeffs << std::endl;
+    return 0;
 }
@@ -0,0 +1,226 @@
+#include "calibration_set.h"
+#include "fnv_hash.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/calib3d.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+static bool readFile(const std::string &path, std::vector<uchar> &bytes) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !bytes.empty();
+}
+
+// 64 bit FNV-1a, as hex
+static std::string hashBytes(const std::vector<uchar> &bytes) {
+    std::uint64_t hash = fnv1a64(bytes.data(), bytes.size());
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+    return text;
+}
+
+CalibrationSet::CalibrationSet(const std::string &cache_path, const Settings &settings):
+    cache_path(cache_path), settings(settings), searched(0), cached(0),
+    reused(false), incremental(false)
+{
+    load();
+}
+
+void CalibrationSet::detect(const std::vector<std::string> &paths,
+                            std::vector<CalibrationView> &views)
+{
+    views.assign(paths.size(), CalibrationView());
+    // Not vector<bool>, each image sets its own flag from another thread
+    std::vector<uchar> hit(paths.size(), 0);
+
+    // Only reads the cache, new corners are added once everything is done
+    auto detectOne = [&](std::size_t i) {
+        CalibrationView &view = views[i];
+        view.path = paths[i];
+        view.found = false;
+        std::vector<uchar> bytes;
+        if (!readFile(paths[i], bytes)) return;
+        view.hash = hashBytes(bytes);
+
+        if (settings.use_cache) {
+            auto entry = corners.find(view.hash);
+            if (entry != corners.end()) {
+                view.image_size = entry->second.image_size;
+                view.found = entry->second.found;
+                view.corners = entry->second.corners;
+                hit[i] = 1;
+                return;
+            }
+        }
+
+        cv::Mat gray = cv::imdecode(bytes, cv::IMREAD_GRAYSCALE);
+        if (gray.empty()) return;
+        view.image_size = gray.size();
+        int flags = cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE |
+            cv::CALIB_CB_FAST_CHECK;
+        view.found = cv::findChessboardCorners(gray, settings.pattern_size, view.corners, flags);
+        if (view.found) {
+            cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01);
+            cv::cornerSubPix(gray, view.corners, cv::Size(11, 11), cv::Size(-1, -1), criteria);
+        } else {
+            view.corners.clear();
+        }
+    };
+    if (settings.parallel) {
+        cv::parallel_for_(cv::Range(0, (int)paths.size()), [&](const cv::Range &range) {
+            for (int i = range.start; i < range.end; i++) {
+                detectOne(i);
+            }
+        });
+    } else {
+        for (std::size_t i = 0; i < paths.size(); i++) {
+            detectOne(i);
+        }
+    }
+
+    searched = cached = 0;
+    for (std::size_t i = 0; i < views.size(); i++) {
+        if (hit[i]) {
+            cached++;
+        } else if (views[i].image_size.area() > 0) {
+            searched++;
+            Corners &entry = corners[views[i].hash];
+            entry.image_size = views[i].image_size;
+            entry.found = views[i].found;
+            entry.corners = views[i].corners;
+        }
+    }
+}
+
+double CalibrationSet::calibrate(const std::string &camera,
+                                 const std::vector<CalibrationView> &views,
+                                 cv::Mat &camera_matrix, cv::Mat &dist_coeffs)
+{
+    reused = incremental = false;
+
+    // Same order as findChessboardCorners, along the rows first
+    std::vector<cv::Point3f> board;
+    for (int i = 0; i < settings.pattern_size.height; i++) {
+        for (int j = 0; j < settings.pattern_size.width; j++) {
+            board.push_back(cv::Point3f(j*settings.square_size, i*settings.square_size, 0));
+        }
+    }
+
+    std::vector<std::vector<cv::Point3f>> object_points;
+    std::vector<std::vector<cv::Point2f>> image_points;
+    std::vector<std::string> hashes;
+    cv::Size image_size;
+    for (const CalibrationView &view: views) {
+        if (!view.found) continue;
+        if (image_size.area() == 0) image_size = view.image_size;
+        if (view.image_size != image_size) continue;
+        object_points.push_back(board);
+        image_points.push_back(view.corners);
+        hashes.push_back(view.hash);
+    }
+    if (image_points.size() < 3) return -1;
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+    // Gives the same model as intrinsics.yml: one focal length, k1 and k2
+    int flags = cv::CALIB_FIX_ASPECT_RATIO | cv::CALIB_ZERO_TANGENT_DIST | cv::CALIB_FIX_K3;
+    camera_matrix = cv::Mat::eye(3, 3, CV_64F);
+    dist_coeffs = cv::Mat::zeros(1, 5, CV_64F);
+    auto last = results.find(camera);
+    if (last != results.end() && last->second.image_size == image_size) {
+        const Result &result = last->second;
+        if (result.hashes == hashes) {
+            result.camera_matrix.copyTo(camera_matrix);
+            result.dist_coeffs.copyTo(dist_coeffs);
+            reused = true;
+            return result.rms;
+        }
+        if (std::includes(hashes.begin(), hashes.end(),
+                          result.hashes.begin(), result.hashes.end())) {
+            result.camera_matrix.copyTo(camera_matrix);
+            result.dist_coeffs.copyTo(dist_coeffs);
+            flags |= cv::CALIB_USE_INTRINSIC_GUESS;
+            incremental = true;
+        }
+    }
+
+    std::vector<cv::Mat> rvecs, tvecs;
+    double rms = cv::calibrateCamera(object_points, image_points, image_size,
+                                     camera_matrix, dist_coeffs, rvecs, tvecs, flags);
+    dist_coeffs = dist_coeffs.reshape(1, 1);
+
+    Result &result = results[camera];
+    result.hashes = hashes;
+    result.image_size = image_size;
+    result.camera_matrix = camera_matrix.clone();
+    result.dist_coeffs = dist_coeffs.clone();
+    result.rms = rms;
+    return rms;
+}
+
+void CalibrationSet::load() {
+    if (!settings.use_cache || !std::ifstream(cache_path)) return;
+    cv::FileStorage fs(cache_path, cv::FileStorage::READ);
+    if (!fs.isOpened()) return;
+    // Corners of a different board are no use
+    if ((int)fs["pattern_width"] != settings.pattern_size.width ||
+            (int)fs["pattern_height"] != settings.pattern_size.height) {
+        return;
+    }
+
+    for (const cv::FileNode &node: fs["views"]) {
+        Corners &entry = corners[(std::string)node["hash"]];
+        entry.image_size = cv::Size((int)node["width"], (int)node["height"]);
+        entry.found = (int)node["found"] != 0;
+        cv::Mat points;
+        node["corners"] >> points;
+        if (!points.empty()) points.copyTo(entry.corners);
+    }
+    for (const cv::FileNode &node: fs["cameras"]) {
+        Result &result = results[(std::string)node["name"]];
+        for (const cv::FileNode &hash: node["hashes"]) {
+            result.hashes.push_back((std::string)hash);
+        }
+        result.image_size = cv::Size((int)node["width"], (int)node["height"]);
+        node["camera_matrix"] >> result.camera_matrix;
+        node["dist_coeffs"] >> result.dist_coeffs;
+        result.rms = (double)node["rms"];
+    }
+}
+
+bool CalibrationSet::save()const {
+    if (!settings.use_cache) return true;
+    cv::FileStorage fs(cache_path, cv::FileStorage::WRITE);
+    if (!fs.isOpened()) return false;
+    fs << "pattern_width" << settings.pattern_size.width;
+    fs << "pattern_height" << settings.pattern_size.height;
+
+    fs << "views" << "[";
+    for (const auto &entry: corners) {
+        fs << "{" << "hash" << entry.first << "found" << (int)entry.second.found
+           << "width" << entry.second.image_size.width
+           << "height" << entry.second.image_size.height
+           << "corners" << cv::Mat(entry.second.corners) << "}";
+    }
+    fs << "]";
+
+    fs << "cameras" << "[";
+    for (const auto &entry: results) {
+        const Result &result = entry.second;
+        fs << "{" << "name" << entry.first << "hashes" << "[";
+        for (const std::string &hash: result.hashes) {
+            fs << hash;
+        }
+        fs << "]" << "width" << result.image_size.width << "height" << result.image_size.height
+           << "camera_matrix" << result.camera_matrix << "dist_coeffs" << result.dist_coeffs
+           << "rms" << result.rms << "}";
+    }
+    fs << "]";
+    return true;
+}
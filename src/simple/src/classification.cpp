@@ -0,0 +1,129 @@
+#include <opencv2/core.hpp>
+#include <opencv2/ml.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "batch_classifier.h"
+#include "classification_data.h"
+
+// cv::ml's classifiers behind the same interface, to compare against
+class OpenCvKnn: public BatchClassifier {
+public:
+    explicit OpenCvKnn(int k): k(k), knn(cv::ml::KNearest::create()) {}
+    void train(const cv::Mat &samples, const std::vector<int> &labels) {
+        knn->train(samples, cv::ml::ROW_SAMPLE, cv::Mat(labels, true));
+    }
+    void predict(const cv::Mat &samples, std::vector<int> &labels)const {
+        cv::Mat results;
+        knn->findNearest(samples, k, results);
+        labels.resize(samples.rows);
+        for (int i = 0; i < samples.rows; i++) {
+            labels[i] = cvRound(results.at<float>(i));
+        }
+    }
+    std::string describe()const {
+        return "cv::ml::KNearest(k=" + std::to_string(k) + ")";
+    }
+private:
+    int k;
+    cv::Ptr<cv::ml::KNearest> knn;
+};
+
+class OpenCvLinearSvm: public BatchClassifier {
+public:
+    explicit OpenCvLinearSvm(double c): c(c), svm(cv::ml::SVM::create()) {
+        svm->setType(cv::ml::SVM::C_SVC);
+        svm->setKernel(cv::ml::SVM::LINEAR);
+        svm->setC(c);
+    }
+    void train(const cv::Mat &samples, const std::vector<int> &labels) {
+        svm->train(samples, cv::ml::ROW_SAMPLE, cv::Mat(labels, true));
+    }
+    void predict(const cv::Mat &samples, std::vector<int> &labels)const {
+        cv::Mat results;
+        svm->predict(samples, results);
+        labels.resize(samples.rows);
+        for (int i = 0; i < samples.rows; i++) {
+            labels[i] = cvRound(results.at<float>(i));
+        }
+    }
+    std::string describe()const {
+        return cv::format("cv::ml::SVM(linear, C=%g)", c);
+    }
+private:
+    double c;
+    cv::Ptr<cv::ml::SVM> svm;
+};
+
+static void compareClassifiers(const std::string &name, const cv::Mat &samples,
+                               const std::vector<int> &labels,
+                               const cv::CommandLineParser &parser) {
+    cv::Mat train_samples, test_samples;
+    std::vector<int> train_labels, test_labels;
+    splitSamples(samples, labels, parser.get<double>("test_fraction"), parser.get<int>("seed"),
+                 train_samples, train_labels, test_samples, test_labels);
+    std::cout << name << ": " << train_samples.rows << " training and " << test_samples.rows
+              << " test samples of " << samples.cols << " features" << std::endl;
+
+    int k = parser.get<int>("k");
+    int batch = parser.get<int>("batch");
+    LinearSvmClassifier::Settings svm_settings;
+    svm_settings.lambda = parser.get<double>("lambda");
+    svm_settings.epochs = parser.get<int>("epochs");
+
+    KnnClassifier knn(k);
+    OpenCvKnn opencv_knn(k);
+    LinearSvmClassifier svm(svm_settings);
+    OpenCvLinearSvm opencv_svm(parser.get<double>("svm_c"));
+    BatchClassifier *classifiers[] = { &knn, &opencv_knn, &svm, &opencv_svm };
+    for (BatchClassifier *classifier: classifiers) {
+        printReport(std::cout, evaluateClassifier(*classifier, train_samples, train_labels,
+                                                  test_samples, test_labels, batch));
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char** argv){
+    cv::CommandLineParser parser(argc, argv,
+        "{help h||}"
+        "{digits|digits.png|sheet of handwritten digits}"
+        "{letters|letter-recognition.data|UCI letter recognition data}"
+        "{k|5|neighbours for the kNN classifiers}"
+        "{lambda|0.0001|regularisation of the Pegasos SVM}"
+        "{epochs|20|passes of the Pegasos SVM over the training samples}"
+        "{svm_c|1|C of cv::ml::SVM}"
+        "{batch|0|test samples per call to predict, 0 for all at once}"
+        "{test_fraction|0.1|fraction of the samples held back for testing}"
+        "{seed|1|for splitting the samples}"
+        "{no_deskew||leave the digits as they are before taking the features}");
+    if(parser.has("help")){
+        parser.printMessage();
+        return 0;
+    }
+    cv::samples::addSamplesDataSearchPath("data");
+
+    std::vector<cv::Mat> digits;
+    std::vector<int> digit_labels;
+    if(!loadDigitSheet(cv::samples::findFile(parser.get<std::string>("digits")),
+                       digits, digit_labels)){
+        std::cout << "Could not read the digits." << std::endl;
+        return 1;
+    }
+    int64 start = cv::getTickCount();
+    cv::Mat digit_features = digitHogFeatures(digits, !parser.has("no_deskew"));
+    double ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency();
+    std::cout << "Features of " << digits.size() << " digits in " << ms << " ms ("
+              << 1000.0*digits.size()/ms << " digits/s)" << std::endl;
+    compareClassifiers("Digits", digit_features, digit_labels, parser);
+
+    cv::Mat letters;
+    std::vector<int> letter_labels;
+    if(!loadLetterData(cv::samples::findFile(parser.get<std::string>("letters")),
+                       letters, letter_labels)){
+        std::cout << "Could not read the letters." << std::endl;
+        return 1;
+    }
+    compareClassifiers("Letters", letters, letter_labels, parser);
+    return 0;
+}
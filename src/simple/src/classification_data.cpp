@@ -0,0 +1,136 @@
+#include "classification_data.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+static const int hog_bins = 16;
+static const int hog_features = 4*hog_bins;
+
+bool loadDigitSheet(const std::string &path, std::vector<cv::Mat> &digits,
+                    std::vector<int> &labels, int cell_size, int rows_per_class) {
+    cv::Mat sheet = cv::imread(path, cv::IMREAD_GRAYSCALE);
+    if (sheet.empty()) return false;
+    digits.clear();
+    labels.clear();
+    for (int y = 0; y + cell_size <= sheet.rows; y += cell_size) {
+        int label = y/cell_size/rows_per_class;
+        for (int x = 0; x + cell_size <= sheet.cols; x += cell_size) {
+            digits.push_back(sheet(cv::Rect(x, y, cell_size, cell_size)));
+            labels.push_back(label);
+        }
+    }
+    return !digits.empty();
+}
+
+cv::Mat deskewDigit(const cv::Mat &digit) {
+    cv::Moments m = cv::moments(digit);
+    if (std::abs(m.mu02) < 1e-2) return digit.clone();
+    double skew = m.mu11/m.mu02;
+    cv::Mat shear = (cv::Mat_<double>(2, 3) << 1, skew, -0.5*digit.rows*skew, 0, 1, 0);
+    cv::Mat result;
+    cv::warpAffine(digit, result, shear, digit.size(), cv::WARP_INVERSE_MAP | cv::INTER_LINEAR);
+    return result;
+}
+
+// The histograms of one digit into features, using the scratch matrices
+static void hogRow(const cv::Mat &digit, float *features, cv::Mat &gx, cv::Mat &gy,
+                   cv::Mat &magnitude, cv::Mat &angle) {
+    cv::Sobel(digit, gx, CV_32F, 1, 0);
+    cv::Sobel(digit, gy, CV_32F, 0, 1);
+    cv::cartToPolar(gx, gy, magnitude, angle);
+
+    std::fill(features, features + hog_features, 0.0f);
+    const float bins_per_radian = hog_bins/(2*CV_PI);
+    for (int i = 0; i < digit.rows; i++) {
+        const float *mag = magnitude.ptr<float>(i);
+        const float *ang = angle.ptr<float>(i);
+        float *cells = features + (2*i >= digit.rows ? 2*hog_bins : 0);
+        for (int j = 0; j < digit.cols; j++) {
+            int bin = std::min(hog_bins - 1, (int)(ang[j]*bins_per_radian));
+            cells[(2*j >= digit.cols ? hog_bins : 0) + bin] += mag[j];
+        }
+    }
+
+    float sum = 0;
+    for (int j = 0; j < hog_features; j++) {
+        sum += features[j];
+    }
+    if (sum <= 0) return;
+    for (int j = 0; j < hog_features; j++) {
+        features[j] = std::sqrt(features[j]/sum);
+    }
+}
+
+cv::Mat digitHogFeatures(const std::vector<cv::Mat> &digits, bool deskew) {
+    cv::Mat features((int)digits.size(), hog_features, CV_32F);
+    const int batch = 64;
+    const int batches = ((int)digits.size() + batch - 1)/batch;
+    cv::parallel_for_(cv::Range(0, batches), [&](const cv::Range &range) {
+        cv::Mat upright, gx, gy, magnitude, angle;
+        for (int b = range.start; b < range.end; b++) {
+            int end = std::min((int)digits.size(), (b + 1)*batch);
+            for (int i = b*batch; i < end; i++) {
+                upright = deskew ? deskewDigit(digits[i]) : digits[i];
+                hogRow(upright, features.ptr<float>(i), gx, gy, magnitude, angle);
+            }
+        }
+    });
+    return features;
+}
+
+bool loadLetterData(const std::string &path, cv::Mat &samples, std::vector<int> &labels) {
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+    const int num_features = 16;
+    std::vector<float> values;
+    labels.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] < 'A' || line[0] > 'Z') continue;
+        std::istringstream fields(line.substr(1));
+        std::vector<float> row;
+        char comma;
+        int value;
+        while (fields >> comma >> value) {
+            row.push_back(value);
+        }
+        if ((int)row.size() != num_features) continue;
+        values.insert(values.end(), row.begin(), row.end());
+        labels.push_back(line[0] - 'A');
+    }
+    if (labels.empty()) return false;
+    cv::Mat((int)labels.size(), num_features, CV_32F, values.data()).copyTo(samples);
+    return true;
+}
+
+void splitSamples(const cv::Mat &samples, const std::vector<int> &labels,
+                  double test_fraction, int seed,
+                  cv::Mat &train_samples, std::vector<int> &train_labels,
+                  cv::Mat &test_samples, std::vector<int> &test_labels) {
+    CV_Assert(samples.rows == (int)labels.size());
+    std::vector<int> order(samples.rows);
+    std::iota(order.begin(), order.end(), 0);
+    cv::RNG rng(seed);
+    for (int i = (int)order.size() - 1; i > 0; i--) {
+        std::swap(order[i], order[rng.uniform(0, i + 1)]);
+    }
+    const int num_test = cvRound(samples.rows*test_fraction);
+    test_samples.create(num_test, samples.cols, samples.type());
+    train_samples.create(samples.rows - num_test, samples.cols, samples.type());
+    test_labels.resize(num_test);
+    train_labels.resize(samples.rows - num_test);
+    for (int i = 0; i < samples.rows; i++) {
+        if (i < num_test) {
+            samples.row(order[i]).copyTo(test_samples.row(i));
+            test_labels[i] = labels[order[i]];
+        } else {
+            samples.row(order[i]).copyTo(train_samples.row(i - num_test));
+            train_labels[i - num_test] = labels[order[i]];
+        }
+    }
+}
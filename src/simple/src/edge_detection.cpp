@@ -1,60 +1,44 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <sstream>
+#include <string>
 
-class ImageOperation {
-public:
-    virtual void apply(const cv::Mat &gray)=0;
-    const cv::Mat &get_output()const{ return output; }
-protected:
-    cv::Mat output;
-};
-
-class SmoothOperation: public ImageOperation {
-public:
-    SmoothOperation(int ksize, double sigma) {
-        kernel = cv::getGaussianKernel(ksize, sigma);
-    }
-    void apply(const cv::Mat &gray) {
-        cv::filter2D(gray, output, -1, kernel);
-    }
-private:
-    cv::Mat kernel;
-};
+#include "edge_operations.h"
+#include "frame_loop.h"
+#include "incremental_chain.h"
+#include "operation_chain.h"
+#include "row_operations.h"
+#include "separable_filter.h"
 
-class CannyEdgeDetectorCustom: public ImageOperation {
+// The original per pixel implementation, only kept so --compare can time
+// the current CannyEdgeDetectorCustom against it.
+class CannyEdgeDetectorOriginal: public ImageOperation {
 public:
-    CannyEdgeDetectorCustom(int ksize, double sigma) {
+    CannyEdgeDetectorOriginal(int ksize, double sigma) {
         cv::Mat temp = cv::getGaussianKernel(ksize, sigma);
         cv::getDerivKernels(kernel_dsdx, kernel_dsdy, 1, 1, ksize);
         cv::filter2D(kernel_dsdx, kernel_dsdx, -1, temp);
         cv::filter2D(kernel_dsdy, kernel_dsdy, -1, temp);
-
     }
     void apply(const cv::Mat &gray) {
-        // Use depth of CV_16S in gradient channel, to avoid overflow
-        // 16S = 16 bits per pixel, signed
         cv::filter2D(gray, dsdx, CV_32F, kernel_dsdx);
         cv::filter2D(gray, dsdy, CV_32F, kernel_dsdy);
-        // Can also do this directly with the cv::Sobel function
 
         cv::Mat ds_mag(dsdx.rows, dsdx.cols, CV_32F);
         cv::magnitude(dsdx, dsdy, ds_mag);
 
         double max_mag;
         cv::minMaxLoc(ds_mag, 0, &max_mag);
-
         float mag_threshold = max_mag*0.2;
 
-
-        // Now use non-maximum suppression to only retain pixels for
-        // which ds_mag is a local maxima along the edge direction
         cv::Mat edges = cv::Mat(ds_mag.rows, ds_mag.cols, CV_8UC1);
-
         for (int i = 0; i < ds_mag.rows; i++) {
             for (int j = 0; j < ds_mag.cols; j++) {
-                // Image only has one channel
                 float mag = ds_mag.ptr<float>(i)[j];
                 float nx = dsdx.ptr<float>(i)[j]/mag;
                 float ny = dsdy.ptr<float>(i)[j]/mag;
@@ -80,19 +64,19 @@ public:
 private:
     cv::Mat kernel_dsdx;
     cv::Mat kernel_dsdy;
-    cv::Mat dsdx, dsdy, ds_mag;
+    cv::Mat dsdx, dsdy;
 };
 
-class MarrHildrethDetectorCustom: public ImageOperation {
+// The original zero crossing scan, kept so --compare can check the
+// current MarrHildrethDetectorCustom gives exactly the same output.
+class MarrHildrethDetectorOriginal: public ImageOperation {
 public:
-    MarrHildrethDetectorCustom(int ksize, double sigma) {
+    MarrHildrethDetectorOriginal(int ksize, double sigma) {
         kernel = cv::getGaussianKernel(ksize, sigma);
         cv::Laplacian(kernel, kernel, -1);
     }
-
     void apply(const cv::Mat &gray) {
         cv::filter2D(gray, d2s, CV_16S, kernel);
-        // Now identify zero crossings in laplacian of smoothed image
         output = cv::Mat(d2s.rows, d2s.cols, CV_8UC1);
         for (int i = 0; i < d2s.rows; i++) {
             for (int j = 0; j < d2s.cols; j++) {
@@ -106,15 +90,10 @@ public:
                             } else if (d2s.ptr<short>(i+di)[j+dj] < 0) {
                                 neg_sign = true;
                             }
-
                         }
                     }
                 }
-                if (pos_sign && neg_sign) {
-                    output.ptr<uchar>(i)[j] = 255;
-                } else {
-                    output.ptr<uchar>(i)[j] = 0;
-                }
+                output.ptr<uchar>(i)[j] = (pos_sign && neg_sign) ? 255 : 0;
             }
         }
     }
@@ -123,26 +102,241 @@ private:
     cv::Mat d2s;
 };
 
-int gaussian_ksize(double sigma) {
-    int ksize = 2*ceil(3.7*sigma - 1) + 1;
-    if (ksize > 31) ksize=31;
-    return ksize;
+// Mean time per call in ms, after one warm up call
+static double timeCall(const std::function<void()> &call, int repeats) {
+    call();
+    int64 start = cv::getTickCount();
+    for (int k = 0; k < repeats; k++) {
+        call();
+    }
+    return 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency()/repeats;
 }
 
-int main()
-{
-    cv::VideoCapture video;
-    video.open(0);
-    if(!video.isOpened()){
-        std::cout << "Could not open video capture." << std::endl;
+static double timeOperation(ImageOperation &operation, const cv::Mat &gray, int repeats) {
+    return timeCall([&]() { operation.apply(gray); }, repeats);
+}
+
+// Fraction of the edge pixels in a with an edge pixel of b within 1 pixel
+static double edgeAgreement(const cv::Mat &a, const cv::Mat &b) {
+    cv::Mat b_grown, both;
+    cv::dilate(b, b_grown, cv::Mat());
+    cv::bitwise_and(a, b_grown, both);
+    int count = cv::countNonZero(a);
+    if (count == 0) return 1;
+    return (double)cv::countNonZero(both)/count;
+}
+
+// Times the original and current custom detectors. The Canny detector is
+// checked against cv::Canny run with equivalent smoothing/thresholds, and
+// the Marr-Hildreth detector must match the original exactly.
+static int compareDetectors(const std::string &image_name) {
+    cv::samples::addSamplesDataSearchPath("data");
+    cv::Mat image = cv::imread(cv::samples::findFile(image_name), cv::IMREAD_GRAYSCALE);
+    if (image.empty()) {
+        std::cout << "Could not read " << image_name << std::endl;
         return 1;
     }
+    const cv::Size sizes[] = { cv::Size(640, 480), cv::Size(1920, 1080) };
+    const double sigmas[] = { 1, 3, 7 };
+    cv::Mat gray, blurred, reference;
+    for (const cv::Size &size: sizes) {
+        cv::resize(image, gray, size);
+        for (double sigma: sigmas) {
+            int ksize = gaussian_ksize(sigma);
+            CannyEdgeDetectorOriginal original(ksize, sigma);
+            CannyEdgeDetectorCustom custom(ksize, sigma);
+            double original_ms = timeOperation(original, gray, 3);
+            double custom_ms = timeOperation(custom, gray, 10);
+
+            // Sobel 3x3 gives 8x the slope of a ramp, and the custom
+            // detector gives sigma x the slope
+            cv::GaussianBlur(gray, blurred, cv::Size(ksize, ksize), sigma);
+            cv::Canny(blurred, reference,
+                      8*custom.get_low_threshold()/sigma,
+                      8*custom.get_high_threshold()/sigma, 3, true);
+
+            std::cout << size.width << "x" << size.height << ", sigma " << sigma
+                      << ": original " << original_ms << " ms, new " << custom_ms
+                      << " ms (" << original_ms/custom_ms << "x)"
+                      << ", vs cv::Canny precision "
+                      << edgeAgreement(custom.get_output(), reference)
+                      << " recall " << edgeAgreement(reference, custom.get_output())
+                      << std::endl;
+        }
+        for (double sigma: { 2.0, 4.0 }) {
+            int ksize = gaussian_ksize(sigma);
+            MarrHildrethDetectorOriginal original(ksize, sigma);
+            MarrHildrethDetectorCustom custom(ksize, sigma);
+            double original_ms = timeOperation(original, gray, 3);
+            double custom_ms = timeOperation(custom, gray, 10);
+            cv::Mat difference = original.get_output() != custom.get_output();
+
+            std::cout << size.width << "x" << size.height << ", sigma " << sigma
+                      << ": marr-hildreth original " << original_ms << " ms, new "
+                      << custom_ms << " ms (" << original_ms/custom_ms << "x)"
+                      << ", pixels different " << cv::countNonZero(difference)
+                      << std::endl;
+        }
+    }
+    return 0;
+}
+
+static void reportFilter(const std::string &name, double ms, double reference_ms,
+                         const cv::Mat &result, const cv::Mat &reference) {
+    std::cout << "  " << name << ": " << ms << " ms vs " << reference_ms << " ms ("
+              << reference_ms/ms << "x), max error " << cv::norm(result, reference, cv::NORM_INF)
+              << std::endl;
+}
+
+// Times FixedPointFilter against the OpenCV functions it stands in for,
+// and gives the largest difference from them
+static int compareFilters(const std::string &image_name) {
+    cv::Mat image = cv::imread(cv::samples::findFile(image_name), cv::IMREAD_GRAYSCALE);
+    if (image.empty()) {
+        std::cout << "Could not read " << image_name << std::endl;
+        return 1;
+    }
+    const cv::Size sizes[] = { cv::Size(640, 480), cv::Size(1920, 1080) };
+    cv::Mat gray, result, reference;
+    for (const cv::Size &size: sizes) {
+        cv::resize(image, gray, size);
+        std::cout << size.width << "x" << size.height << ":" << std::endl;
+        for (double sigma: { 0.5, 1.0, 2.0, 3.0 }) {
+            int ksize = gaussian_ksize(sigma);
+            cv::Mat kernel = cv::getGaussianKernel(ksize, sigma, CV_32F);
+            FixedPointFilter filter(kernel, kernel);
+            double ms = timeCall([&]() { filter.apply(gray, result, CV_8U); }, 20);
+            double reference_ms = timeCall([&]() {
+                cv::GaussianBlur(gray, reference, cv::Size(ksize, ksize), sigma, sigma);
+            }, 20);
+            reportFilter(cv::format("smooth, sigma %g, vs cv::GaussianBlur", sigma), ms,
+                         reference_ms, result, reference);
+
+            // The scale normalised derivative CannyEdgeDetectorCustom uses
+            cv::Mat deriv_kernel(ksize, 1, CV_32F);
+            double gain = 0;
+            for (int k = 0; k < ksize; k++) {
+                double x = k - ksize/2;
+                deriv_kernel.at<float>(k) = x*kernel.at<float>(k);
+                gain += x*x*kernel.at<float>(k);
+            }
+            deriv_kernel *= sigma/gain;
+            FixedPointFilter gradient(deriv_kernel, kernel);
+            ms = timeCall([&]() { gradient.apply(gray, result, CV_32F); }, 20);
+            reference_ms = timeCall([&]() {
+                cv::sepFilter2D(gray, reference, CV_32F, deriv_kernel, kernel);
+            }, 20);
+            reportFilter(cv::format("d/dx, sigma %g, vs cv::sepFilter2D", sigma), ms,
+                         reference_ms, result, reference);
+        }
+        // Sobel's smoothing kernel doesn't sum to 1, so it is normalised and
+        // the result scaled back up
+        for (int ksize: { 3, 5 }) {
+            cv::Mat deriv_kernel, smooth_kernel;
+            cv::getDerivKernels(deriv_kernel, smooth_kernel, 1, 0, ksize, false, CV_32F);
+            double smooth_sum = cv::sum(smooth_kernel)[0];
+            FixedPointFilter sobel(deriv_kernel, smooth_kernel/smooth_sum);
+            double ms = timeCall([&]() { sobel.apply(gray, result, CV_32F, smooth_sum); }, 20);
+            double reference_ms = timeCall([&]() {
+                cv::Sobel(gray, reference, CV_32F, 1, 0, ksize);
+            }, 20);
+            reportFilter(cv::format("d/dx, %dx%d, vs cv::Sobel", ksize, ksize), ms, reference_ms,
+                         result, reference);
+        }
+    }
+    return 0;
+}
+
+// Runs the frames of each video through smoothing and Canny, on every
+// pixel and incrementally, and compares the time and results
+static int compareIncremental(const std::string &videos, int max_frames) {
+    std::stringstream list(videos);
+    std::string name;
+    while (std::getline(list, name, ',')) {
+        std::unique_ptr<FrameSource> source = openFrameSource("video:" + name);
+        std::vector<cv::Mat> frames;
+        cv::Mat frame;
+        while (source && (int)frames.size() < max_frames && source->read(frame)) {
+            frames.push_back(frame.clone());
+        }
+        if (frames.empty()) {
+            std::cout << "Could not read " << name << std::endl;
+            return 1;
+        }
+
+        ColorConvertOperation to_gray(cv::COLOR_BGR2GRAY, CV_8UC1);
+        SmoothOperation smooth(gaussian_ksize(1), 1), incremental_smooth(gaussian_ksize(1), 1);
+        CannyEdgeDetectorCustom canny(gaussian_ksize(1), 1);
+        CannyEdgeDetectorCustom incremental_canny(gaussian_ksize(1), 1);
+        OperationChain full;
+        full.add(to_gray).add(smooth).add(canny);
+        IncrementalChain incremental;
+        incremental.add(to_gray).add(incremental_smooth).add(incremental_canny);
 
-    cv::Mat frame, gray, output;
-    video >> frame; // Use for getting image size
+        double full_ms = 0, incremental_ms = 0, changed = 0, computed = 0;
+        double smooth_error = 0, edges_different = 0, worst_edges_different = 0;
+        for (const cv::Mat &f: frames) {
+            int64 start = cv::getTickCount();
+            full.apply(f);
+            full_ms += 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency();
+            start = cv::getTickCount();
+            incremental.apply(f);
+            incremental_ms += 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency();
 
+            changed += incremental.get_changed_fraction();
+            computed += incremental.get_computed_fraction();
+            smooth_error = std::max(smooth_error, cv::norm(smooth.get_output(),
+                incremental_smooth.get_output(), cv::NORM_INF));
+            cv::Mat different = full.get_output() != incremental.get_output();
+            double fraction = (double)cv::countNonZero(different)/different.total();
+            edges_different += fraction;
+            worst_edges_different = std::max(worst_edges_different, fraction);
+        }
+        double n = (double)frames.size();
+        std::cout << name << ", " << frames.size() << " frames of " << frames[0].cols << "x"
+                  << frames[0].rows << ": full " << full_ms/n << " ms, incremental "
+                  << incremental_ms/n << " ms (" << full_ms/incremental_ms << "x)" << std::endl
+                  << "  tiles changed " << 100*changed/n << "%, pixels computed "
+                  << 100*computed/n << "%" << std::endl
+                  << "  smoothed max difference " << smooth_error << ", edge pixels different "
+                  << 100*edges_different/n << "% mean, " << 100*worst_edges_different
+                  << "% worst frame" << std::endl;
+    }
+    return 0;
+}
+
+// Times each chain fused and on whole images, at 1080p
+static int compareChains(const std::string &image_name, std::vector<OperationChain> &chains) {
+    cv::Mat image = cv::imread(cv::samples::findFile(image_name));
+    if (image.empty()) {
+        std::cout << "Could not read " << image_name << std::endl;
+        return 1;
+    }
+    cv::Mat frame;
+    cv::resize(image, frame, cv::Size(1920, 1080));
+    for (std::size_t i = 0; i < chains.size(); i++) {
+        compareChainModes(std::cout, "Operation " + std::to_string(i), chains[i], frame);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    cv::CommandLineParser parser(argc, argv, std::string(FrameLoop::keys) +
+        "{op|0|index of the operation to start with}"
+        "{compare||time the custom detectors and operation chains, and check their output}"
+        "{image|lena.jpg|image used by --compare}"
+        "{videos|tree.avi,Megamind.avi|videos --compare runs the incremental mode on}"
+        "{compare_frames|300|frames of each video --compare uses at most}"
+        "{incremental||only recompute the tiles which changed since the last frame}"
+        "{bank||run every operation on each frame, sharing one scale space}"
+        "{decimate||in --bank mode, compute large sigmas at reduced resolution}");
+    if(parser.has("help")){
+        parser.printMessage();
+        return 0;
+    }
     std::vector<std::unique_ptr<ImageOperation>> operations;
-    int op = 0;
+    int op = parser.get<int>("op");
 
     operations.push_back(std::unique_ptr<ImageOperation>(
         new SmoothOperation(gaussian_ksize(1), 1)
@@ -169,22 +363,79 @@ int main()
         new MarrHildrethDetectorCustom(gaussian_ksize(2), 2)
     ));
 
-    while(true){
-        video >> frame; // Overloaded >> operator, reads current frame into a mat
-        if(frame.empty()){
-            break;
-        }
-        cv::cvtColor(frame, gray, cv::COLOR_RGB2GRAY);
-        cv::flip(gray, gray, 1);
-        operations[op]->apply(gray);
-        cv::imshow("Frame", operations[op]->get_output());
-
-        if((char)cv::waitKey(10) == 27) {
-            op++;
-            if (op == operations.size()) {
-                break;
-            }
-        }
+    // Each frame is converted and mirrored, then goes through the
+    // operation. The conversion, mirroring and smoothing are fused; the
+    // detectors need the whole image.
+    ColorConvertOperation to_gray(cv::COLOR_RGB2GRAY, CV_8UC1);
+    MirrorOperation mirror;
+    OperationChain front;
+    front.add(to_gray).add(mirror);
+    std::vector<OperationChain> chains(operations.size());
+    for(std::size_t i = 0; i < operations.size(); i++){
+        chains[i].add(to_gray).add(mirror).add(*operations[i]);
+    }
+    // Mirroring moves pixels across the image, so with --incremental it is
+    // done to the result instead
+    bool incremental = parser.has("incremental");
+    std::vector<IncrementalChain> incremental_chains(operations.size());
+    for(std::size_t i = 0; i < operations.size(); i++){
+        incremental_chains[i].add(to_gray).add(*operations[i]);
     }
+
+    if(parser.has("compare")){
+        int result = compareDetectors(parser.get<std::string>("image"));
+        if(result == 0) result = compareFilters(parser.get<std::string>("image"));
+        if(result == 0) result = compareIncremental(parser.get<std::string>("videos"),
+                                                    parser.get<int>("compare_frames"));
+        if(result != 0) return result;
+        return compareChains(parser.get<std::string>("image"), chains);
+    }
+    if(op < 0 || op >= (int)operations.size()){
+        std::cout << "Operation must be in [0, " << operations.size() << ")" << std::endl;
+        return 1;
+    }
+    FrameLoop loop(parser, "camera:0");
+    if(!loop.isOpened()){
+        std::cout << "Could not open frame source." << std::endl;
+        return 1;
+    }
+
+    // Every sigma used by the operations above
+    bool bank = parser.has("bank");
+    GaussianScaleSpace scale_space({ 0.5, 1, 2, 3, 4, 7 }, parser.has("decimate"));
+
+    // With --pipeline the frames are processed on another thread, and the
+    // key handler moves op on from the display thread
+    std::atomic<int> current_op(op);
+    loop.run("Frame", 10,
+        [&](const cv::Mat &frame, cv::Mat &result) {
+            int index = current_op.load();
+            if(index >= (int)operations.size()) return;
+            if(bank){
+                front.apply(frame);
+                {
+                    TRACE_SCOPE("scale space");
+                    scale_space.build(front.get_output());
+                }
+                TRACE_SCOPE("operations");
+                for(const std::unique_ptr<ImageOperation> &operation: operations){
+                    operation->applyScaleSpace(scale_space);
+                }
+                operations[index]->get_output().copyTo(result);
+            }else if(incremental){
+                incremental_chains[index].apply(frame);
+                cv::flip(incremental_chains[index].get_output(), result, 1);
+            }else{
+                chains[index].apply(frame);
+                chains[index].get_output().copyTo(result);
+            }
+        },
+        [&](int key) {
+            if((char)key == 27) {
+                current_op++;
+            }
+            return current_op.load() < (int)operations.size();
+        });
+    loop.report(std::cout);
     return 0;
 }
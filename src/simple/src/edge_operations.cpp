@@ -0,0 +1,330 @@
+#include "edge_operations.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+SmoothOperation::SmoothOperation(int ksize, double sigma):
+    sigma(sigma), kernel(cv::getGaussianKernel(ksize, sigma)), filter(kernel, kernel)
+{
+}
+
+void SmoothOperation::apply(const cv::Mat &gray) {
+    applyAllRows(gray);
+}
+
+void SmoothOperation::applyRows(const cv::Mat &src, cv::Mat &dst)const {
+    filter.apply(src, dst, CV_8U);
+}
+
+void SmoothOperation::applyScaleSpace(const GaussianScaleSpace &scale_space) {
+    const ScaleLevel &level = scale_space.find(sigma);
+    if (level.octave == 0) {
+        level.smoothed.convertTo(output, CV_8U);
+    } else {
+        cv::resize(level.smoothed, upsampled, scale_space.get_source().size(),
+                   0, 0, cv::INTER_LINEAR);
+        upsampled.convertTo(output, CV_8U);
+    }
+}
+
+CannyEdgeDetectorCustom::CannyEdgeDetectorCustom(
+        int ksize, double sigma, float low_threshold, float high_threshold):
+    sigma(sigma), low_threshold(low_threshold), high_threshold(high_threshold)
+{
+    // Derivative of gaussian, g'(x) = -x/sigma^2 g(x). filter2D correlates
+    // rather than convolves, so the sign flips. The kernel is scaled so a
+    // ramp of slope 1 gives exactly sigma, ie: the scale normalised
+    // derivative.
+    kernel_smooth = cv::getGaussianKernel(ksize, sigma, CV_32F);
+    kernel_deriv.create(ksize, 1, CV_32F);
+    int radius = ksize/2;
+    double gain = 0;
+    for (int k = 0; k < ksize; k++) {
+        double x = k - radius;
+        kernel_deriv.at<float>(k) = x*kernel_smooth.at<float>(k);
+        gain += x*x*kernel_smooth.at<float>(k);
+    }
+    kernel_deriv *= sigma/gain;
+    filter_x = FixedPointFilter(kernel_deriv, kernel_smooth);
+    filter_y = FixedPointFilter(kernel_smooth, kernel_deriv);
+}
+
+void CannyEdgeDetectorCustom::apply(const cv::Mat &gray) {
+    // Smooth along one axis, differentiate along the other
+    filter_x.apply(gray, dsdx, CV_32F);
+    filter_y.apply(gray, dsdy, CV_32F);
+    detect();
+}
+
+void CannyEdgeDetectorCustom::applyScaleSpace(const GaussianScaleSpace &scale_space) {
+    const ScaleLevel &level = scale_space.find(sigma);
+    // Central differences of the smoothed image. Sobel with ksize 1 is
+    // [-1 0 1], which is twice the slope, and the gradient is scale
+    // normalised in the pixels of the level.
+    double scale = level.octave_sigma()/2;
+    if (level.octave == 0) {
+        cv::Sobel(level.smoothed, dsdx, CV_32F, 1, 0, 1, scale);
+        cv::Sobel(level.smoothed, dsdy, CV_32F, 0, 1, 1, scale);
+    } else {
+        cv::Size size = scale_space.get_source().size();
+        cv::Sobel(level.smoothed, level_dx, CV_32F, 1, 0, 1, scale);
+        cv::Sobel(level.smoothed, level_dy, CV_32F, 0, 1, 1, scale);
+        cv::resize(level_dx, dsdx, size, 0, 0, cv::INTER_LINEAR);
+        cv::resize(level_dy, dsdy, size, 0, 0, cv::INTER_LINEAR);
+    }
+    detect();
+}
+
+void CannyEdgeDetectorCustom::detect() {
+    cv::Size padded_size(dsdx.cols + 2, dsdx.rows + 2);
+    if (ds_mag_padded.size() != padded_size) {
+        ds_mag_padded = cv::Mat::zeros(padded_size, CV_32F);
+        edge_class_padded = cv::Mat::zeros(padded_size, CV_8U);
+    }
+    cv::Rect inner(1, 1, dsdx.cols, dsdx.rows);
+    cv::Mat ds_mag = ds_mag_padded(inner);
+    cv::magnitude(dsdx, dsdy, ds_mag);
+
+    suppressNonMaxima();
+    hysteresis();
+
+    cv::compare(edge_class_padded(inner), 2, output, cv::CMP_EQ);
+}
+
+// tan(22.5 degrees). Comparing |gy| against tan22*|gx| puts the gradient
+// direction into one of 4 bins without dividing.
+static const float tan22 = 0.4142135623730950f;
+
+// Classify one pixel as 0 (suppressed), 1 (weak) or 2 (strong).
+// m, m_up and m_down are the magnitude rows at, above and below the pixel.
+static inline uchar classifyPixel(const float *m, const float *m_up,
+                                  const float *m_down, float gx, float gy,
+                                  int j, float low, float high)
+{
+    float mag = m[j];
+    if (mag <= low) return 0;
+    float ax = std::abs(gx), ay = std::abs(gy);
+    float n1, n2;
+    if (ay <= tan22*ax) {
+        n1 = m[j-1]; n2 = m[j+1];
+    } else if (ax <= tan22*ay) {
+        n1 = m_up[j]; n2 = m_down[j];
+    } else if (gx*gy > 0) {
+        n1 = m_up[j-1]; n2 = m_down[j+1];
+    } else {
+        n1 = m_up[j+1]; n2 = m_down[j-1];
+    }
+    // Strict on one side only, so a plateau two pixels wide keeps one pixel
+    if (mag > n1 && mag >= n2) return mag > high ? 2 : 1;
+    return 0;
+}
+
+void CannyEdgeDetectorCustom::suppressNonMaxima() {
+    const int rows = dsdx.rows, cols = dsdx.cols;
+    const float low = low_threshold, high = high_threshold;
+
+    int nblocks = std::max(1, std::min(rows, cv::getNumThreads()*4));
+    int block_rows = (rows + nblocks - 1)/nblocks;
+    seeds.resize(nblocks);
+
+    cv::parallel_for_(cv::Range(0, nblocks), [&](const cv::Range &range) {
+        for (int b = range.start; b < range.end; b++) {
+            std::vector<uchar*> &block_seeds = seeds[b];
+            block_seeds.clear();
+            int i_end = std::min(rows, (b + 1)*block_rows);
+            for (int i = b*block_rows; i < i_end; i++) {
+                const float *dx = dsdx.ptr<float>(i);
+                const float *dy = dsdy.ptr<float>(i);
+                // +1 skips the padding column, so index j is image column j
+                const float *m_up = ds_mag_padded.ptr<float>(i) + 1;
+                const float *m = ds_mag_padded.ptr<float>(i + 1) + 1;
+                const float *m_down = ds_mag_padded.ptr<float>(i + 2) + 1;
+                uchar *out = edge_class_padded.ptr<uchar>(i + 1) + 1;
+
+                int j = 0;
+#if CV_SIMD
+                const int n = cv::v_float32::nlanes;
+                const cv::v_float32 v_tan22 = cv::vx_setall_f32(tan22);
+                const cv::v_float32 v_low = cv::vx_setall_f32(low);
+                const cv::v_float32 v_high = cv::vx_setall_f32(high);
+                const cv::v_float32 v_zero = cv::vx_setzero_f32();
+                const cv::v_uint8 v_strong = cv::vx_setall_u8(2);
+                auto classify = [&](int k) {
+                    cv::v_float32 gx = cv::vx_load(dx + k), gy = cv::vx_load(dy + k);
+                    cv::v_float32 ax = cv::v_abs(gx), ay = cv::v_abs(gy);
+                    cv::v_float32 mag = cv::vx_load(m + k);
+                    cv::v_float32 horiz = ay <= v_tan22*ax;
+                    cv::v_float32 vert = ax <= v_tan22*ay;
+                    cv::v_float32 diag = (gx*gy) > v_zero;
+                    cv::v_float32 n1 = cv::v_select(horiz, cv::vx_load(m + k - 1),
+                        cv::v_select(vert, cv::vx_load(m_up + k),
+                        cv::v_select(diag, cv::vx_load(m_up + k - 1),
+                                           cv::vx_load(m_up + k + 1))));
+                    cv::v_float32 n2 = cv::v_select(horiz, cv::vx_load(m + k + 1),
+                        cv::v_select(vert, cv::vx_load(m_down + k),
+                        cv::v_select(diag, cv::vx_load(m_down + k + 1),
+                                           cv::vx_load(m_down + k - 1))));
+                    cv::v_float32 keep = (mag > n1) & (mag >= n2) & (mag > v_low);
+                    cv::v_float32 strong = keep & (mag > v_high);
+                    // Masks are all ones, ie: -1, so subtracting them counts
+                    return cv::vx_setzero_s32() - cv::v_reinterpret_as_s32(keep)
+                                                - cv::v_reinterpret_as_s32(strong);
+                };
+                for (; j <= cols - 4*n; j += 4*n) {
+                    cv::v_uint8 cls = cv::v_pack_u(
+                        cv::v_pack(classify(j), classify(j + n)),
+                        cv::v_pack(classify(j + 2*n), classify(j + 3*n)));
+                    cv::v_store(out + j, cls);
+                    if (cv::v_check_any(cls == v_strong)) {
+                        for (int k = j; k < j + 4*n; k++) {
+                            if (out[k] == 2) block_seeds.push_back(out + k);
+                        }
+                    }
+                }
+#endif
+                for (; j < cols; j++) {
+                    out[j] = classifyPixel(m, m_up, m_down, dx[j], dy[j], j, low, high);
+                    if (out[j] == 2) block_seeds.push_back(out + j);
+                }
+            }
+        }
+    });
+}
+
+void CannyEdgeDetectorCustom::hysteresis() {
+    // Grow strong edges into connected weak pixels. The zero border means
+    // the neighbour lookups can't leave the map.
+    const std::ptrdiff_t step = edge_class_padded.step;
+    const std::ptrdiff_t offsets[8] = {
+        -step - 1, -step, -step + 1, -1, 1, step - 1, step, step + 1
+    };
+    stack.clear();
+    for (const std::vector<uchar*> &block_seeds: seeds) {
+        stack.insert(stack.end(), block_seeds.begin(), block_seeds.end());
+    }
+    while (!stack.empty()) {
+        uchar *p = stack.back();
+        stack.pop_back();
+        for (int k = 0; k < 8; k++) {
+            uchar *q = p + offsets[k];
+            if (*q == 1) {
+                *q = 2;
+                stack.push_back(q);
+            }
+        }
+    }
+}
+
+MarrHildrethDetectorCustom::MarrHildrethDetectorCustom(int ksize, double sigma, int min_swing):
+    sigma(sigma), min_swing(std::min(std::max(min_swing, 0), (int)SHRT_MAX))
+{
+    kernel = cv::getGaussianKernel(ksize, sigma);
+    cv::Laplacian(kernel, kernel, -1);
+}
+
+// Runs body(start_row, end_row) over blocks of rows in parallel
+template <typename Body>
+static void parallelRows(int rows, const Body &body) {
+    int nblocks = std::max(1, std::min(rows, cv::getNumThreads()*4));
+    int block_rows = (rows + nblocks - 1)/nblocks;
+    cv::parallel_for_(cv::Range(0, nblocks), [&](const cv::Range &range) {
+        for (int b = range.start; b < range.end; b++) {
+            body(b*block_rows, std::min(rows, (b + 1)*block_rows));
+        }
+    });
+}
+
+void MarrHildrethDetectorCustom::apply(const cv::Mat &gray) {
+    cv::filter2D(gray, d2s, CV_16S, kernel);
+    findZeroCrossings();
+}
+
+void MarrHildrethDetectorCustom::applyScaleSpace(const GaussianScaleSpace &scale_space) {
+    const ScaleLevel &level = scale_space.find(sigma);
+    double s = level.octave_sigma();
+    cv::Laplacian(level.smoothed, laplacian, CV_32F, 1, s*s);
+    if (level.octave == 0) {
+        laplacian.convertTo(d2s, CV_16S);
+    } else {
+        cv::resize(laplacian, laplacian_upsampled, scale_space.get_source().size(),
+                   0, 0, cv::INTER_LINEAR);
+        laplacian_upsampled.convertTo(d2s, CV_16S);
+    }
+    findZeroCrossings();
+}
+
+void MarrHildrethDetectorCustom::findZeroCrossings() {
+    const int rows = d2s.rows, cols = d2s.cols;
+    cv::Size padded_size(cols + 2, rows + 2);
+    if (signs_padded.size() != padded_size) {
+        signs_padded = cv::Mat::zeros(padded_size, CV_8U);
+    }
+    output.create(rows, cols, CV_8U);
+    const short swing = (short)min_swing;
+
+    // Work out the sign of every pixel once, rather than 9 times
+    parallelRows(rows, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            const short *src = d2s.ptr<short>(i);
+            uchar *dst = signs_padded.ptr<uchar>(i + 1) + 1;
+            int j = 0;
+#if CV_SIMD
+            const int n = cv::v_int16::nlanes;
+            const cv::v_int16 v_pos = cv::vx_setall_s16(swing);
+            const cv::v_int16 v_neg = cv::vx_setall_s16(-swing);
+            const cv::v_int16 v_one = cv::vx_setall_s16(1);
+            const cv::v_int16 v_two = cv::vx_setall_s16(2);
+            auto sign = [&](int k) {
+                cv::v_int16 v = cv::vx_load(src + k);
+                return ((v > v_pos) & v_one) | ((v < v_neg) & v_two);
+            };
+            for (; j <= cols - 2*n; j += 2*n) {
+                cv::v_store(dst + j, cv::v_pack_u(sign(j), sign(j + n)));
+            }
+#endif
+            for (; j < cols; j++) {
+                dst[j] = (src[j] > swing ? 1 : 0) | (src[j] < -swing ? 2 : 0);
+            }
+        }
+    });
+
+    // OR the signs over each 3x3 neighbourhood, both bits set means a
+    // zero crossing
+    parallelRows(rows, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            const uchar *r0 = signs_padded.ptr<uchar>(i) + 1;
+            const uchar *r1 = signs_padded.ptr<uchar>(i + 1) + 1;
+            const uchar *r2 = signs_padded.ptr<uchar>(i + 2) + 1;
+            uchar *dst = output.ptr<uchar>(i);
+            int j = 0;
+#if CV_SIMD
+            const int n = cv::v_uint8::nlanes;
+            const cv::v_uint8 v_both = cv::vx_setall_u8(3);
+            for (; j <= cols - n; j += n) {
+                cv::v_uint8 left = cv::vx_load(r0 + j - 1) | cv::vx_load(r1 + j - 1) |
+                                   cv::vx_load(r2 + j - 1);
+                cv::v_uint8 centre = cv::vx_load(r0 + j) | cv::vx_load(r1 + j) |
+                                     cv::vx_load(r2 + j);
+                cv::v_uint8 right = cv::vx_load(r0 + j + 1) | cv::vx_load(r1 + j + 1) |
+                                    cv::vx_load(r2 + j + 1);
+                cv::v_store(dst + j, (left | centre | right) == v_both);
+            }
+#endif
+            for (; j < cols; j++) {
+                uchar signs = r0[j-1] | r0[j] | r0[j+1] |
+                              r1[j-1] | r1[j] | r1[j+1] |
+                              r2[j-1] | r2[j] | r2[j+1];
+                dst[j] = signs == 3 ? 255 : 0;
+            }
+        }
+    });
+}
+
+int gaussian_ksize(double sigma) {
+    int ksize = 2*ceil(3.7*sigma - 1) + 1;
+    if (ksize > 31) ksize=31;
+    return ksize;
+}
@@ -2,130 +2,104 @@
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
 #include <iostream>
+#include <string>
 
-void weightedSquareDifference(const cv::Mat& src, cv::Mat& dest, const cv::Mat& window, cv::Point anchor = cv::Point(-1, -1)){
-    CV_Assert(src.depth() == CV_8U);
-    if(anchor==cv::Point(-1, -1)){
-        anchor = cv::Point((window.cols-1)/2, (window.rows-1)/2);
+#include "frame_loop.h"
+#include "operation_chain.h"
+#include "row_operations.h"
+#include "square_difference.h"
+
+int main(int argc, char** argv){
+    cv::CommandLineParser parser(argc, argv, std::string(FrameLoop::keys) +
+        "{op|0|index of the operation to start with}"
+        "{window|3|size of the square difference window}"
+        "{compare||time each operation fused and on whole images at 1080p}");
+    if(parser.has("help")){
+        parser.printMessage();
+        return 0;
+    }
+
+    // Every operation starts from the smoothed grey image. All but the
+    // normalisation run fused, a strip of rows at a time.
+    ColorConvertOperation to_gray(cv::COLOR_RGB2GRAY, CV_8UC1);
+    GaussianBlurOperation blur(5, 1);
+    // 3x3 Sobel kernels, saturated to 8 bits like cv::Sobel with CV_8U
+    Filter2DOperation grad_x((cv::Mat_<char>(3,3) << -1,0,1, -2,0,2, -1,0,1), CV_8U);
+    Filter2DOperation grad_y((cv::Mat_<char>(3,3) << -1,-2,-1, 0,0,0, 1,2,1), CV_8U);
+    SobelMagnitudeOperation grad_mag;
+    NormalizeOperation normalize;
+    // What happens if we convolve (filter) the image with various kernels?
+    // Vertical step kernel -> Large for horizontal edges
+    Filter2DOperation step_vertical((cv::Mat_<char>(3,3) << 5,5,5, 0,0,0, -5,-5,-5));
+    // Horizontal step kernel -> Large for vertical edges
+    Filter2DOperation step_horizontal((cv::Mat_<char>(3,3) << 5,0,-5, 5,0,-5, 5,0,-5));
+    // An edge detection kernel which detects edges in all directions
+    Filter2DOperation edge_diagonal((cv::Mat_<char>(3,3) << 1,0,-1, 0,0,0, -1,0,1));
+    // A better edge detection kernel
+    Filter2DOperation edge_laplacian((cv::Mat_<char>(3,3) << 0,1,0, 1,-4,1, 0,1,0));
+    // An even better edge detection kernel
+    Filter2DOperation edge_all((cv::Mat_<char>(3,3) << -1,-1,-1, -1,8,-1, -1,-1,-1));
+
+    std::vector<OperationChain> chains(9);
+    for(OperationChain &chain: chains){
+        chain.add(to_gray).add(blur);
     }
-    for(int y=0; y<src.rows; y++){
-        for(int x=0; x<src.cols; x++){
-            int sum = 0;
-            for(int v=0; v<window.rows; v++){
-                for(int u=0; u<window.cols; u++){
-                    if(y+v-anchor.y>0 && y+v-anchor.y<src.rows &&
-                            x+u-anchor.x>0 && x+u-anchor.x<src.cols){
-                        sum += (int)window.ptr<uchar>(v)[u] *
-                                pow(src.ptr<uchar>(y+v-anchor.y)[x+u-anchor.x]
-                                    - src.ptr<uchar>(y)[x], 2);
-                    }
-                }
-            }
-            dest.ptr<uchar>(y)[x] = (uchar)sum;
+    // 0: Base image
+    // 1, 2: X and Y components of the gradient
+    chains[1].add(grad_x);
+    chains[2].add(grad_y);
+    // 3: Magnitude of the gradient
+    chains[3].add(grad_mag).add(normalize);
+    chains[4].add(step_vertical).add(normalize);
+    chains[5].add(step_horizontal).add(normalize);
+    chains[6].add(edge_diagonal).add(normalize);
+    chains[7].add(edge_laplacian).add(normalize);
+    chains[8].add(edge_all).add(normalize);
+
+    if(parser.has("compare")){
+        cv::samples::addSamplesDataSearchPath("data");
+        cv::Mat image = cv::imread(cv::samples::findFile("lena.jpg"));
+        if(image.empty()){
+            std::cout << "Could not read lena.jpg" << std::endl;
+            return 1;
+        }
+        cv::resize(image, image, cv::Size(1920, 1080));
+        for(std::size_t i = 0; i < chains.size(); i++){
+            compareChainModes(std::cout, "Operation " + std::to_string(i), chains[i], image);
         }
+        return 0;
     }
-}
 
-int main(int argc, char** argv){
-    cv::VideoCapture video;
-    video.open(0);
-    if(!video.isOpened()){
-        std::cout << "Could not open video capture." << std::endl;
+    FrameLoop loop(parser, "camera:0");
+    if(!loop.isOpened()){
+        std::cout << "Could not open frame source." << std::endl;
         return 1;
     }
-    cv::Mat frame, output;
-    video >> frame; // Use for getting image size
-    cv::Mat gray;
-    cv::Mat grad_x, grad_y, grad_mag;
-    cv::Mat kernel;
-    cv::Mat window = cv::Mat::ones(3, 3, CV_8U);
-    int op=0;
-    while(true){
-        video >> frame; // Overloaded >> operator, reads current frame into a mat
-        cv::cvtColor(frame, gray, cv::COLOR_RGB2GRAY);
-        cv::GaussianBlur(gray, gray, cv::Size(5, 5), 1);
-        if(frame.empty()){
+    cv::Mat frame, output, normalized;
+    int window_size = parser.get<int>("window");
+    cv::Mat window = cv::Mat::ones(window_size, window_size, CV_8U);
+    int op = parser.get<int>("op");
+    while(loop.next(frame)){
+        if(op >= 0 && op < (int)chains.size()){
+            chains[op].apply(frame);
+            loop.show("Frame", chains[op].get_output());
+        }else if(op == 9){
+            // Rectangular window
+            chains[0].apply(frame);
+            weightedSquareDifference(chains[0].get_output(), output, window,
+                                     cv::Point(-1, -1), CV_32F);
+            // Not in place, that would change output's depth and make the
+            // next frame allocate it again
+            cv::normalize(output, normalized, 0, 255, cv::NORM_MINMAX, CV_8U);
+            loop.show("Frame", normalized);
+        }else{
+            // 10: Find the gradient of the above, which simplfies to a
+            // linear operation
             break;
         }
-        switch(op){
-            case 0:
-                // Base image
-                cv::imshow("Frame", gray);
-                break;
-            case 1:
-                // X component of the gradient
-                cv::Sobel(gray, grad_x, CV_8U, 1, 0, 3, 1, 0, cv::BORDER_DEFAULT);
-                cv::imshow("Frame", grad_x);
-                break;
-            case 2:
-                // Y component of the gradient
-                cv::Sobel(gray, grad_y, CV_8U, 0, 1, 3, 1, 0, cv::BORDER_DEFAULT);
-                cv::imshow("Frame", grad_y);
-                break;
-            case 3:
-                // Magnitude of the gradient
-                // src, dst, depth, dx, dy, kernel size, scale, delta, border type
-                cv::Sobel(gray, grad_x, CV_8U, 1, 0, 3, 1, 0, cv::BORDER_DEFAULT);
-                cv::Sobel(gray, grad_y, CV_8U, 0, 1, 3, 1, 0, cv::BORDER_DEFAULT);
-                grad_x.convertTo(grad_x, CV_32F);
-                grad_y.convertTo(grad_y, CV_32F);
-                cv::magnitude(grad_x, grad_y, grad_mag);
-                grad_mag.convertTo(grad_mag, CV_8U);
-                cv::normalize(grad_mag, grad_mag, 0, 255, cv::NORM_MINMAX);
-                cv::imshow("Frame", grad_mag);
-                break;
-            case 4:
-                // What happens if we convolve (filter) the image with
-                // various kernels?
-                // Vertical step kernel -> Large for horizontal edges
-                kernel = (cv::Mat_<char>(3,3) << 5,5,5, 0,0,0, -5,-5,-5);
-                cv::filter2D(gray, output, -1, kernel);
-                cv::normalize(output, output, 0, 255, cv::NORM_MINMAX);
-                cv::imshow("Frame", output);
-                break;
-            case 5:
-                // Horizontal step kernel -> Large for vertical edges
-                kernel = (cv::Mat_<char>(3,3) << 5,0,-5, 5,0,-5, 5,0,-5);
-                cv::filter2D(gray, output, -1, kernel);
-                cv::normalize(output, output, 0, 255, cv::NORM_MINMAX);
-                cv::imshow("Frame", output);
-                break;
-            case 6:
-                // An edge detection kernel which detects edges
-                // in all directions
-                kernel = (cv::Mat_<char>(3,3) << 1,0,-1, 0,0,0, -1,0,1);
-                cv::filter2D(gray, output, -1, kernel);
-                cv::normalize(output, output, 0, 255, cv::NORM_MINMAX);
-                cv::imshow("Frame", output);
-                break;
-            case 7:
-                // A better edge detection kernel
-                kernel = (cv::Mat_<char>(3,3) << 0,1,0, 1,-4,1, 0,1,0);
-                cv::filter2D(gray, output, -1, kernel);
-                cv::normalize(output, output, 0, 255, cv::NORM_MINMAX);
-                cv::imshow("Frame", output);
-                break;
-            case 8:
-                // An even better edge detection kernel
-                kernel = (cv::Mat_<char>(3,3) << -1,-1,-1, -1,8,-1, -1,-1,-1);
-                cv::filter2D(gray, output, -1, kernel);
-                cv::normalize(output, output, 0, 255, cv::NORM_MINMAX);
-                cv::imshow("Frame", output);
-                break;
-            case 9:
-                // Rectangular window
-                weightedSquareDifference(gray, output, window);
-                cv::normalize(output, output, 0, 255, cv::NORM_MINMAX);
-                cv::imshow("Frame", output);
-                break;
-            case 10:
-                // Find the gradient of the above, which simplfies to a
-                // linear operation
-            default:
-                return 0;
-        }
-        char c = (char)cv::waitKey(25);
+        char c = (char)loop.waitKey(25);
         if(c==27) op++;
     }
+    loop.report(std::cout);
     return 0;
 }
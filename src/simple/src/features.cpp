@@ -2,55 +2,275 @@
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/features2d.hpp>
+#include <opencv2/videoio.hpp>
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <memory>
+
+#include "frame_loop.h"
+#include "hamming_matcher.h"
+#include "keypoint_tracker.h"
+
+static const int num_ops = 4;
+static const char *const detect_names[num_ops] = { "", "SIFT detect", "FAST detect", "ORB detect" };
+static const char *const track_names[num_ops] = { "", "SIFT track", "FAST track", "ORB track" };
+
+static cv::Ptr<cv::Feature2D> createDetector(int op){
+    switch(op){
+        case 1:
+            return cv::SIFT::create();
+        case 2:
+            return cv::FastFeatureDetector::create();
+        case 3:
+            return cv::ORB::create();
+        default:
+            return cv::Ptr<cv::Feature2D>();
+    }
+}
+
+// Keypoints per second and track survival, detecting on every frame
+// against tracking, for each detector on the sample videos
+static int compareTracking(int max_frames){
+    cv::samples::addSamplesDataSearchPath("data");
+    for(const char *name: { "tree.avi", "Megamind.avi" }){
+        for(int op = 1; op < num_ops; op++){
+            cv::Ptr<cv::Feature2D> detector = createDetector(op);
+            KeypointTracker tracker([op]() { return createDetector(op); });
+            cv::VideoCapture capture(cv::samples::findFile(name));
+            if(!capture.isOpened()){
+                std::cout << "Could not open " << name << std::endl;
+                return 1;
+            }
+            cv::Mat frame, gray;
+            std::vector<cv::KeyPoint> keypoints;
+            std::size_t detected = 0;
+            double detect_ms = 0;
+            int frames = 0;
+            while(frames < max_frames && capture.read(frame)){
+                cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+                int64 start = cv::getTickCount();
+                detector->detect(gray, keypoints);
+                detect_ms += 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency();
+                detected += keypoints.size();
+                tracker.update(gray);
+                frames++;
+            }
+            std::cout << name << ", " << detect_names[op] << " every frame: "
+                      << 1000.0*detected/detect_ms << " keypoints/s, "
+                      << (double)detected/frames << " keypoints/frame" << std::endl;
+            tracker.report(std::cout);
+        }
+    }
+    return 0;
+}
+
+// Fraction of matches which land within 3 pixels of where the ground
+// truth homography puts them
+static double matchPrecision(const std::vector<cv::KeyPoint> &query_keypoints,
+                             const std::vector<cv::KeyPoint> &train_keypoints,
+                             const std::vector<cv::DMatch> &matches, const cv::Mat &H){
+    if(matches.empty()) return 0;
+    std::vector<cv::Point2f> from, to;
+    for(const cv::DMatch &match: matches){
+        from.push_back(query_keypoints[match.queryIdx].pt);
+    }
+    cv::perspectiveTransform(from, to, H);
+    int correct = 0;
+    for(std::size_t i = 0; i < matches.size(); i++){
+        if(cv::norm(to[i] - train_keypoints[matches[i].trainIdx].pt) < 3) correct++;
+    }
+    return (double)correct/matches.size();
+}
+
+// Mean distance between the image corners mapped by H and by H_true
+static double cornerError(const cv::Mat &H, const cv::Mat &H_true, cv::Size size){
+    if(H.empty()) return -1;
+    std::vector<cv::Point2f> corners = {
+        cv::Point2f(0, 0), cv::Point2f((float)size.width, 0),
+        cv::Point2f((float)size.width, (float)size.height), cv::Point2f(0, (float)size.height) };
+    std::vector<cv::Point2f> a, b;
+    cv::perspectiveTransform(corners, a, H);
+    cv::perspectiveTransform(corners, b, H_true);
+    double sum = 0;
+    for(int i = 0; i < 4; i++) sum += cv::norm(a[i] - b[i]);
+    return sum/4;
+}
+
+// Times each matcher on ORB descriptors of two image pairs, and checks the
+// matches and RANSAC homography against ground truth where there is some
+static int compareMatching(){
+    cv::samples::addSamplesDataSearchPath("data");
+    typedef std::function<void(const cv::Mat&, const cv::Mat&, std::vector<cv::DMatch>&)> MatchFunction;
+    struct Method {
+        std::string name;
+        MatchFunction match;
+    };
+    auto hamming = [](bool use_index, double ratio, bool cross_check) -> MatchFunction {
+        HammingMatcher::Settings settings;
+        settings.use_index = use_index;
+        settings.ratio = ratio;
+        settings.cross_check = cross_check;
+        return [settings](const cv::Mat &query, const cv::Mat &train, std::vector<cv::DMatch> &matches){
+            HammingMatcher matcher(settings);
+            matcher.train(train);
+            matcher.match(query, matches);
+        };
+    };
+    std::vector<Method> methods = {
+        { "cv::BFMatcher, ratio 0.8", [](const cv::Mat &query, const cv::Mat &train,
+                                         std::vector<cv::DMatch> &matches){
+            cv::BFMatcher matcher(cv::NORM_HAMMING);
+            std::vector<std::vector<cv::DMatch>> knn;
+            matcher.knnMatch(query, train, knn, 2);
+            matches.clear();
+            for(const std::vector<cv::DMatch> &pair: knn){
+                if(pair.size() == 2 && pair[0].distance < 0.8f*pair[1].distance){
+                    matches.push_back(pair[0]);
+                }
+            }
+        }},
+        { "cv::BFMatcher, cross check", [](const cv::Mat &query, const cv::Mat &train,
+                                           std::vector<cv::DMatch> &matches){
+            cv::BFMatcher(cv::NORM_HAMMING, true).match(query, train, matches);
+        }},
+        { "HammingMatcher, ratio 0.8", hamming(false, 0.8, false) },
+        { "HammingMatcher, cross check", hamming(false, 0, true) },
+        { "HammingMatcher index, ratio 0.8", hamming(true, 0.8, false) },
+        { "HammingMatcher index, cross check", hamming(true, 0, true) },
+    };
+
+    cv::Mat H13;
+    cv::FileStorage fs(cv::samples::findFile("H1to3p.xml"), cv::FileStorage::READ);
+    fs["H13"] >> H13;
+    struct Pair {
+        const char *query, *train;
+        cv::Mat H; // Ground truth, if known
+    };
+    const Pair pairs[] = {
+        { "box.png", "box_in_scene.png", cv::Mat() },
+        { "graf1.png", "graf3.png", H13 },
+    };
+
+    auto orb = cv::ORB::create(5000);
+    for(const Pair &pair: pairs){
+        cv::Mat query_image = cv::imread(cv::samples::findFile(pair.query), cv::IMREAD_GRAYSCALE);
+        cv::Mat train_image = cv::imread(cv::samples::findFile(pair.train), cv::IMREAD_GRAYSCALE);
+        if(query_image.empty() || train_image.empty()){
+            std::cout << "Could not read " << pair.query << " or " << pair.train << std::endl;
+            return 1;
+        }
+        std::vector<cv::KeyPoint> query_keypoints, train_keypoints;
+        cv::Mat query_descriptors, train_descriptors;
+        orb->detectAndCompute(query_image, cv::noArray(), query_keypoints, query_descriptors);
+        orb->detectAndCompute(train_image, cv::noArray(), train_keypoints, train_descriptors);
+        std::cout << pair.query << " (" << query_keypoints.size() << " keypoints) vs "
+                  << pair.train << " (" << train_keypoints.size() << ")" << std::endl;
+
+        for(const Method &method: methods){
+            std::vector<cv::DMatch> matches, inliers;
+            const int repeats = 10;
+            method.match(query_descriptors, train_descriptors, matches);
+            int64 start = cv::getTickCount();
+            for(int k = 0; k < repeats; k++){
+                method.match(query_descriptors, train_descriptors, matches);
+            }
+            double ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency()/repeats;
+            cv::Mat H = matchedHomography(query_keypoints, train_keypoints, matches, inliers);
+
+            std::cout << "  " << method.name << ": " << ms << " ms, "
+                      << 1000.0*query_descriptors.rows/ms << " queries/s, "
+                      << matches.size() << " matches, " << inliers.size() << " RANSAC inliers";
+            if(!pair.H.empty()){
+                std::cout << ", precision " << matchPrecision(query_keypoints, train_keypoints,
+                                                              matches, pair.H)
+                          << ", homography corner error "
+                          << cornerError(H, pair.H, query_image.size()) << " px";
+            }
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
 
 int main(int argc, char** argv){
-    cv::VideoCapture video;
-    video.open(0);
-    if(!video.isOpened()){
-        std::cout << "Could not open video capture." << std::endl;
+    cv::CommandLineParser parser(argc, argv, std::string(FrameLoop::keys) +
+        "{op|0|index of the operation to start with}"
+        "{track||detect on keyframes only, and track keypoints in between}"
+        "{compare||compare detecting every frame with tracking on the sample videos}"
+        "{matching||compare the Hamming matchers with cv::BFMatcher on the sample image pairs}");
+    if(parser.has("help")){
+        parser.printMessage();
+        return 0;
+    }
+    if(parser.has("matching")){
+        return compareMatching();
+    }
+    if(parser.has("compare")){
+        int frames = parser.get<int>("frames");
+        return compareTracking(frames > 0 ? frames : 300);
+    }
+    FrameLoop loop(parser, "camera:0");
+    if(!loop.isOpened()){
+        std::cout << "Could not open frame source." << std::endl;
         return 1;
     }
-    cv::Mat frame, gray, temp;
-    video >> frame; // Use for getting image size
-    cv::Mat window = cv::Mat::ones(3, 3, CV_8U);
-    int op=0;
+    cv::Mat gray;
+    // Moved on by the key handler, which runs on the display thread when
+    // --pipeline is used
+    std::atomic<int> op(parser.get<int>("op"));
+    bool track = parser.has("track");
 
-    auto sift = cv::SIFT::create();
-    auto fast = cv::FastFeatureDetector::create();
-    auto orb = cv::ORB::create();
+    std::vector<cv::Ptr<cv::Feature2D>> detectors;
+    std::vector<std::unique_ptr<KeypointTracker>> trackers;
+    for(int i = 0; i < num_ops; i++){
+        detectors.push_back(createDetector(i));
+        trackers.push_back(std::unique_ptr<KeypointTracker>(
+            new KeypointTracker([i]() { return createDetector(i); })));
+    }
     std::vector<cv::KeyPoint> keypoints;
+    int last_op = -1;
 
-    while(true){
-        video >> frame; // Overloaded >> operator, reads current frame into a mat
-        cv::cvtColor(frame, gray, cv::COLOR_RGB2GRAY);
-        cv::GaussianBlur(gray, gray, cv::Size(5, 5), 1);
-        if(frame.empty()){
-            break;
-        }
-        switch(op){
-            case 0:
+    loop.run("Frame", 25,
+        [&](const cv::Mat &frame, cv::Mat &result) {
+            {
+                TRACE_SCOPE("cvtColor");
+                cv::cvtColor(frame, gray, cv::COLOR_RGB2GRAY);
+            }
+            {
+                TRACE_SCOPE("GaussianBlur");
+                cv::GaussianBlur(gray, gray, cv::Size(5, 5), 1);
+            }
+            int index = op.load();
+            if(index == 0){
                 // Base image
-                cv::imshow("Frame", gray);
-                break;
-            case 1:
-                sift->detect(gray, keypoints);
-                cv::drawKeypoints(gray, keypoints, temp);
-                cv::imshow("Frame", temp);
-            case 2:
-                fast->detect(gray, keypoints);
-                cv::drawKeypoints(gray, keypoints, temp);
-                cv::imshow("Frame", temp);
-            case 3:
-                // X component of the gradient
-                orb->detect(gray, keypoints);
-                cv::drawKeypoints(gray, keypoints, temp);
-                cv::imshow("Frame", temp);
-                break;
-            default:
-                return 0;
+                gray.copyTo(result);
+                return;
+            }
+            if(index < 0 || index >= num_ops) return;
+            if(track){
+                // Its last frame could be from a while ago
+                if(index != last_op) trackers[index]->restart();
+                TRACE_SCOPE(track_names[index]);
+                trackers[index]->update(gray);
+                keypoints = trackers[index]->get_keypoints();
+            }else{
+                TRACE_SCOPE(detect_names[index]);
+                detectors[index]->detect(gray, keypoints);
+            }
+            last_op = index;
+            TRACE_SCOPE("drawKeypoints");
+            cv::drawKeypoints(gray, keypoints, result);
+        },
+        [&](int key) {
+            if((char)key == 27) op++;
+            return op.load() < num_ops;
+        });
+    loop.report(std::cout);
+    if(track){
+        for(int i = 1; i < num_ops; i++){
+            std::cout << detect_names[i] << " ";
+            trackers[i]->report(std::cout);
         }
-        char c = (char)cv::waitKey(25);
-        if(c==27) op++;
     }
 }
@@ -0,0 +1,10 @@
+#include "fnv_hash.h"
+
+std::uint64_t fnv1a64(const void *data, std::size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    std::uint64_t hash = 14695981039346656037ull;
+    for (std::size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i])*1099511628211ull;
+    }
+    return hash;
+}
@@ -0,0 +1,115 @@
+#include "frame_arena.h"
+
+#include <algorithm>
+#include <new>
+
+FrameArena::FrameArena():
+    counters()
+{
+}
+
+FrameArena::~FrameArena() {
+    trim();
+}
+
+FrameArena &FrameArena::shared() {
+    // Leaked on purpose, Mats in statics may be released after main returns
+    static FrameArena *arena = new FrameArena();
+    return *arena;
+}
+
+FrameArena::Counters FrameArena::get_counters()const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+void FrameArena::trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &entry: free_buffers) {
+        for (uchar *buffer: entry.second) {
+            cv::fastFree(buffer);
+            counters.bytes_held -= entry.first;
+        }
+    }
+    free_buffers.clear();
+    for (void *header: free_headers) {
+        ::operator delete(header);
+    }
+    free_headers.clear();
+}
+
+cv::UMatData *FrameArena::allocate(int dims, const int *sizes, int type, void *data,
+                                   size_t *step, cv::AccessFlag, cv::UMatUsageFlags)const
+{
+    // Same layout as cv::Mat's own allocator
+    std::size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) {
+            if (data && step[i] != CV_AUTOSTEP) {
+                CV_Assert(total <= step[i]);
+                total = step[i];
+            } else {
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    void *header;
+    if (free_headers.empty()) {
+        header = ::operator new(sizeof(cv::UMatData));
+    } else {
+        header = free_headers.back();
+        free_headers.pop_back();
+    }
+    cv::UMatData *u = new (header) cv::UMatData(this);
+
+    uchar *buffer = (uchar*)data;
+    if (data) {
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+    } else {
+        auto entry = free_buffers.find(total);
+        if (entry != free_buffers.end() && !entry->second.empty()) {
+            buffer = entry->second.back();
+            entry->second.pop_back();
+            counters.reuses++;
+        } else {
+            // Aligned to 64 bytes
+            buffer = (uchar*)cv::fastMalloc(total);
+            counters.heap_allocations++;
+            counters.bytes_held += total;
+        }
+        counters.bytes_in_use += total;
+        counters.peak_bytes_in_use = std::max(counters.peak_bytes_in_use, counters.bytes_in_use);
+    }
+    u->data = u->origdata = buffer;
+    u->size = total;
+    return u;
+}
+
+bool FrameArena::allocate(cv::UMatData *data, cv::AccessFlag, cv::UMatUsageFlags)const {
+    return data != 0;
+}
+
+void FrameArena::deallocate(cv::UMatData *u)const {
+    if (!u) return;
+    CV_Assert(u->urefcount == 0 && u->refcount == 0);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+        free_buffers[u->size].push_back(u->origdata);
+        counters.bytes_in_use -= u->size;
+    }
+    u->~UMatData();
+    free_headers.push_back(u);
+}
+
+ScopedArena::ScopedArena(FrameArena &arena):
+    previous(cv::Mat::getDefaultAllocator())
+{
+    cv::Mat::setDefaultAllocator(&arena);
+}
+
+ScopedArena::~ScopedArena() {
+    cv::Mat::setDefaultAllocator(previous);
+}
@@ -0,0 +1,224 @@
+#include "frame_loop.h"
+
+#include <opencv2/highgui.hpp>
+#include <algorithm>
+#include <utility>
+
+const char *const FrameLoop::keys =
+    "{help h||print this message}"
+    "{source||frame source: camera:N, video:PATH, images:GLOB or synthetic:WxH}"
+    "{headless||run without display as fast as possible, then report timing}"
+    "{frames|0|stop after this many frames (0 = when the source ends)}"
+    "{loop||restart video files and image sequences when they end}"
+    "{pipeline||capture, process and display on separate threads}"
+    "{ring|4|frames buffered between pipeline stages}"
+    "{drop||when the pipeline falls behind, drop the oldest frames instead of waiting}"
+    "{overlay||draw per stage timings and fps over the image}"
+    "{trace||write a Chrome trace of the run to this file when reporting}"
+    "{undistort||undistort frames with the intrinsics in this file, eg: data/intrinsics.yml}"
+    "{arena||allocate images from a recycling arena, and report heap allocations per frame}";
+
+// Frames to run in headless mode if the source never ends by itself
+static const int default_headless_frames = 300;
+
+FrameLoop::FrameLoop(const cv::CommandLineParser &parser,
+                     const std::string &default_source):
+    FrameLoop(parser, openFrameSource(parser.has("source") ?
+                                      parser.get<std::string>("source") : default_source))
+{
+}
+
+FrameLoop::FrameLoop(const cv::CommandLineParser &parser,
+                     std::unique_ptr<FrameSource> source_in):
+    source(std::move(source_in)), headless(parser.has("headless")), loop(parser.has("loop")),
+    max_frames(parser.get<int>("frames")),
+    pipelined(parser.has("pipeline")), ring_size(std::max(1, parser.get<int>("ring"))),
+    drop(parser.has("drop")), overlay(parser.has("overlay")),
+    trace_path(parser.get<std::string>("trace")),
+    intrinsics_path(parser.get<std::string>("undistort")),
+    frame_count(0), frame_open(false), start_ticks(0), end_ticks(0), frame_ticks(0),
+    read_ms(0)
+{
+    if (parser.has("arena")) {
+        arena_scope.reset(new ScopedArena(FrameArena::shared()));
+    }
+    if (headless && max_frames <= 0 && source &&
+            (!source->isBounded() || loop)) {
+        max_frames = default_headless_frames;
+    }
+}
+
+static double ticksToMs(int64 ticks){
+    return 1000.0*ticks/cv::getTickFrequency();
+}
+
+void FrameLoop::finishFrame(){
+    if (!frame_open) return;
+    end_ticks = cv::getTickCount();
+    latencies_ms.push_back(ticksToMs(end_ticks - frame_ticks));
+    TRACE_RECORD("frame", frame_ticks, end_ticks);
+    countAllocations();
+    frame_open = false;
+}
+
+void FrameLoop::countAllocations(){
+    if (arena_scope) {
+        arena_allocations.push_back(FrameArena::shared().get_counters().heap_allocations);
+    }
+}
+
+bool FrameLoop::read(cv::Mat &frame){
+    if (!source || (max_frames > 0 && frame_count >= max_frames)) return false;
+
+    int64 before = cv::getTickCount();
+    if (frame_count == 0) start_ticks = before;
+    bool ok = source->read(frame);
+    if (!ok && loop && source->rewind()) {
+        ok = source->read(frame);
+    }
+    if (!ok) return false;
+    if (!intrinsics_path.empty()) undistortFrame(frame);
+
+    int64 after = cv::getTickCount();
+    TRACE_RECORD("capture", before, after);
+    read_ms += ticksToMs(after - before);
+    frame_count++;
+    return true;
+}
+
+void FrameLoop::undistortFrame(cv::Mat &frame){
+    if (!undistorter || undistorter->get_size() != frame.size()) {
+        cv::Mat camera_matrix, dist_coeffs;
+        if (!UndistortOperation::readIntrinsics(intrinsics_path, frame.size(),
+                                                camera_matrix, dist_coeffs)) {
+            std::cout << "Could not read intrinsics from " << intrinsics_path
+                      << ", frames won't be undistorted" << std::endl;
+            intrinsics_path.clear();
+            return;
+        }
+        undistorter.reset(new UndistortOperation(camera_matrix, dist_coeffs, frame.size()));
+    }
+    TRACE_SCOPE("undistort");
+    // The last frame's buffer is reused for the output
+    std::swap(frame, distorted);
+    undistorter->undistort(distorted, frame);
+}
+
+bool FrameLoop::next(cv::Mat &frame){
+    // Frames which were never shown still count towards the latency
+    finishFrame();
+    if (!read(frame)) return false;
+    frame_ticks = cv::getTickCount();
+    frame_open = true;
+    return true;
+}
+
+void FrameLoop::run(const std::string &window, int delay,
+                    const ProcessFunction &process, const KeyFunction &on_key){
+    if (!pipelined) {
+        cv::Mat frame, result;
+        while (next(frame)) {
+            process(frame, result);
+            show(window, result);
+            if (!on_key(waitKey(delay))) break;
+        }
+        return;
+    }
+
+    pipeline.reset(new Pipeline(ring_size,
+        drop ? Pipeline::Ring::DROP_OLDEST : Pipeline::Ring::BLOCK));
+    pipeline->run(
+        [this](cv::Mat &frame) { return read(frame); },
+        process,
+        [&](const PipelineFrame &slot) {
+            // Capture to display, including time spent queued
+            end_ticks = cv::getTickCount();
+            latencies_ms.push_back(ticksToMs(end_ticks - slot.capture_ticks));
+            countAllocations();
+            TRACE_RECORD("frame", slot.capture_ticks, end_ticks);
+            display(window, slot.result);
+            return on_key(waitKey(delay));
+        });
+}
+
+void FrameLoop::show(const std::string &window, const cv::Mat &image){
+    finishFrame();
+    display(window, image);
+}
+
+void FrameLoop::display(const std::string &window, const cv::Mat &image){
+    if (headless || image.empty()) return;
+    TRACE_SCOPE("imshow");
+    if (overlay) {
+        image.copyTo(overlay_image);
+        Trace::drawOverlay(overlay_image);
+        cv::imshow(window, overlay_image);
+    } else {
+        cv::imshow(window, image);
+    }
+}
+
+int FrameLoop::waitKey(int delay){
+    if (headless) return -1;
+    TRACE_SCOPE("waitKey");
+    return cv::waitKey(delay);
+}
+
+static double percentile(const std::vector<double> &sorted, double p){
+    if (sorted.empty()) return 0;
+    std::size_t i = (std::size_t)(p*(sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+void FrameLoop::report(std::ostream &os)const{
+    if (!source) return;
+    os << "Source: " << source->describe() << std::endl;
+    if (frame_count == 0) {
+        os << "No frames processed" << std::endl;
+        return;
+    }
+    int64 end = frame_open ? cv::getTickCount() : end_ticks;
+    double elapsed_ms = ticksToMs(end - start_ticks);
+    std::vector<double> sorted = latencies_ms;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0;
+    for (double ms: sorted) sum += ms;
+
+    os << "Frames: " << frame_count << " in " << elapsed_ms/1000 << " s ("
+       << 1000*frame_count/elapsed_ms << " fps)" << std::endl;
+    os << "Latency ms: mean " << sum/std::max<std::size_t>(sorted.size(), 1)
+       << ", p50 " << percentile(sorted, 0.5)
+       << ", p95 " << percentile(sorted, 0.95)
+       << ", max " << (sorted.empty() ? 0 : sorted.back()) << std::endl;
+    os << "Read ms: mean " << read_ms/frame_count << std::endl;
+    if (undistorter) {
+        os << "Undistortion maps "
+           << (undistorter->was_cached() ? "mapped from " : "built, cached in ")
+           << undistorter->get_cache_path() << " in " << undistorter->get_startup_ms() << " ms"
+           << std::endl;
+    }
+    if (pipeline) {
+        pipeline->report(os);
+    }
+    if (!arena_allocations.empty()) {
+        // The first frames allocate everything, after that it should be none
+        const std::size_t warm_up = std::min<std::size_t>(5, arena_allocations.size() - 1);
+        std::size_t first = arena_allocations[warm_up];
+        std::size_t steady = arena_allocations.back() - first;
+        std::size_t steady_frames = arena_allocations.size() - 1 - warm_up;
+        FrameArena::Counters counters = FrameArena::shared().get_counters();
+        os << "Arena: " << first << " heap allocations by frame " << warm_up + 1
+           << ", then " << steady << " in " << steady_frames << " frames ("
+           << (steady_frames ? (double)steady/steady_frames : 0) << " per frame), "
+           << counters.reuses << " reuses, peak in use " << counters.peak_bytes_in_use/1e6
+           << " MB, held " << counters.bytes_held/1e6 << " MB" << std::endl;
+    }
+    Trace::report(os);
+    if (!trace_path.empty()) {
+        if (Trace::writeChromeTrace(trace_path)) {
+            os << "Trace written to " << trace_path << std::endl;
+        } else {
+            os << "Could not write " << trace_path << std::endl;
+        }
+    }
+}
@@ -0,0 +1,189 @@
+#include "frame_source.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <cmath>
+#include <cstdio>
+#include <utility>
+
+static std::string findDataFile(const std::string &path){
+    static bool search_path_added = false;
+    if (!search_path_added) {
+        cv::samples::addSamplesDataSearchPath("data");
+        search_path_added = true;
+    }
+    std::string found = cv::samples::findFile(path, false, true);
+    if (found.empty()) return path;
+    return found;
+}
+
+VideoCaptureSource::VideoCaptureSource(int device):
+    bounded(false), name("camera " + std::to_string(device))
+{
+    video.open(device);
+}
+
+VideoCaptureSource::VideoCaptureSource(const std::string &filename):
+    bounded(true), name(filename)
+{
+    video.open(findDataFile(filename));
+}
+
+bool VideoCaptureSource::read(cv::Mat &frame){
+    if (!video.read(frame)) return false;
+    return !frame.empty();
+}
+
+bool VideoCaptureSource::rewind(){
+    if (!bounded) return false;
+    return video.set(cv::CAP_PROP_POS_FRAMES, 0);
+}
+
+ImageSequenceSource::ImageSequenceSource(const std::string &pattern):
+    pattern(pattern), index(0)
+{
+    cv::glob(pattern, files, false);
+    if (files.empty()) {
+        // Try again relative to the data directory
+        std::size_t slash = pattern.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : pattern.substr(0, slash);
+        std::string found = findDataFile(dir);
+        if (found != dir) {
+            cv::glob(found + pattern.substr(slash == std::string::npos ? 0 : slash),
+                     files, false);
+        }
+    }
+    images.resize(files.size());
+}
+
+bool ImageSequenceSource::read(cv::Mat &frame){
+    while (index < files.size()) {
+        cv::Mat &image = images[index];
+        if (image.empty()) {
+            image = cv::imread(files[index]);
+        }
+        index++;
+        // Skip anything imread can't decode
+        if (!image.empty()) {
+            // Hand out a copy, callers are allowed to draw on the frame
+            image.copyTo(frame);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string ImageSequenceSource::describe()const{
+    return pattern + " (" + std::to_string(files.size()) + " images)";
+}
+
+SyntheticSource::SyntheticSource(cv::Size size):
+    size(size), count(0)
+{
+    background.create(size, CV_8UC3);
+    for (int i = 0; i < size.height; i++) {
+        cv::Vec3b *row = background.ptr<cv::Vec3b>(i);
+        for (int j = 0; j < size.width; j++) {
+            row[j] = cv::Vec3b(
+                (uchar)(255*j/size.width),
+                (uchar)(255*i/size.height),
+                (uchar)(128));
+        }
+    }
+}
+
+bool SyntheticSource::read(cv::Mat &frame){
+    background.copyTo(frame);
+    int w = size.width, h = size.height;
+    double t = count*0.05;
+
+    // A few shapes moving around, so there are edges and features to find
+    cv::Point centre(w/2 + (int)(w/3*std::cos(t)), h/2 + (int)(h/3*std::sin(t)));
+    cv::circle(frame, centre, h/8, cv::Scalar(255, 255, 255), -1);
+    cv::Point corner(w/4 + (int)(w/5*std::sin(0.7*t)), h/4);
+    cv::rectangle(frame, corner, corner + cv::Point(w/6, h/5), cv::Scalar(0, 0, 0), -1);
+    for (int k = 0; k < 8; k++) {
+        int x = (k*w/8 + count*3) % w;
+        cv::line(frame, cv::Point(x, 0), cv::Point(w - 1 - x, h - 1),
+                 cv::Scalar(40*k, 255 - 30*k, 90), 2);
+    }
+
+    // Sensor-ish noise, seeded by frame number so runs are repeatable
+    noise.create(size, CV_8UC3);
+    cv::RNG rng(count + 1);
+    rng.fill(noise, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(16));
+    cv::add(frame, noise, frame);
+
+    count++;
+    return true;
+}
+
+std::string SyntheticSource::describe()const{
+    return "synthetic " + std::to_string(size.width) + "x" + std::to_string(size.height);
+}
+
+SideBySideSource::SideBySideSource(std::unique_ptr<FrameSource> left,
+                                   std::unique_ptr<FrameSource> right):
+    left(std::move(left)), right(std::move(right))
+{
+    CV_Assert(this->left && this->right);
+}
+
+bool SideBySideSource::read(cv::Mat &frame){
+    if (!left->read(left_frame) || !right->read(right_frame)) return false;
+    if (left_frame.size() != right_frame.size() || left_frame.type() != right_frame.type()) {
+        return false;
+    }
+    cv::hconcat(left_frame, right_frame, frame);
+    return true;
+}
+
+std::string SideBySideSource::describe()const{
+    return left->describe() + " | " + right->describe();
+}
+
+static bool isNumber(const std::string &s){
+    if (s.empty()) return false;
+    for (char c: s) {
+        if (c < '0' || c > '9') return false;
+    }
+    return true;
+}
+
+std::unique_ptr<FrameSource> openFrameSource(const std::string &spec){
+    std::string kind, arg;
+    std::size_t colon = spec.find(':');
+    if (colon != std::string::npos) {
+        kind = spec.substr(0, colon);
+        arg = spec.substr(colon + 1);
+    } else if (isNumber(spec)) {
+        kind = "camera";
+        arg = spec;
+    } else if (spec == "synthetic") {
+        kind = "synthetic";
+    } else if (spec.find('*') != std::string::npos) {
+        kind = "images";
+        arg = spec;
+    } else {
+        kind = "video";
+        arg = spec;
+    }
+
+    if (kind == "camera") {
+        if (!isNumber(arg)) return std::unique_ptr<FrameSource>();
+        return std::unique_ptr<FrameSource>(new VideoCaptureSource(std::stoi(arg)));
+    } else if (kind == "video") {
+        return std::unique_ptr<FrameSource>(new VideoCaptureSource(arg));
+    } else if (kind == "images") {
+        return std::unique_ptr<FrameSource>(new ImageSequenceSource(arg));
+    } else if (kind == "synthetic") {
+        cv::Size size(640, 480);
+        if (!arg.empty() &&
+                std::sscanf(arg.c_str(), "%dx%d", &size.width, &size.height) != 2) {
+            return std::unique_ptr<FrameSource>();
+        }
+        if (size.width <= 0 || size.height <= 0) return std::unique_ptr<FrameSource>();
+        return std::unique_ptr<FrameSource>(new SyntheticSource(size));
+    }
+    return std::unique_ptr<FrameSource>();
+}
@@ -0,0 +1,174 @@
+#include "hamming_matcher.h"
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core/hal/hal.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <climits>
+
+int hammingDistance(const uchar *a, const uchar *b, int bytes) {
+#if CV_SIMD128
+    if (bytes == 32) {
+        // ORB, the usual case: two 128 bit registers
+        cv::v_uint8x16 x0 = cv::v_load(a) ^ cv::v_load(b);
+        cv::v_uint8x16 x1 = cv::v_load(a + 16) ^ cv::v_load(b + 16);
+        return (int)cv::v_reduce_sum(cv::v_popcount(x0) + cv::v_popcount(x1));
+    }
+#endif
+    return cv::hal::normHamming(a, b, bytes);
+}
+
+static inline void consider(HammingMatcher::Neighbours &n, int index, int distance) {
+    if (distance < n.best_distance) {
+        n.second = n.best;
+        n.second_distance = n.best_distance;
+        n.best = index;
+        n.best_distance = distance;
+    } else if (distance < n.second_distance) {
+        n.second = index;
+        n.second_distance = distance;
+    }
+}
+
+static const HammingMatcher::Neighbours no_neighbours = { -1, -1, INT_MAX, INT_MAX };
+
+HammingMatcher::HammingMatcher(const Settings &settings):
+    settings(settings), pieces(0), candidates_per_query(0)
+{
+}
+
+// 16 bit piece t of a descriptor
+static inline int pieceKey(const uchar *descriptor, int t) {
+    return descriptor[2*t] | (descriptor[2*t + 1] << 8);
+}
+
+void HammingMatcher::train(const cv::Mat &descriptors) {
+    CV_Assert(descriptors.empty() || descriptors.depth() == CV_8U);
+    train_descriptors = descriptors;
+    pieces = 0;
+    offsets.clear();
+    ids.clear();
+    if (!settings.use_index || descriptors.empty()) return;
+
+    pieces = descriptors.cols/2;
+    offsets.assign(pieces, std::vector<int>(65536 + 1, 0));
+    ids.assign(pieces, std::vector<int>(descriptors.rows));
+    cv::parallel_for_(cv::Range(0, pieces), [&](const cv::Range &range) {
+        for (int t = range.start; t < range.end; t++) {
+            std::vector<int> &offset = offsets[t];
+            for (int i = 0; i < descriptors.rows; i++) {
+                offset[pieceKey(descriptors.ptr<uchar>(i), t) + 1]++;
+            }
+            for (int k = 0; k < 65536; k++) offset[k + 1] += offset[k];
+            std::vector<int> fill(offset.begin(), offset.end() - 1);
+            for (int i = 0; i < descriptors.rows; i++) {
+                ids[t][fill[pieceKey(descriptors.ptr<uchar>(i), t)]++] = i;
+            }
+        }
+    });
+}
+
+void HammingMatcher::knn2(const cv::Mat &queries, std::vector<Neighbours> &neighbours)const {
+    neighbours.assign(queries.rows, no_neighbours);
+    if (queries.empty() || train_descriptors.empty()) {
+        candidates_per_query = 0;
+        return;
+    }
+    CV_Assert(queries.type() == train_descriptors.type() &&
+              queries.cols == train_descriptors.cols);
+    if (pieces > 0) {
+        knnIndex(queries, neighbours);
+    } else {
+        knnBrute(queries, neighbours);
+        candidates_per_query = train_descriptors.rows;
+    }
+}
+
+void HammingMatcher::knnBrute(const cv::Mat &queries, std::vector<Neighbours> &neighbours)const {
+    const int bytes = queries.cols;
+    cv::parallel_for_(cv::Range(0, queries.rows), [&](const cv::Range &range) {
+        for (int q = range.start; q < range.end; q++) {
+            const uchar *query = queries.ptr<uchar>(q);
+            Neighbours &n = neighbours[q];
+            for (int i = 0; i < train_descriptors.rows; i++) {
+                consider(n, i, hammingDistance(query, train_descriptors.ptr<uchar>(i), bytes));
+            }
+        }
+    });
+}
+
+void HammingMatcher::knnIndex(const cv::Mat &queries, std::vector<Neighbours> &neighbours)const {
+    const int bytes = queries.cols;
+    const int probes = settings.probe_bits > 0 ? 17 : 1;
+    std::vector<std::size_t> candidates(queries.rows, 0);
+    cv::parallel_for_(cv::Range(0, queries.rows), [&](const cv::Range &range) {
+        // Marks references already compared for this query
+        std::vector<int> seen(train_descriptors.rows, -1);
+        for (int q = range.start; q < range.end; q++) {
+            const uchar *query = queries.ptr<uchar>(q);
+            Neighbours &n = neighbours[q];
+            for (int t = 0; t < pieces; t++) {
+                const int key = pieceKey(query, t);
+                const std::vector<int> &offset = offsets[t];
+                for (int p = 0; p < probes; p++) {
+                    // The key itself, then each single bit flip
+                    const int probe = p == 0 ? key : key ^ (1 << (p - 1));
+                    for (int k = offset[probe]; k < offset[probe + 1]; k++) {
+                        int i = ids[t][k];
+                        if (seen[i] == q) continue;
+                        seen[i] = q;
+                        candidates[q]++;
+                        consider(n, i, hammingDistance(query, train_descriptors.ptr<uchar>(i), bytes));
+                    }
+                }
+            }
+        }
+    });
+    std::size_t total = 0;
+    for (std::size_t c: candidates) total += c;
+    candidates_per_query = (double)total/queries.rows;
+}
+
+void HammingMatcher::match(const cv::Mat &queries, std::vector<cv::DMatch> &matches)const {
+    std::vector<Neighbours> forward;
+    knn2(queries, forward);
+
+    std::vector<Neighbours> backward;
+    if (settings.cross_check) {
+        Settings reverse_settings = settings;
+        reverse_settings.cross_check = false;
+        HammingMatcher reverse(reverse_settings);
+        reverse.train(queries);
+        reverse.knn2(train_descriptors, backward);
+    }
+
+    matches.clear();
+    for (int q = 0; q < (int)forward.size(); q++) {
+        const Neighbours &n = forward[q];
+        if (n.best < 0) continue;
+        if (settings.ratio > 0 && n.second >= 0 &&
+                n.best_distance >= settings.ratio*n.second_distance) continue;
+        if (settings.cross_check && backward[n.best].best != q) continue;
+        matches.push_back(cv::DMatch(q, n.best, (float)n.best_distance));
+    }
+}
+
+cv::Mat matchedHomography(const std::vector<cv::KeyPoint> &query_keypoints,
+                          const std::vector<cv::KeyPoint> &train_keypoints,
+                          const std::vector<cv::DMatch> &matches,
+                          std::vector<cv::DMatch> &inliers, double threshold) {
+    inliers.clear();
+    if (matches.size() < 4) return cv::Mat();
+    std::vector<cv::Point2f> from, to;
+    for (const cv::DMatch &match: matches) {
+        from.push_back(query_keypoints[match.queryIdx].pt);
+        to.push_back(train_keypoints[match.trainIdx].pt);
+    }
+    std::vector<uchar> mask;
+    cv::Mat H = cv::findHomography(from, to, cv::RANSAC, threshold, mask);
+    if (H.empty()) return H;
+    for (std::size_t i = 0; i < matches.size(); i++) {
+        if (mask[i]) inliers.push_back(matches[i]);
+    }
+    return H;
+}
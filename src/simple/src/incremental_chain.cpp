@@ -0,0 +1,136 @@
+#include "incremental_chain.h"
+#include "trace.h"
+
+#include <opencv2/imgproc.hpp>
+#include <utility>
+
+IncrementalChain::IncrementalChain(const Settings &settings):
+    settings(settings), type(-1), frames_since_refresh(0), refreshing(true),
+    changed_fraction(0), computed_fraction(0), full_frame(false)
+{
+    CV_Assert(settings.downsample > 0 && settings.tile_size % settings.downsample == 0);
+}
+
+IncrementalChain &IncrementalChain::add(ImageOperation &operation) {
+    operations.push_back(&operation);
+    outputs.push_back(cv::Mat());
+    refreshing = true;
+    return *this;
+}
+
+void IncrementalChain::findChanges(const cv::Mat &image) {
+    TRACE_SCOPE("incremental: change mask");
+    cv::Size small_size(size.width/settings.downsample, size.height/settings.downsample);
+    if (image.channels() == 1) {
+        cv::resize(image, small, small_size, 0, 0, cv::INTER_AREA);
+    } else {
+        cv::Mat shrunk;
+        cv::resize(image, shrunk, small_size, 0, 0, cv::INTER_AREA);
+        cv::cvtColor(shrunk, small,
+                     image.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+    }
+    if (full_frame) {
+        change_mask.setTo(255);
+        small.copyTo(reference);
+        return;
+    }
+
+    // Sum of absolute differences over each tile of the shrunk frames. The
+    // partial tiles at the right and bottom are averaged over what there is.
+    cv::absdiff(small, reference, difference);
+    const int step = settings.tile_size/settings.downsample;
+    for (int ty = 0; ty < tiles.height; ty++) {
+        uchar *mask = change_mask.ptr<uchar>(ty);
+        for (int tx = 0; tx < tiles.width; tx++) {
+            cv::Rect tile = cv::Rect(tx*step, ty*step, step, step) &
+                cv::Rect(0, 0, small.cols, small.rows);
+            bool changed = true;
+            if (tile.area() > 0) {
+                changed = cv::sum(difference(tile))[0] > settings.threshold*tile.area();
+                if (changed) small(tile).copyTo(reference(tile));
+            }
+            mask[tx] = changed ? 255 : 0;
+        }
+    }
+}
+
+void IncrementalChain::applyTiles(std::size_t i, const cv::Mat &input, const cv::Mat &dirty,
+                                  int radius) {
+    ImageOperation &operation = *operations[i];
+    const cv::Rect image_rect(cv::Point(0, 0), size);
+    std::size_t computed = 0;
+    // One region per run of dirty tiles along a row of tiles, with a border
+    // of radius pixels so the tiles come out the same as in a full frame
+    for (int ty = 0; ty < tiles.height; ty++) {
+        const uchar *row = dirty.ptr<uchar>(ty);
+        for (int tx = 0; tx < tiles.width; ) {
+            if (!row[tx]) {
+                tx++;
+                continue;
+            }
+            int end = tx;
+            while (end < tiles.width && row[end]) end++;
+            cv::Rect rect = cv::Rect(tx*settings.tile_size, ty*settings.tile_size,
+                                     (end - tx)*settings.tile_size, settings.tile_size) &
+                image_rect;
+            cv::Rect region = cv::Rect(rect.x - radius, rect.y - radius,
+                                       rect.width + 2*radius, rect.height + 2*radius) &
+                image_rect;
+            operation.apply(input(region));
+            cv::Mat target = outputs[i](rect);
+            operation.get_output()(rect - region.tl()).copyTo(target);
+            computed += region.area();
+            tx = end;
+        }
+    }
+    computed_fraction += (double)computed/size.area();
+}
+
+void IncrementalChain::apply(const cv::Mat &image) {
+    CV_Assert(!operations.empty());
+    if (image.size() != size || image.type() != type) {
+        size = image.size();
+        type = image.type();
+        tiles = cv::Size((size.width + settings.tile_size - 1)/settings.tile_size,
+                         (size.height + settings.tile_size - 1)/settings.tile_size);
+        change_mask.create(tiles, CV_8U);
+        refreshing = true;
+    }
+    full_frame = refreshing ||
+        (settings.refresh_interval > 0 && frames_since_refresh >= settings.refresh_interval);
+    refreshing = false;
+    frames_since_refresh = full_frame ? 1 : frames_since_refresh + 1;
+
+    findChanges(image);
+    changed_fraction = (double)cv::countNonZero(change_mask)/tiles.area();
+    computed_fraction = 0;
+
+    cv::Mat input = image;
+    cv::Mat dirty = change_mask.clone(), grown;
+    bool whole = full_frame;
+    for (std::size_t i = 0; i < operations.size(); i++) {
+        int radius = operations[i]->stencilRadius();
+        bool any = whole || cv::countNonZero(dirty) > 0;
+        if (radius < 0 && any) whole = true;
+        if (whole) {
+            TRACE_SCOPE("incremental: whole image");
+            operations[i]->apply(input);
+            operations[i]->get_output().copyTo(outputs[i]);
+            computed_fraction += 1;
+        } else if (any) {
+            TRACE_SCOPE("incremental: tiles");
+            // Tiles within reach of a change, which with a radius of up to a
+            // tile is the 3x3 around it
+            int reach = (radius + settings.tile_size - 1)/settings.tile_size;
+            if (reach > 0) {
+                cv::dilate(dirty, grown, cv::getStructuringElement(cv::MORPH_RECT,
+                           cv::Size(2*reach + 1, 2*reach + 1)));
+                std::swap(dirty, grown);
+            }
+            applyTiles(i, input, dirty, radius);
+        }
+        input = outputs[i];
+    }
+    computed_fraction /= operations.size();
+    output = outputs.back();
+}
@@ -0,0 +1,153 @@
+#include "keypoint_tracker.h"
+
+#include <opencv2/video/tracking.hpp>
+#include <algorithm>
+
+KeypointTracker::KeypointTracker(const DetectorFactory &factory, const Settings &settings):
+    factory(factory), settings(settings), frame(0), restarting(true),
+    total_ms(0), keypoints_out(0), tracked_in(0), tracked_out(0), detected(0),
+    detection_frames(0)
+{
+}
+
+cv::Rect KeypointTracker::cell(int col, int row, cv::Size size)const {
+    int x0 = col*size.width/settings.grid_cols, x1 = (col + 1)*size.width/settings.grid_cols;
+    int y0 = row*size.height/settings.grid_rows, y1 = (row + 1)*size.height/settings.grid_rows;
+    return cv::Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+void KeypointTracker::update(const cv::Mat &gray) {
+    CV_Assert(gray.type() == CV_8UC1);
+    int64 start = cv::getTickCount();
+
+    bool keyframe = restarting || gray.size() != size ||
+        (settings.keyframe_interval > 0 && frame % settings.keyframe_interval == 0);
+    size = gray.size();
+    restarting = false;
+
+    // Last frame's pyramid becomes the previous one without being rebuilt
+    std::swap(pyramid, prev_pyramid);
+    cv::buildOpticalFlowPyramid(gray, pyramid, settings.window, settings.pyramid_levels);
+
+    if (keyframe) {
+        keypoints.clear();
+        ages.clear();
+    } else {
+        track(gray);
+    }
+    detect(gray, keyframe);
+
+    frame++;
+    keypoints_out += keypoints.size();
+    total_ms += 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency();
+}
+
+void KeypointTracker::track(const cv::Mat &gray) {
+    if (keypoints.empty()) return;
+    prev_points.resize(keypoints.size());
+    for (std::size_t i = 0; i < keypoints.size(); i++) {
+        prev_points[i] = keypoints[i].pt;
+    }
+    cv::calcOpticalFlowPyrLK(prev_pyramid, pyramid, prev_points, next_points,
+                             status, errors, settings.window, settings.pyramid_levels);
+
+    const cv::Rect bounds(0, 0, gray.cols, gray.rows);
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < keypoints.size(); i++) {
+        if (!status[i] || !bounds.contains(next_points[i])) continue;
+        keypoints[kept] = keypoints[i];
+        keypoints[kept].pt = next_points[i];
+        ages[kept] = ages[i] + 1;
+        kept++;
+    }
+    tracked_in += keypoints.size();
+    tracked_out += kept;
+    keypoints.resize(kept);
+    ages.resize(kept);
+}
+
+void KeypointTracker::detect(const cv::Mat &gray, bool keyframe) {
+    const int cells = settings.grid_cols*settings.grid_rows;
+    // Which of the surviving keypoints are in each cell
+    std::vector<std::vector<int>> in_cell(cells);
+    for (std::size_t i = 0; i < keypoints.size(); i++) {
+        int col = std::min(settings.grid_cols - 1, (int)(keypoints[i].pt.x*settings.grid_cols/gray.cols));
+        int row = std::min(settings.grid_rows - 1, (int)(keypoints[i].pt.y*settings.grid_rows/gray.rows));
+        in_cell[row*settings.grid_cols + col].push_back((int)i);
+    }
+    std::vector<int> starved;
+    for (int c = 0; c < cells; c++) {
+        if (keyframe || (int)in_cell[c].size() < settings.min_per_cell) starved.push_back(c);
+    }
+    if (starved.empty()) return;
+    detection_frames++;
+
+    // One detector per stripe, and each stripe only ever runs on one
+    // thread at a time
+    const int stripes = std::max(1, std::min((int)starved.size(), cv::getNumThreads()));
+    while ((int)detectors.size() < stripes) detectors.push_back(factory());
+
+    std::vector<std::vector<cv::KeyPoint>> found(starved.size());
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range) {
+        std::vector<cv::KeyPoint> candidates;
+        for (int s = range.start; s < range.end; s++) {
+            for (std::size_t k = s; k < starved.size(); k += stripes) {
+                int c = starved[k];
+                cv::Rect inner = cell(c % settings.grid_cols, c / settings.grid_cols, gray.size());
+                cv::Rect outer(inner.x - settings.border, inner.y - settings.border,
+                               inner.width + 2*settings.border, inner.height + 2*settings.border);
+                outer &= cv::Rect(0, 0, gray.cols, gray.rows);
+                detectors[s]->detect(gray(outer), candidates);
+
+                // Strongest first, only those really in this cell, and not
+                // on top of one already there
+                std::sort(candidates.begin(), candidates.end(),
+                    [](const cv::KeyPoint &a, const cv::KeyPoint &b) {
+                        return a.response > b.response;
+                    });
+                std::vector<cv::Point2f> taken;
+                for (int i: in_cell[c]) taken.push_back(keypoints[i].pt);
+                const double min_sq = settings.min_distance*settings.min_distance;
+                for (cv::KeyPoint keypoint: candidates) {
+                    if ((int)taken.size() >= settings.max_per_cell) break;
+                    keypoint.pt.x += outer.x;
+                    keypoint.pt.y += outer.y;
+                    if (!inner.contains(keypoint.pt)) continue;
+                    bool crowded = false;
+                    for (const cv::Point2f &p: taken) {
+                        cv::Point2f d = p - keypoint.pt;
+                        if (d.dot(d) < min_sq) {
+                            crowded = true;
+                            break;
+                        }
+                    }
+                    if (crowded) continue;
+                    taken.push_back(keypoint.pt);
+                    found[k].push_back(keypoint);
+                }
+            }
+        }
+    });
+
+    for (const std::vector<cv::KeyPoint> &cell_keypoints: found) {
+        keypoints.insert(keypoints.end(), cell_keypoints.begin(), cell_keypoints.end());
+        ages.insert(ages.end(), cell_keypoints.size(), 0);
+        detected += cell_keypoints.size();
+    }
+}
+
+double KeypointTracker::get_keypoints_per_second()const {
+    return total_ms > 0 ? 1000.0*keypoints_out/total_ms : 0;
+}
+
+double KeypointTracker::get_survival()const {
+    return tracked_in > 0 ? (double)tracked_out/tracked_in : 0;
+}
+
+void KeypointTracker::report(std::ostream &os)const {
+    os << "Tracker: " << frame << " frames, " << (frame ? total_ms/frame : 0) << " ms/frame, "
+       << get_keypoints_per_second() << " keypoints/s, "
+       << (frame ? (double)keypoints_out/frame : 0) << " keypoints/frame, survival "
+       << get_survival() << " per frame, detected on " << detection_frames
+       << " frames (" << detected << " keypoints)" << std::endl;
+}
@@ -0,0 +1,145 @@
+#include "operation_chain.h"
+#include "trace.h"
+
+#include <algorithm>
+
+static std::size_t imageBytes(const cv::Mat &image) {
+    return image.total()*image.elemSize();
+}
+
+OperationChain::OperationChain(int strip_rows):
+    strip_rows(strip_rows), bytes_moved(0)
+{
+}
+
+OperationChain &OperationChain::add(ImageOperation &operation) {
+    operations.push_back(&operation);
+    return *this;
+}
+
+void OperationChain::apply(const cv::Mat &image) {
+    bytes_moved = 0;
+    cv::Mat current = image;
+    std::size_t runs = 0;
+    for (std::size_t begin = 0; begin < operations.size(); ) {
+        std::size_t end = begin + 1;
+        if (strip_rows > 0 && operations[begin]->rowHalo() >= 0) {
+            while (end < operations.size() && operations[end]->rowHalo() >= 0) end++;
+        }
+        if (end - begin == 1 && (strip_rows <= 0 || operations[begin]->rowHalo() < 0)) {
+            // On its own, on the whole image
+            TRACE_SCOPE("chain: whole image");
+            operations[begin]->apply(current);
+            bytes_moved += imageBytes(current) + imageBytes(operations[begin]->get_output());
+            current = operations[begin]->get_output();
+        } else {
+            if (run_outputs.size() <= runs) run_outputs.resize(runs + 1);
+            TRACE_SCOPE("chain: fused rows");
+            applyFused(begin, end, current, run_outputs[runs]);
+            current = run_outputs[runs++];
+        }
+        begin = end;
+    }
+    output = current;
+}
+
+int OperationChain::stencilRadius()const {
+    int radius = 0;
+    for (const ImageOperation *operation: operations) {
+        int r = operation->stencilRadius();
+        if (r < 0) return -1;
+        radius += r;
+    }
+    return radius;
+}
+
+void OperationChain::applyFused(std::size_t begin, std::size_t end,
+                                const cv::Mat &src, cv::Mat &dst) {
+    const int rows = src.rows, cols = src.cols;
+    const int stages = (int)(end - begin);
+
+    // after[i]: extra rows stage i has to produce for the stages after it.
+    // types[i]: output type of stage i.
+    std::vector<int> after(stages, 0), types(stages);
+    for (int i = stages - 2; i >= 0; i--) {
+        after[i] = after[i + 1] + operations[begin + i + 1]->rowHalo();
+    }
+    int type = src.type();
+    for (int i = 0; i < stages; i++) {
+        type = operations[begin + i]->outputType(type);
+        types[i] = type;
+    }
+    dst.create(src.size(), types[stages - 1]);
+
+    const int strips = (rows + strip_rows - 1)/strip_rows;
+    const int input_halo = after[0] + operations[begin]->rowHalo();
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range &range) {
+        // One band per intermediate stage, sized for the tallest strip
+        std::vector<cv::Mat> bands(stages);
+        for (int i = 0; i + 1 < stages; i++) {
+            bands[i].create(std::min(rows, strip_rows + 2*after[i]), cols, types[i]);
+        }
+        for (int s = range.start; s < range.end; s++) {
+            const int y0 = s*strip_rows, y1 = std::min(rows, y0 + strip_rows);
+            // Rows [in_start, ...) of the image are in the current input
+            cv::Mat in = src;
+            int in_start = 0;
+            for (int i = 0; i < stages; i++) {
+                const int lo = std::max(0, y0 - after[i]);
+                const int hi = std::min(rows, y1 + after[i]);
+                cv::Mat out;
+                if (i == stages - 1) {
+                    out = dst.rowRange(lo, hi);
+                } else {
+                    // A header of its own rather than a rowRange, so it
+                    // looks like the end of the image to the next stage
+                    // when it really is, and not like more rows follow
+                    out = cv::Mat(hi - lo, cols, types[i], bands[i].data);
+                }
+                const uchar *out_data = out.data;
+                cv::Mat in_rows = in.rowRange(lo - in_start, hi - in_start);
+                operations[begin + i]->applyRows(in_rows, out);
+                CV_Assert(out.data == out_data);
+                in = out;
+                in_start = lo;
+            }
+        }
+    });
+
+    // Each strip reads its own rows of src plus the halo either side
+    std::size_t rows_read = 0;
+    for (int s = 0; s < strips; s++) {
+        int y0 = s*strip_rows, y1 = std::min(rows, y0 + strip_rows);
+        rows_read += std::min(rows, y1 + input_halo) - std::max(0, y0 - input_halo);
+    }
+    bytes_moved += rows_read*cols*src.elemSize() + imageBytes(dst);
+}
+
+void compareChainModes(std::ostream &os, const std::string &name, OperationChain &chain,
+                       const cv::Mat &image, int repeats) {
+    const int fused_rows = 32;
+    double ms[2];
+    std::size_t bytes[2];
+    cv::Mat fused_output;
+    for (int mode = 0; mode < 2; mode++) {
+        chain.set_strip_rows(mode == 0 ? fused_rows : 0);
+        chain.apply(image);
+        int64 start = cv::getTickCount();
+        for (int k = 0; k < repeats; k++) {
+            chain.apply(image);
+        }
+        ms[mode] = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency()/repeats;
+        bytes[mode] = chain.get_bytes_moved();
+        if (mode == 0) chain.get_output().copyTo(fused_output);
+    }
+    chain.set_strip_rows(fused_rows);
+
+    cv::Mat difference;
+    cv::absdiff(fused_output, chain.get_output(), difference);
+    double max_difference;
+    cv::minMaxLoc(difference.reshape(1), nullptr, &max_difference);
+    os << name << " " << image.cols << "x" << image.rows
+       << ": fused " << ms[0] << " ms, " << bytes[0]/1e6 << " MB"
+       << ", whole image " << ms[1] << " ms, " << bytes[1]/1e6 << " MB"
+       << " (" << ms[1]/ms[0] << "x), max difference " << max_difference << std::endl;
+}
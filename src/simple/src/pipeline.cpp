@@ -0,0 +1,57 @@
+#include "pipeline.h"
+
+#include <thread>
+
+Pipeline::Pipeline(std::size_t capacity, Ring::Policy policy):
+    capture_ring(capacity, policy), result_ring(capacity, policy)
+{
+}
+
+void Pipeline::run(const CaptureFunction &capture, const ProcessFunction &process,
+                   const PresentFunction &present)
+{
+    std::thread capture_thread([&]() {
+        PipelineFrame slot;
+        int index = 0;
+        while (capture(slot.frame)) {
+            slot.index = index++;
+            slot.capture_ticks = cv::getTickCount();
+            if (!capture_ring.push(slot)) break;
+        }
+        capture_ring.close();
+    });
+
+    std::thread process_thread([&]() {
+        PipelineFrame slot;
+        while (capture_ring.pop(slot)) {
+            process(slot.frame, slot.result);
+            if (!result_ring.push(slot)) break;
+        }
+        result_ring.close();
+        // If presentation stopped early, let capture know too
+        capture_ring.close();
+    });
+
+    PipelineFrame slot;
+    while (result_ring.pop(slot)) {
+        if (!present(slot)) {
+            result_ring.close();
+            capture_ring.close();
+            break;
+        }
+    }
+
+    process_thread.join();
+    capture_thread.join();
+}
+
+static void reportRing(std::ostream &os, const char *name, const Pipeline::Ring &ring) {
+    os << name << " ring: " << ring.get_pushed() << " pushed, "
+       << ring.get_dropped() << " dropped, depth mean " << ring.get_mean_depth()
+       << " max " << ring.get_max_depth() << "/" << ring.capacity() << std::endl;
+}
+
+void Pipeline::report(std::ostream &os)const {
+    reportRing(os, "Capture", capture_ring);
+    reportRing(os, "Result", result_ring);
+}
@@ -0,0 +1,62 @@
+#include "row_operations.h"
+
+#include <opencv2/imgproc.hpp>
+#include <cmath>
+
+ColorConvertOperation::ColorConvertOperation(int code, int output_type):
+    code(code), output_type(output_type)
+{
+}
+
+void ColorConvertOperation::applyRows(const cv::Mat &src, cv::Mat &dst)const {
+    cv::cvtColor(src, dst, code);
+}
+
+void MirrorOperation::applyRows(const cv::Mat &src, cv::Mat &dst)const {
+    cv::flip(src, dst, 1);
+}
+
+GaussianBlurOperation::GaussianBlurOperation(int ksize, double sigma):
+    ksize(ksize), sigma(sigma)
+{
+}
+
+void GaussianBlurOperation::applyRows(const cv::Mat &src, cv::Mat &dst)const {
+    cv::GaussianBlur(src, dst, cv::Size(ksize, ksize), sigma);
+}
+
+Filter2DOperation::Filter2DOperation(const cv::Mat &kernel, int ddepth):
+    kernel(kernel.clone()), ddepth(ddepth)
+{
+    CV_Assert(kernel.rows % 2 == 1 && kernel.cols % 2 == 1);
+}
+
+int Filter2DOperation::outputType(int input_type)const {
+    if (ddepth < 0) return input_type;
+    return CV_MAKETYPE(ddepth, CV_MAT_CN(input_type));
+}
+
+void Filter2DOperation::applyRows(const cv::Mat &src, cv::Mat &dst)const {
+    cv::filter2D(src, dst, ddepth, kernel);
+}
+
+void SobelMagnitudeOperation::applyRows(const cv::Mat &src, cv::Mat &dst)const {
+    CV_Assert(src.type() == CV_8UC1);
+    // Only a band's worth, so these stay in cache
+    static thread_local cv::Mat grad_x, grad_y;
+    cv::Sobel(src, grad_x, CV_8U, 1, 0, 3);
+    cv::Sobel(src, grad_y, CV_8U, 0, 1, 3);
+    for (int i = 0; i < src.rows; i++) {
+        const uchar *gx = grad_x.ptr<uchar>(i);
+        const uchar *gy = grad_y.ptr<uchar>(i);
+        uchar *out = dst.ptr<uchar>(i);
+        for (int j = 0; j < src.cols; j++) {
+            float x = gx[j], y = gy[j];
+            out[j] = cv::saturate_cast<uchar>(std::sqrt(x*x + y*y));
+        }
+    }
+}
+
+void NormalizeOperation::apply(const cv::Mat &image) {
+    cv::normalize(image, output, 0, 255, cv::NORM_MINMAX, dtype);
+}
@@ -0,0 +1,87 @@
+#include "scale_space.h"
+
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+
+int gaussian_ksize_uncapped(double sigma) {
+    if (sigma <= 0) return 1;
+    return 2*std::max(0, (int)std::ceil(3.7*sigma - 1)) + 1;
+}
+
+GaussianScaleSpace::GaussianScaleSpace(const std::vector<double> &sigmas,
+                                       bool decimate, int max_ksize):
+    decimate(decimate), max_ksize(max_ksize),
+    // Sized up front, levels keep pointers into it while building
+    octaves(16)
+{
+    std::vector<double> sorted = sigmas;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    for (double sigma: sorted) {
+        CV_Assert(sigma > 0);
+        ScaleLevel level;
+        level.sigma = sigma;
+        level.octave = 0;
+        levels.push_back(level);
+    }
+}
+
+// Blur from sigma_from to sigma_to, both in the pixels of src
+static void blurIncrement(const cv::Mat &src, cv::Mat &dst, double sigma_from, double sigma_to) {
+    double increment = std::sqrt(std::max(0.0, sigma_to*sigma_to - sigma_from*sigma_from));
+    int ksize = gaussian_ksize_uncapped(increment);
+    if (ksize == 1) {
+        src.copyTo(dst);
+    } else {
+        cv::GaussianBlur(src, dst, cv::Size(ksize, ksize), increment, increment);
+    }
+}
+
+void GaussianScaleSpace::build(const cv::Mat &gray) {
+    source = gray;
+    gray.convertTo(base, CV_32F);
+
+    const cv::Mat *prev = &base;
+    double prev_sigma = 0;
+    int octave = 0;
+    for (ScaleLevel &level: levels) {
+        while (decimate) {
+            double scale = (double)(1 << octave);
+            double increment = std::sqrt(level.sigma*level.sigma - prev_sigma*prev_sigma);
+            if (gaussian_ksize_uncapped(increment/scale) <= max_ksize) break;
+
+            // Needs about a pixel of blur before dropping every other
+            // pixel, or it aliases
+            if (prev_sigma < scale) {
+                blurIncrement(*prev, anti_alias, prev_sigma/scale, 1.0);
+                prev = &anti_alias;
+                prev_sigma = scale;
+            }
+            CV_Assert(octave < (int)octaves.size());
+            cv::Mat &decimated = octaves[octave];
+            decimated.create((prev->rows + 1)/2, (prev->cols + 1)/2, CV_32F);
+            for (int i = 0; i < decimated.rows; i++) {
+                const float *src = prev->ptr<float>(2*i);
+                float *dst = decimated.ptr<float>(i);
+                for (int j = 0; j < decimated.cols; j++) {
+                    dst[j] = src[2*j];
+                }
+            }
+            octave++;
+            prev = &decimated;
+        }
+        double scale = (double)(1 << octave);
+        blurIncrement(*prev, level.smoothed, prev_sigma/scale, level.sigma/scale);
+        level.octave = octave;
+        prev = &level.smoothed;
+        prev_sigma = level.sigma;
+    }
+}
+
+const ScaleLevel &GaussianScaleSpace::find(double sigma)const {
+    for (const ScaleLevel &level: levels) {
+        if (std::abs(level.sigma - sigma) < 1e-9) return level;
+    }
+    CV_Error(cv::Error::StsBadArg, "Sigma is not part of the scale space");
+}
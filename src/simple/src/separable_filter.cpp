@@ -0,0 +1,299 @@
+#include "separable_filter.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+
+// The first pass has 8 bit taps, and rounds its sums to 7 bits so they
+// fit in a short
+static const int first_bits = 8;
+static const int second_bits = 12;
+static const int total_bits = first_bits - 1 + second_bits;
+
+// dst[j] = sum of taps[k]*src[k][j]. The sources are the rows around the
+// output row for a vertical pass, or the same row shifted by k for a
+// horizontal one.
+template <int R>
+static void firstPass(const uchar *const *src, const ushort *taps, short *dst, int n) {
+    const int K = 2*R + 1;
+    int j = 0;
+#if CV_SIMD128
+    // Each product is at most 255*256, and so is the sum
+    cv::v_uint16x8 one = cv::v_setall_u16(1);
+    for (; j + 8 <= n; j += 8) {
+        cv::v_uint16x8 sum = cv::v_setzero_u16();
+        for (int k = 0; k < K; k++) {
+            sum += cv::v_load_expand(src[k] + j)*cv::v_setall_u16(taps[k]);
+        }
+        cv::v_store(dst + j, cv::v_reinterpret_as_s16((sum + one) >> 1));
+    }
+#endif
+    for (; j < n; j++) {
+        int sum = 0;
+        for (int k = 0; k < K; k++) {
+            sum += taps[k]*src[k][j];
+        }
+        dst[j] = (short)((sum + 1) >> 1);
+    }
+}
+
+static inline void storeResult(uchar *dst, int sum, float) {
+    dst[0] = cv::saturate_cast<uchar>((sum + (1 << (total_bits - 1))) >> total_bits);
+}
+
+static inline void storeResult(float *dst, int sum, float scale) {
+    dst[0] = sum*scale;
+}
+
+#if CV_SIMD128
+static inline void storeResult(uchar *dst, const cv::v_int32x4 &low, const cv::v_int32x4 &high,
+                               float) {
+    cv::v_int32x4 half = cv::v_setall_s32(1 << (total_bits - 1));
+    cv::v_pack_u_store(dst, cv::v_pack((low + half) >> total_bits, (high + half) >> total_bits));
+}
+
+static inline void storeResult(float *dst, const cv::v_int32x4 &low, const cv::v_int32x4 &high,
+                               float scale) {
+    cv::v_float32x4 s = cv::v_setall_f32(scale);
+    cv::v_store(dst, cv::v_cvt_f32(low)*s);
+    cv::v_store(dst + 4, cv::v_cvt_f32(high)*s);
+}
+
+// Two taps in each 32 bit lane, for v_dotprod
+static inline cv::v_int16x8 tapPair(short a, short b) {
+    unsigned pair = (unsigned)(ushort)a | ((unsigned)(ushort)b << 16);
+    return cv::v_reinterpret_as_s16(cv::v_setall_u32(pair));
+}
+#endif
+
+// Same as firstPass, for the 16 bit output of firstPass, with 32 bit sums
+template <int R, typename T>
+static void secondPass(const short *const *src, const short *taps, T *dst, int n, float scale) {
+    const int K = 2*R + 1;
+    int j = 0;
+#if CV_SIMD128
+    // Sources interleaved in pairs, so one v_dotprod does two taps
+    cv::v_int16x8 pairs[R + 1];
+    for (int k = 0; k < R; k++) {
+        pairs[k] = tapPair(taps[2*k], taps[2*k + 1]);
+    }
+    pairs[R] = tapPair(taps[K - 1], 0);
+    cv::v_int16x8 zero = cv::v_setzero_s16();
+    for (; j + 8 <= n; j += 8) {
+        cv::v_int32x4 low = cv::v_setzero_s32(), high = cv::v_setzero_s32();
+        cv::v_int16x8 a_b_low, a_b_high;
+        for (int k = 0; k < R; k++) {
+            cv::v_zip(cv::v_load(src[2*k] + j), cv::v_load(src[2*k + 1] + j), a_b_low, a_b_high);
+            low += cv::v_dotprod(a_b_low, pairs[k]);
+            high += cv::v_dotprod(a_b_high, pairs[k]);
+        }
+        cv::v_zip(cv::v_load(src[K - 1] + j), zero, a_b_low, a_b_high);
+        low += cv::v_dotprod(a_b_low, pairs[R]);
+        high += cv::v_dotprod(a_b_high, pairs[R]);
+        storeResult(dst + j, low, high, scale);
+    }
+#endif
+    for (; j < n; j++) {
+        int sum = 0;
+        for (int k = 0; k < K; k++) {
+            sum += taps[k]*src[k][j];
+        }
+        storeResult(dst + j, sum, scale);
+    }
+}
+
+typedef void (*FirstPass)(const uchar *const*, const ushort*, short*, int);
+typedef void (*SecondPass8U)(const short *const*, const short*, uchar*, int, float);
+typedef void (*SecondPass32F)(const short *const*, const short*, float*, int, float);
+
+static const FirstPass first_passes[FixedPointFilter::max_radius + 1] = {
+    0, firstPass<1>, firstPass<2>, firstPass<3>, firstPass<4>, firstPass<5>, firstPass<6>,
+    firstPass<7>, firstPass<8>, firstPass<9>, firstPass<10>, firstPass<11>
+};
+static const SecondPass8U second_passes_8u[FixedPointFilter::max_radius + 1] = {
+    0, secondPass<1, uchar>, secondPass<2, uchar>, secondPass<3, uchar>, secondPass<4, uchar>,
+    secondPass<5, uchar>, secondPass<6, uchar>, secondPass<7, uchar>, secondPass<8, uchar>,
+    secondPass<9, uchar>, secondPass<10, uchar>, secondPass<11, uchar>
+};
+static const SecondPass32F second_passes_32f[FixedPointFilter::max_radius + 1] = {
+    0, secondPass<1, float>, secondPass<2, float>, secondPass<3, float>, secondPass<4, float>,
+    secondPass<5, float>, secondPass<6, float>, secondPass<7, float>, secondPass<8, float>,
+    secondPass<9, float>, secondPass<10, float>, secondPass<11, float>
+};
+
+// Index into [0, n) for BORDER_REFLECT_101
+static int reflect101(int i, int n) {
+    if (n == 1) return 0;
+    while (i < 0 || i >= n) {
+        i = i < 0 ? -i : 2*n - 2 - i;
+    }
+    return i;
+}
+
+static bool isSmoothing(const cv::Mat &kernel) {
+    double sum = 0;
+    for (int k = 0; k < (int)kernel.total(); k++) {
+        float tap = kernel.at<float>(k);
+        if (tap < 0) return false;
+        sum += tap;
+    }
+    return sum <= 1 + 1e-6;
+}
+
+// Taps in fixed point with the given fraction bits. If the kernel sums to
+// 1 the centre tap takes the rounding error, so flat areas stay exact.
+static std::vector<int> quantise(const cv::Mat &kernel, int bits) {
+    std::vector<int> taps(kernel.total());
+    double sum = 0;
+    int quantised_sum = 0;
+    for (std::size_t k = 0; k < taps.size(); k++) {
+        sum += kernel.at<float>((int)k);
+        taps[k] = (int)std::lround(kernel.at<float>((int)k)*(1 << bits));
+        quantised_sum += taps[k];
+    }
+    if (std::abs(sum - 1) < 1e-4) {
+        taps[taps.size()/2] += (1 << bits) - quantised_sum;
+    }
+    return taps;
+}
+
+FixedPointFilter::FixedPointFilter(const cv::Mat &row_kernel, const cv::Mat &column_kernel):
+    radius(0), rows_first(true)
+{
+    row_kernel.reshape(1, 1).convertTo(this->row_kernel, CV_32F);
+    column_kernel.reshape(1, 1).convertTo(this->column_kernel, CV_32F);
+    int length = (int)this->row_kernel.total();
+    if (length != (int)this->column_kernel.total() || length % 2 == 0 ||
+            length < 3 || length/2 > max_radius) {
+        return;
+    }
+    const cv::Mat *first = &this->row_kernel, *second = &this->column_kernel;
+    if (!isSmoothing(*first)) {
+        std::swap(first, second);
+        rows_first = false;
+        if (!isSmoothing(*first)) return;
+    }
+
+    std::vector<int> first_q = quantise(*first, first_bits);
+    std::vector<int> second_q = quantise(*second, second_bits);
+    int first_sum = 0;
+    for (int k = 0; k < length; k++) {
+        first_sum += first_q[k];
+        if (second_q[k] < SHRT_MIN || second_q[k] > SHRT_MAX) return;
+    }
+    if (first_sum > 1 << first_bits) return;
+
+    first_taps.assign(first_q.begin(), first_q.end());
+    second_taps.assign(second_q.begin(), second_q.end());
+    radius = length/2;
+}
+
+void FixedPointFilter::apply(const cv::Mat &src, cv::Mat &dst, int ddepth, double scale)const {
+    cv::Size whole_size;
+    cv::Point offset;
+    src.locateROI(whole_size, offset);
+    bool fixed_point = isFixedPoint() && src.type() == CV_8UC1 &&
+        (ddepth == CV_32F || (ddepth == CV_8U && scale == 1)) &&
+        whole_size.width > radius && whole_size.height > radius;
+    if (!fixed_point) {
+        cv::sepFilter2D(src, dst, ddepth, row_kernel, column_kernel*scale);
+        return;
+    }
+
+    // The strips read rows around them from src
+    cv::Mat input = src.data == dst.data ? src.clone() : src;
+    dst.create(src.size(), CV_MAKETYPE(ddepth, 1));
+    float fixed_scale = (float)(scale/(1 << total_bits));
+    const int strip_rows = 32;
+    cv::parallel_for_(cv::Range(0, (src.rows + strip_rows - 1)/strip_rows),
+                      [&](const cv::Range &range) {
+        for (int s = range.start; s < range.end; s++) {
+            applyStrip(input, dst, s*strip_rows, std::min(src.rows, (s + 1)*strip_rows),
+                       fixed_scale);
+        }
+    });
+}
+
+void FixedPointFilter::applyStrip(const cv::Mat &src, cv::Mat &dst, int begin, int end,
+                                  float scale)const
+{
+    const int R = radius, K = 2*R + 1, cols = src.cols;
+    cv::Size whole_size;
+    cv::Point offset;
+    src.locateROI(whole_size, offset);
+
+    // Row y of src, which may be outside it, at column 0 of src
+    auto rowAt = [&](int y) {
+        int whole_y = reflect101(offset.y + y, whole_size.height);
+        return src.data + (std::ptrdiff_t)(whole_y - offset.y)*(std::ptrdiff_t)src.step[0];
+    };
+    // Column of src for position p of a row padded by R either side
+    auto paddedColumn = [&](int p) {
+        return reflect101(offset.x + p - R, whole_size.width) - offset.x;
+    };
+    auto finishRow = [&](const short *const *rows, int i) {
+        if (dst.depth() == CV_8U) {
+            second_passes_8u[R](rows, second_taps.data(), dst.ptr<uchar>(i), cols, scale);
+        } else {
+            second_passes_32f[R](rows, second_taps.data(), dst.ptr<float>(i), cols, scale);
+        }
+    };
+    const uchar *first_rows[2*max_radius + 1];
+    const short *second_rows[2*max_radius + 1];
+
+    if (rows_first) {
+        // Horizontal pass into a ring of the last K rows, then down the ring
+        cv::AutoBuffer<uchar> padded(cols + 2*R);
+        cv::AutoBuffer<short> ring(K*cols);
+        for (int k = 0; k < K; k++) {
+            first_rows[k] = padded.data() + k;
+        }
+        auto horizontal = [&](int y) {
+            const uchar *row = rowAt(y);
+            for (int p = 0; p < R; p++) {
+                padded[p] = row[paddedColumn(p)];
+                padded[cols + R + p] = row[paddedColumn(cols + R + p)];
+            }
+            std::memcpy(padded.data() + R, row, cols);
+            short *out = ring.data() + ((y - begin + R) % K)*cols;
+            first_passes[R](first_rows, first_taps.data(), out, cols);
+        };
+        for (int y = begin - R; y < begin + R; y++) {
+            horizontal(y);
+        }
+        for (int i = begin; i < end; i++) {
+            horizontal(i + R);
+            for (int k = 0; k < K; k++) {
+                second_rows[k] = ring.data() + ((i - begin + k) % K)*cols;
+            }
+            finishRow(second_rows, i);
+        }
+    } else {
+        // Vertical pass into one padded row, then along it. The columns
+        // either side come from the image around src where there is one.
+        cv::AutoBuffer<short> padded(cols + 2*R);
+        int p0 = std::max(0, R - offset.x);
+        int p1 = std::min(cols + 2*R, whole_size.width - offset.x + R);
+        for (int k = 0; k < K; k++) {
+            second_rows[k] = padded.data() + k;
+        }
+        for (int i = begin; i < end; i++) {
+            for (int k = 0; k < K; k++) {
+                first_rows[k] = rowAt(i - R + k) + (p0 - R);
+            }
+            first_passes[R](first_rows, first_taps.data(), padded.data() + p0, p1 - p0);
+            for (int p = 0; p < p0; p++) {
+                padded[p] = padded[paddedColumn(p) + R];
+            }
+            for (int p = p1; p < cols + 2*R; p++) {
+                padded[p] = padded[paddedColumn(p) + R];
+            }
+            finishRow(second_rows, i);
+        }
+    }
+}
@@ -0,0 +1,161 @@
+#include "square_difference.h"
+
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+static void storeRow(const std::vector<double> &values, cv::Mat &dest, int i){
+    const int cols = dest.cols;
+    switch (dest.depth()) {
+    case CV_8U: {
+        uchar *d = dest.ptr<uchar>(i);
+        for (int j = 0; j < cols; j++) d[j] = cv::saturate_cast<uchar>(values[j]);
+        break;
+    }
+    case CV_32S: {
+        int *d = dest.ptr<int>(i);
+        for (int j = 0; j < cols; j++) d[j] = cv::saturate_cast<int>(values[j]);
+        break;
+    }
+    default: {
+        float *d = dest.ptr<float>(i);
+        for (int j = 0; j < cols; j++) d[j] = (float)values[j];
+        break;
+    }
+    }
+}
+
+// Uniform window with the given weight:
+//   sum (I(q) - I(p))^2 = sum I(q)^2 - 2 I(p) sum I(q) + n I(p)^2
+// where the sums are over the part of the window inside the image.
+static void boxSquareDifference(const cv::Mat &src, cv::Mat &dest, cv::Size ksize,
+                                cv::Point anchor, double weight){
+    cv::Mat sum, sqsum;
+    cv::integral(src, sum, sqsum, CV_32S, CV_64F);
+    const int rows = src.rows, cols = src.cols;
+
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        std::vector<double> values(cols);
+        for (int i = range.start; i < range.end; i++) {
+            int y0 = std::max(i - anchor.y, 0);
+            int y1 = std::max(std::min(i - anchor.y + ksize.height, rows), y0);
+            const int *s0 = sum.ptr<int>(y0), *s1 = sum.ptr<int>(y1);
+            const double *q0 = sqsum.ptr<double>(y0), *q1 = sqsum.ptr<double>(y1);
+            const uchar *centre = src.ptr<uchar>(i);
+            for (int j = 0; j < cols; j++) {
+                int x0 = std::max(j - anchor.x, 0);
+                int x1 = std::max(std::min(j - anchor.x + ksize.width, cols), x0);
+                double n = (double)(y1 - y0)*(x1 - x0);
+                double s = s1[x1] - s1[x0] - s0[x1] + s0[x0];
+                double s2 = q1[x1] - q1[x0] - q0[x1] + q0[x0];
+                double c = centre[j];
+                values[j] = weight*(s2 - 2*c*s + c*c*n);
+            }
+            storeRow(values, dest, i);
+        }
+    });
+}
+
+// Rank 1 window, window(v, u) = kernel_y(v)*kernel_x(u). Same expansion as
+// the box case, with each sum done by a separable filter. The filters use a
+// zero border, so filtering an image of ones gives the weight of the taps
+// inside the image.
+static void separableSquareDifference(const cv::Mat &src, cv::Mat &dest,
+                                      const cv::Mat &kernel_x, const cv::Mat &kernel_y,
+                                      cv::Point anchor){
+    cv::Mat image, squared, ones;
+    src.convertTo(image, CV_64F);
+    cv::multiply(image, image, squared);
+    ones = cv::Mat::ones(src.size(), CV_64F);
+
+    cv::Mat f0, f1, f2;
+    cv::sepFilter2D(ones, f0, CV_64F, kernel_x, kernel_y, anchor, 0, cv::BORDER_CONSTANT);
+    cv::sepFilter2D(image, f1, CV_64F, kernel_x, kernel_y, anchor, 0, cv::BORDER_CONSTANT);
+    cv::sepFilter2D(squared, f2, CV_64F, kernel_x, kernel_y, anchor, 0, cv::BORDER_CONSTANT);
+
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &range) {
+        std::vector<double> values(src.cols);
+        for (int i = range.start; i < range.end; i++) {
+            const double *c = image.ptr<double>(i);
+            const double *w0 = f0.ptr<double>(i), *w1 = f1.ptr<double>(i),
+                         *w2 = f2.ptr<double>(i);
+            for (int j = 0; j < src.cols; j++) {
+                values[j] = w2[j] - 2*c[j]*w1[j] + c[j]*c[j]*w0[j];
+            }
+            storeRow(values, dest, i);
+        }
+    });
+}
+
+static void genericSquareDifference(const cv::Mat &src, cv::Mat &dest,
+                                    const cv::Mat &weights, cv::Point anchor){
+    const int rows = src.rows, cols = src.cols;
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range) {
+        std::vector<double> values(cols);
+        for (int i = range.start; i < range.end; i++) {
+            const uchar *centre = src.ptr<uchar>(i);
+            for (int j = 0; j < cols; j++) {
+                double sum = 0;
+                int c = centre[j];
+                // Only the taps which land inside the image
+                int u0 = std::max(0, anchor.x - j);
+                int u1 = std::min(weights.cols, cols - j + anchor.x);
+                for (int v = 0; v < weights.rows; v++) {
+                    int y = i + v - anchor.y;
+                    if (y < 0 || y >= rows) continue;
+                    const uchar *row = src.ptr<uchar>(y);
+                    const double *w = weights.ptr<double>(v);
+                    for (int u = u0; u < u1; u++) {
+                        int d = row[j + u - anchor.x] - c;
+                        sum += w[u]*(d*d);
+                    }
+                }
+                values[j] = sum;
+            }
+            storeRow(values, dest, i);
+        }
+    });
+}
+
+void weightedSquareDifference(const cv::Mat& src_in, cv::Mat& dest, const cv::Mat& window,
+                              cv::Point anchor, int ddepth){
+    CV_Assert(src_in.depth() == CV_8U && src_in.channels() == 1);
+    CV_Assert(!window.empty() && window.channels() == 1);
+    CV_Assert(ddepth == CV_8U || ddepth == CV_32S || ddepth == CV_32F);
+    if(anchor==cv::Point(-1, -1)){
+        anchor = cv::Point((window.cols-1)/2, (window.rows-1)/2);
+    }
+    // Rows of dest are written while other rows of src are still being read
+    cv::Mat src = src_in.data == dest.data ? src_in.clone() : src_in;
+    dest.create(src.size(), CV_MAKETYPE(ddepth, 1));
+
+    cv::Mat weights;
+    window.convertTo(weights, CV_64F);
+    double min_weight, max_weight;
+    cv::minMaxLoc(weights, &min_weight, &max_weight);
+    if (min_weight == max_weight) {
+        boxSquareDifference(src, dest, window.size(), anchor, max_weight);
+        return;
+    }
+
+    if (weights.rows == 1 || weights.cols == 1) {
+        cv::Mat one = cv::Mat::ones(1, 1, CV_64F);
+        if (weights.rows == 1) {
+            separableSquareDifference(src, dest, weights, one, anchor);
+        } else {
+            separableSquareDifference(src, dest, one, weights, anchor);
+        }
+        return;
+    }
+    cv::SVD svd(weights);
+    if (svd.w.at<double>(1) <= 1e-9*svd.w.at<double>(0)) {
+        double scale = std::sqrt(svd.w.at<double>(0));
+        cv::Mat kernel_y = svd.u.col(0)*scale;
+        cv::Mat kernel_x = svd.vt.row(0)*scale;
+        separableSquareDifference(src, dest, kernel_x, kernel_y, anchor);
+        return;
+    }
+
+    genericSquareDifference(src, dest, weights, anchor);
+}
@@ -1,23 +1,254 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/calib3d.hpp>
+#include <cmath>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
-int main()
-{
-    // TODO: Instal intel realse sdk, use to access T265
-    cv::VideoCapture video;
-    video.open(1);
-    if(!video.isOpened()){
-        std::cout << "Could not open video capture." << std::endl;
+#include "block_matcher.h"
+#include "frame_loop.h"
+#include "stereo_rectifier.h"
+
+// Intrinsics from intrinsics_path, and the camera poses from the
+// chessboard pairs listed in list_path (as used by OpenCV's stereo_calib)
+static bool calibrate(const std::string &list_path, const std::string &intrinsics_path,
+                      StereoCalibration &calibration){
+    cv::samples::addSamplesDataSearchPath("data");
+    if(!calibration.readIntrinsics(cv::samples::findFile(intrinsics_path, false))){
+        std::cout << "Could not read " << intrinsics_path << std::endl;
+        return false;
+    }
+    cv::FileStorage fs(cv::samples::findFile(list_path, false), cv::FileStorage::READ);
+    if(!fs.isOpened()){
+        std::cout << "Could not read " << list_path << std::endl;
+        return false;
+    }
+    std::vector<std::string> image_list;
+    for(const cv::FileNode &node: fs["imagelist"]){
+        image_list.push_back(cv::samples::findFile((std::string)node, false));
+    }
+    double rms = calibration.calibrateExtrinsics(image_list, cv::Size(9, 6), 1);
+    if(rms < 0){
+        std::cout << "Could not find the chessboard in enough of " << list_path << std::endl;
+        return false;
+    }
+    std::cout << "Stereo calibration from " << image_list.size()/2 << " pairs, RMS error "
+              << rms << " px" << std::endl;
+    return true;
+}
+
+// Scaled to fit the search range, with invalid pixels black
+static void colourDisparity(const cv::Mat &disparity, int num_disparities, cv::Mat &colour){
+    cv::Mat scaled;
+    disparity.convertTo(scaled, CV_8U, 255.0/(16*num_disparities));
+    cv::applyColorMap(scaled, colour, cv::COLORMAP_JET);
+    colour.setTo(cv::Scalar::all(0), disparity < 0);
+}
+
+// Mean absolute error in pixels and fraction more than 2 pixels out, over
+// the pixels both have a disparity for, and the fraction of ground truth
+// pixels given a disparity at all. Ground truth is in whole pixels, 0 where
+// unknown.
+static void disparityError(const cv::Mat &disparity, const cv::Mat &truth,
+                           double &mean_error, double &bad, double &coverage){
+    int known = 0, valid = 0, wrong = 0;
+    double error_sum = 0;
+    for(int i = 0; i < truth.rows; i++){
+        const uchar *t = truth.ptr<uchar>(i);
+        const short *d = disparity.ptr<short>(i);
+        for(int j = 0; j < truth.cols; j++){
+            if(t[j] == 0) continue;
+            known++;
+            if(d[j] < 0) continue;
+            valid++;
+            double error = std::abs(d[j]/16.0 - t[j]);
+            error_sum += error;
+            if(error > 2) wrong++;
+        }
+    }
+    mean_error = valid ? error_sum/valid : 0;
+    bad = valid ? (double)wrong/valid : 0;
+    coverage = known ? (double)valid/known : 0;
+}
+
+// Times the block matchers and OpenCV's on the aloe pair, and scores them
+// against its ground truth
+static int evaluate(const StereoRectifier &rectifier){
+    cv::samples::addSamplesDataSearchPath("data");
+    cv::Mat left = cv::imread(cv::samples::findFile("aloeL.jpg"), cv::IMREAD_GRAYSCALE);
+    cv::Mat right = cv::imread(cv::samples::findFile("aloeR.jpg"), cv::IMREAD_GRAYSCALE);
+    cv::Mat truth = cv::imread(cv::samples::findFile("aloeGT.png"), cv::IMREAD_GRAYSCALE);
+    if(left.empty() || right.empty() || truth.empty() || left.size() != truth.size()){
+        std::cout << "Could not read the aloe images" << std::endl;
         return 1;
     }
-    cv::Mat frame;
-    while(true){
-        video >> frame;
-        cv::imshow("Frame", frame);
-        char c = (char)cv::waitKey(25);
-        if(c==27) break;
+    // The aloe pair is already rectified, and its disparities go up to
+    // about 210
+    const int num_disparities = 256;
+
+    struct Method {
+        std::string name;
+        std::function<void(const cv::Mat&, const cv::Mat&, cv::Mat&)> compute;
+    };
+    std::vector<Method> methods;
+    for(bool use_sgm: { false, true }){
+        BlockMatcher::Settings settings;
+        settings.num_disparities = num_disparities;
+        settings.block_size = use_sgm ? 5 : 9;
+        settings.use_sgm = use_sgm;
+        std::shared_ptr<BlockMatcher> matcher(new BlockMatcher(settings));
+        methods.push_back({ use_sgm ? "BlockMatcher SGM, 5x5" : "BlockMatcher, 9x9",
+            [matcher](const cv::Mat &l, const cv::Mat &r, cv::Mat &disparity){
+                matcher->compute(l, r, disparity);
+            }});
+    }
+    cv::Ptr<cv::StereoBM> bm = cv::StereoBM::create(num_disparities, 9);
+    bm->setUniquenessRatio(10);
+    methods.push_back({ "cv::StereoBM, 9x9",
+        [bm](const cv::Mat &l, const cv::Mat &r, cv::Mat &disparity){
+            bm->compute(l, r, disparity);
+        }});
+    cv::Ptr<cv::StereoSGBM> sgbm = cv::StereoSGBM::create(0, num_disparities, 5, 8*25, 32*25,
+                                                          0, 31, 10);
+    methods.push_back({ "cv::StereoSGBM, 5x5",
+        [sgbm](const cv::Mat &l, const cv::Mat &r, cv::Mat &disparity){
+            sgbm->compute(l, r, disparity);
+        }});
+
+    std::cout << "aloe, " << left.cols << "x" << left.rows << ", " << num_disparities
+              << " disparities" << std::endl;
+    double searched = (double)left.total()*num_disparities;
+    for(const Method &method: methods){
+        cv::Mat disparity;
+        method.compute(left, right, disparity);
+        const int repeats = 5;
+        int64 start = cv::getTickCount();
+        for(int k = 0; k < repeats; k++){
+            method.compute(left, right, disparity);
+        }
+        double ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency()/repeats;
+        double mean_error, bad, coverage;
+        disparityError(disparity, truth, mean_error, bad, coverage);
+        std::cout << "  " << method.name << ": " << ms << " ms, "
+                  << searched/ms/1000 << " Mdisparities/s, coverage " << coverage
+                  << ", mean error " << mean_error << " px, " << bad << " more than 2 px out"
+                  << std::endl;
+    }
+
+    if(!rectifier.empty()){
+        cv::Mat left_pair = cv::imread(cv::samples::findFile("left01.jpg"));
+        cv::Mat right_pair = cv::imread(cv::samples::findFile("right01.jpg"));
+        cv::Mat left_rectified, right_rectified;
+        rectifier.rectify(left_pair, right_pair, left_rectified, right_rectified);
+        const int repeats = 50;
+        int64 start = cv::getTickCount();
+        for(int k = 0; k < repeats; k++){
+            rectifier.rectify(left_pair, right_pair, left_rectified, right_rectified);
+        }
+        double ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency()/repeats;
+        std::cout << "Rectifying a " << left_pair.cols << "x" << left_pair.rows << " pair: "
+                  << ms << " ms, fixed point maps " << rectifier.get_map_bytes()/1024
+                  << " KiB" << std::endl;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    cv::CommandLineParser parser(argc, argv, std::string(FrameLoop::keys) +
+        "{right|images:data/right??.jpg|frame source for the right camera}"
+        "{side_by_side||the source has both cameras side by side in each frame}"
+        "{calibration|stereo_calib.xml|list of chessboard pairs to find the camera poses from}"
+        "{intrinsics|intrinsics.yml|camera matrices and distortion of both cameras}"
+        "{rectified||the pairs are already rectified, skip calibration}"
+        "{disparities|64|disparities to search, a multiple of 16}"
+        "{block|9|block size, odd}"
+        "{sgm||aggregate the block costs semi-globally}"
+        "{evaluate||time the block matchers on the aloe pair and compare with its ground truth}");
+    if(parser.has("help")){
+        parser.printMessage();
+        return 0;
+    }
+
+    StereoRectifier rectifier;
+    if(!parser.has("rectified")){
+        StereoCalibration calibration;
+        if(calibrate(parser.get<std::string>("calibration"),
+                     parser.get<std::string>("intrinsics"), calibration)){
+            rectifier.init(calibration);
+        }else{
+            std::cout << "Matching without rectification" << std::endl;
+        }
+    }
+    if(parser.has("evaluate")){
+        return evaluate(rectifier);
+    }
+
+    // The two cameras are read together in the capture stage and packed side
+    // by side, so dropping frames with --pipeline --drop keeps them paired
+    std::string left_spec = parser.has("source") ?
+        parser.get<std::string>("source") : "images:data/left??.jpg";
+    std::unique_ptr<FrameSource> source = openFrameSource(left_spec);
+    if(!parser.has("side_by_side")){
+        std::unique_ptr<FrameSource> right_source =
+            openFrameSource(parser.get<std::string>("right"));
+        if(!right_source || !right_source->isOpened()){
+            std::cout << "Could not open the right frame source." << std::endl;
+            return 1;
+        }
+        if(source){
+            source.reset(new SideBySideSource(std::move(source), std::move(right_source)));
+        }
     }
+    FrameLoop loop(parser, std::move(source));
+    if(!loop.isOpened()){
+        std::cout << "Could not open frame source." << std::endl;
+        return 1;
+    }
+
+    BlockMatcher::Settings settings;
+    settings.num_disparities = parser.get<int>("disparities");
+    settings.block_size = parser.get<int>("block");
+    settings.use_sgm = parser.has("sgm");
+    BlockMatcher matcher(settings);
+
+    cv::Mat left_gray, right_gray, left_rectified, right_rectified, disparity;
+    loop.run("Disparity", 25,
+        [&](const cv::Mat &frame, cv::Mat &result) {
+            cv::Mat left_frame = frame.colRange(0, frame.cols/2);
+            cv::Mat right_frame = frame.colRange(frame.cols/2, frame.cols/2*2);
+            {
+                TRACE_SCOPE("rectify");
+                if(left_frame.channels() == 3){
+                    cv::cvtColor(left_frame, left_gray, cv::COLOR_BGR2GRAY);
+                }else{
+                    left_gray = left_frame;
+                }
+                if(right_frame.channels() == 3){
+                    cv::cvtColor(right_frame, right_gray, cv::COLOR_BGR2GRAY);
+                }else{
+                    right_gray = right_frame;
+                }
+                if(!rectifier.empty() && left_gray.size() == rectifier.get_size()){
+                    rectifier.rectify(left_gray, right_gray, left_rectified, right_rectified);
+                }else{
+                    left_rectified = left_gray;
+                    right_rectified = right_gray;
+                }
+            }
+            {
+                TRACE_SCOPE("match");
+                matcher.compute(left_rectified, right_rectified, disparity);
+            }
+            colourDisparity(disparity, settings.num_disparities, result);
+        },
+        [&](int key) {
+            return (char)key != 27;
+        });
+    loop.report(std::cout);
     return 0;
 }
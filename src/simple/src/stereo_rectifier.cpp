@@ -0,0 +1,87 @@
+#include "stereo_rectifier.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/calib3d.hpp>
+
+bool StereoCalibration::readIntrinsics(const std::string &path){
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened()) return false;
+    fs["M1"] >> M1;
+    fs["D1"] >> D1;
+    fs["M2"] >> M2;
+    fs["D2"] >> D2;
+    return !M1.empty() && !M2.empty();
+}
+
+double StereoCalibration::calibrateExtrinsics(const std::vector<std::string> &image_list,
+                                              cv::Size pattern_size, float square_size)
+{
+    std::vector<cv::Point3f> board;
+    for (int i = 0; i < pattern_size.height; i++) {
+        for (int j = 0; j < pattern_size.width; j++) {
+            board.push_back(cv::Point3f(j*square_size, i*square_size, 0));
+        }
+    }
+
+    std::vector<std::vector<cv::Point3f>> object_points;
+    std::vector<std::vector<cv::Point2f>> left_points, right_points;
+    int flags = cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE;
+    cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01);
+    for (std::size_t i = 0; i + 1 < image_list.size(); i += 2) {
+        cv::Mat left = cv::imread(image_list[i], cv::IMREAD_GRAYSCALE);
+        cv::Mat right = cv::imread(image_list[i + 1], cv::IMREAD_GRAYSCALE);
+        if (left.empty() || right.empty() || left.size() != right.size()) continue;
+        if (size.area() > 0 && left.size() != size) continue;
+
+        std::vector<cv::Point2f> left_corners, right_corners;
+        if (!cv::findChessboardCorners(left, pattern_size, left_corners, flags)) continue;
+        if (!cv::findChessboardCorners(right, pattern_size, right_corners, flags)) continue;
+        cv::cornerSubPix(left, left_corners, cv::Size(11, 11), cv::Size(-1, -1), criteria);
+        cv::cornerSubPix(right, right_corners, cv::Size(11, 11), cv::Size(-1, -1), criteria);
+        size = left.size();
+        object_points.push_back(board);
+        left_points.push_back(left_corners);
+        right_points.push_back(right_corners);
+    }
+    if (object_points.size() < 3) return -1;
+
+    cv::Mat E, F;
+    return cv::stereoCalibrate(object_points, left_points, right_points,
+                               M1, D1, M2, D2, size, R, T, E, F,
+                               cv::CALIB_FIX_INTRINSIC);
+}
+
+void StereoRectifier::init(const StereoCalibration &calibration, double alpha){
+    size = calibration.size;
+    cv::Mat R1, R2, P1, P2;
+    cv::stereoRectify(calibration.M1, calibration.D1, calibration.M2, calibration.D2,
+                      calibration.size, calibration.R, calibration.T,
+                      R1, R2, P1, P2, Q, cv::CALIB_ZERO_DISPARITY, alpha);
+
+    // Built as floats, then packed into the fixed point form for remap
+    cv::Mat map_x, map_y;
+    cv::initUndistortRectifyMap(calibration.M1, calibration.D1, R1, P1, calibration.size,
+                                CV_32FC1, map_x, map_y);
+    cv::convertMaps(map_x, map_y, left_maps[0], left_maps[1], CV_16SC2);
+    cv::initUndistortRectifyMap(calibration.M2, calibration.D2, R2, P2, calibration.size,
+                                CV_32FC1, map_x, map_y);
+    cv::convertMaps(map_x, map_y, right_maps[0], right_maps[1], CV_16SC2);
+}
+
+void StereoRectifier::rectify(const cv::Mat &left, const cv::Mat &right,
+                              cv::Mat &left_rectified, cv::Mat &right_rectified)const
+{
+    CV_Assert(!empty());
+    cv::remap(left, left_rectified, left_maps[0], left_maps[1], cv::INTER_LINEAR);
+    cv::remap(right, right_rectified, right_maps[0], right_maps[1], cv::INTER_LINEAR);
+}
+
+std::size_t StereoRectifier::get_map_bytes()const{
+    std::size_t bytes = 0;
+    for (int i = 0; i < 2; i++) {
+        bytes += left_maps[i].total()*left_maps[i].elemSize();
+        bytes += right_maps[i].total()*right_maps[i].elemSize();
+    }
+    return bytes;
+}
@@ -0,0 +1,292 @@
+#include "template_matcher.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Sum of (a - b)^2 over n pixels
+static int rowSsd(const uchar *a, const uchar *b, int n) {
+    int j = 0, sum = 0;
+#if CV_SIMD128
+    cv::v_int32x4 acc = cv::v_setzero_s32();
+    for (; j <= n - 8; j += 8) {
+        cv::v_int16x8 d = cv::v_reinterpret_as_s16(cv::v_load_expand(a + j)) -
+            cv::v_reinterpret_as_s16(cv::v_load_expand(b + j));
+        acc += cv::v_dotprod(d, d);
+    }
+    sum = cv::v_reduce_sum(acc);
+#endif
+    for (; j < n; j++) {
+        int d = a[j] - b[j];
+        sum += d*d;
+    }
+    return sum;
+}
+
+// Sum of a*b over n pixels
+static int rowDot(const uchar *a, const uchar *b, int n) {
+    int j = 0, sum = 0;
+#if CV_SIMD128
+    cv::v_int32x4 acc = cv::v_setzero_s32();
+    for (; j <= n - 8; j += 8) {
+        acc += cv::v_dotprod(cv::v_reinterpret_as_s16(cv::v_load_expand(a + j)),
+                             cv::v_reinterpret_as_s16(cv::v_load_expand(b + j)));
+    }
+    sum = cv::v_reduce_sum(acc);
+#endif
+    for (; j < n; j++) {
+        sum += a[j]*b[j];
+    }
+    return sum;
+}
+
+static void toGray(const cv::Mat &image, cv::Mat &gray) {
+    CV_Assert(image.depth() == CV_8U);
+    if (image.channels() == 1) {
+        gray = image;
+    } else {
+        cv::cvtColor(image, gray,
+                     image.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+    }
+}
+
+static double square(double x) {
+    return x*x;
+}
+
+// Sum over the rows [y0, y1) and columns [x, x + w) of an integral image
+template <typename T>
+static double rectSum(const cv::Mat &integral, int x, int y0, int y1, int w) {
+    const T *a = integral.ptr<T>(y0), *b = integral.ptr<T>(y1);
+    return (double)b[x + w] - b[x] - a[x + w] + a[x];
+}
+
+TemplateMatcher::TemplateMatcher(const Settings &settings):
+    settings(settings), stats()
+{
+    CV_Assert(settings.max_levels >= 0 && settings.candidates > 0 && settings.refine_radius >= 0);
+}
+
+int TemplateMatcher::add(const cv::Mat &templ) {
+    cv::Mat gray;
+    toGray(templ, gray);
+    CV_Assert(!gray.empty());
+
+    std::vector<Level> levels;
+    cv::Mat image = gray.clone();
+    for (int l = 0; l <= settings.max_levels; l++) {
+        if (l > 0) {
+            if (std::min(image.cols, image.rows)/2 < settings.min_size) break;
+            cv::Mat smaller;
+            cv::pyrDown(image, smaller);
+            image = smaller;
+        }
+        Level level;
+        level.image = image;
+        const int w = image.cols, h = image.rows;
+        std::vector<double> row_sum(h), row_sq(h);
+        level.sum = 0;
+        for (int r = 0; r < h; r++) {
+            const uchar *row = image.ptr<uchar>(r);
+            row_sum[r] = 0;
+            row_sq[r] = rowDot(row, row, w);
+            for (int j = 0; j < w; j++) {
+                row_sum[r] += row[j];
+            }
+            level.sum += row_sum[r];
+        }
+        level.mean = level.sum/((double)w*h);
+
+        // For NCC the template less its mean, T' = T - mean
+        const bool centred = settings.method == NCC;
+        level.rest_sum.assign(h + 1, 0);
+        level.rest_sq.assign(h + 1, 0);
+        for (int r = h - 1; r >= 0; r--) {
+            double sum = row_sum[r], sq = row_sq[r];
+            if (centred) {
+                sq += w*level.mean*level.mean - 2*level.mean*sum;
+                sum -= w*level.mean;
+            }
+            level.rest_sum[r] = level.rest_sum[r + 1] + sum;
+            level.rest_sq[r] = level.rest_sq[r + 1] + std::max(0.0, sq);
+        }
+        level.norm = std::sqrt(level.rest_sq[0]);
+        levels.push_back(level);
+    }
+    templates.push_back(levels);
+    return (int)templates.size() - 1;
+}
+
+double TemplateMatcher::cost(const FrameLevel &frame, const Level &level, cv::Point p,
+                             double threshold, Stats &counts)const {
+    const int w = level.image.cols, h = level.image.rows;
+    const double n = (double)w*h;
+    const double s = rectSum<int>(frame.sum, p.x, p.y, p.y + h, w);
+    const double s2 = rectSum<double>(frame.sqsum, p.x, p.y, p.y + h, w);
+    counts.windows++;
+
+    if (settings.method == SSD) {
+        // |I - T| >= ||I| - |T||, and by Cauchy-Schwarz with a window of
+        // ones, |I - T|^2 >= (sum I - sum T)^2/n
+        double bound = std::max(square(std::sqrt(s2) - level.norm), square(s - level.sum)/n);
+        if (bound >= threshold) {
+            counts.bound_pruned++;
+            return threshold;
+        }
+        double total = 0;
+        for (int r = 0; r < h; r++) {
+            total += rowSsd(frame.image.ptr<uchar>(p.y + r) + p.x, level.image.ptr<uchar>(r), w);
+            // The rows left can't add less than ||I_rest| - |T_rest||^2
+            double rest = r + 1 < h ?
+                square(std::sqrt(rectSum<double>(frame.sqsum, p.x, p.y + r + 1, p.y + h, w)) -
+                       std::sqrt(level.rest_sq[r + 1])) : 0;
+            if (total + rest >= threshold) {
+                counts.partial_pruned++;
+                return threshold;
+            }
+        }
+        return total;
+    }
+
+    // NCC = sum (I - mean_I) T' / (|I - mean_I| |T'|) = sum I T' / denominator,
+    // since T' sums to 0, and sum I T' = sum I T - mean_T sum I
+    const double variance = s2 - s*s/n;
+    if (variance <= 1e-6*n || level.norm <= 0) return 1;
+    const double denominator = std::sqrt(variance)*level.norm;
+    const double mean = s/n;
+    double cross = 0;
+    for (int r = 0; r < h; r++) {
+        if (r > 0) {
+            // Over the rows left, sum I T' = sum (I - mean_I) T' + mean_I sum T'
+            // and the first is at most |I_rest - mean_I| |T'_rest|
+            double done = rectSum<int>(frame.sum, p.x, p.y, p.y + r, w);
+            double rest_s = s - done;
+            double rest_s2 = rectSum<double>(frame.sqsum, p.x, p.y + r, p.y + h, w);
+            double rest_n = (double)(h - r)*w;
+            double rest_var = std::max(0.0, rest_s2 - 2*mean*rest_s + rest_n*mean*mean);
+            double upper = cross - level.mean*done + mean*level.rest_sum[r] +
+                std::sqrt(rest_var*level.rest_sq[r]);
+            if (1 - upper/denominator >= threshold) {
+                counts.partial_pruned++;
+                return threshold;
+            }
+        }
+        cross += rowDot(frame.image.ptr<uchar>(p.y + r) + p.x, level.image.ptr<uchar>(r), w);
+    }
+    return 1 - (cross - level.mean*s)/denominator;
+}
+
+void TemplateMatcher::insertCandidate(std::vector<Candidate> &best, const Candidate &candidate,
+                                      int keep, int spacing) {
+    for (std::size_t i = 0; i < best.size(); ) {
+        cv::Point d = best[i].location - candidate.location;
+        if (std::max(std::abs(d.x), std::abs(d.y)) >= spacing) {
+            i++;
+        } else if (best[i].cost <= candidate.cost) {
+            return;
+        } else {
+            best.erase(best.begin() + i);
+        }
+    }
+    auto at = std::upper_bound(best.begin(), best.end(), candidate,
+        [](const Candidate &a, const Candidate &b) {
+            return a.cost < b.cost;
+        });
+    best.insert(at, candidate);
+    if ((int)best.size() > keep) best.pop_back();
+}
+
+void TemplateMatcher::search(const FrameLevel &frame, const Level &level, cv::Rect positions,
+                             std::vector<Candidate> &best, int keep, int spacing,
+                             Stats &counts)const {
+    for (int y = positions.y; y < positions.y + positions.height; y++) {
+        for (int x = positions.x; x < positions.x + positions.width; x++) {
+            double threshold = (int)best.size() < keep ?
+                std::numeric_limits<double>::infinity() : best.back().cost;
+            Candidate candidate;
+            candidate.location = cv::Point(x, y);
+            candidate.cost = cost(frame, level, candidate.location, threshold, counts);
+            if (candidate.cost < threshold) insertCandidate(best, candidate, keep, spacing);
+        }
+    }
+}
+
+void TemplateMatcher::match(const cv::Mat &frame, std::vector<TemplateMatch> &matches) {
+    CV_Assert(!frame.empty());
+    stats = Stats();
+    const int num = (int)templates.size();
+    TemplateMatch none;
+    none.location = cv::Point(-1, -1);
+    none.score = 0;
+    matches.assign(num, none);
+    if (num == 0) return;
+
+    std::size_t levels = 0;
+    for (const std::vector<Level> &t: templates) {
+        levels = std::max(levels, t.size());
+    }
+    pyramid.resize(levels);
+    toGray(frame, pyramid[0].image);
+    for (std::size_t l = 1; l < levels; l++) {
+        cv::pyrDown(pyramid[l - 1].image, pyramid[l].image);
+    }
+    for (FrameLevel &level: pyramid) {
+        cv::integral(level.image, level.sum, level.sqsum, CV_32S, CV_64F);
+    }
+
+    std::vector<Stats> counts(num, Stats());
+    cv::parallel_for_(cv::Range(0, num), [&](const cv::Range &range) {
+        for (int t = range.start; t < range.end; t++) {
+            const std::vector<Level> &levels = templates[t];
+            auto fits = [&](int l) {
+                return levels[l].image.cols <= pyramid[l].image.cols &&
+                    levels[l].image.rows <= pyramid[l].image.rows;
+            };
+            // Rounding in pyrDown can leave a template fitting a level but
+            // not the one below
+            int top = -1;
+            while (top + 1 < (int)levels.size() && fits(top + 1)) top++;
+            if (top < 0) continue;
+
+            auto valid = [&](int l) {
+                return cv::Rect(0, 0, pyramid[l].image.cols - levels[l].image.cols + 1,
+                                pyramid[l].image.rows - levels[l].image.rows + 1);
+            };
+            std::vector<Candidate> best;
+            const Level &coarse = levels[top];
+            int spacing = std::max(1, std::min(coarse.image.cols, coarse.image.rows)/2);
+            search(pyramid[top], coarse, valid(top), best, top > 0 ? settings.candidates : 1,
+                   spacing, counts[t]);
+
+            // Each candidate followed down to full size, where it has to
+            // beat the best so far
+            std::vector<Candidate> winner;
+            if (top == 0) winner = best;
+            const int r = settings.refine_radius;
+            for (std::size_t c = 0; top > 0 && c < best.size(); c++) {
+                cv::Point p = best[c].location;
+                for (int l = top - 1; l >= 0; l--) {
+                    std::vector<Candidate> refined;
+                    if (l == 0) refined = winner;
+                    cv::Rect around(2*p.x - r, 2*p.y - r, 2*r + 1, 2*r + 1);
+                    search(pyramid[l], levels[l], around & valid(l), refined, 1, 0, counts[t]);
+                    if (l == 0) {
+                        winner = refined;
+                    } else if (!refined.empty()) {
+                        p = refined[0].location;
+                    }
+                }
+            }
+            if (winner.empty()) continue;
+            matches[t].location = winner[0].location;
+            matches[t].score = settings.method == SSD ? winner[0].cost : 1 - winner[0].cost;
+        }
+    });
+    for (const Stats &c: counts) {
+        stats.windows += c.windows;
+        stats.bound_pruned += c.bound_pruned;
+        stats.partial_pruned += c.partial_pruned;
+    }
+}
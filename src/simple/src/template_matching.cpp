@@ -0,0 +1,149 @@
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "template_matcher.h"
+
+// A template to find, and where it came from if it's a crop of the frame
+struct TestTemplate {
+    std::string name;
+    cv::Mat image;
+    cv::Point truth;
+};
+
+// The best window from cv::matchTemplate, at full resolution
+static TemplateMatch matchFull(const cv::Mat &frame, const cv::Mat &templ,
+                               TemplateMatcher::Method method) {
+    TemplateMatch match;
+    match.location = cv::Point(-1, -1);
+    match.score = 0;
+    if (templ.cols > frame.cols || templ.rows > frame.rows) return match;
+    cv::Mat result;
+    double min_score, max_score;
+    cv::Point min_location, max_location;
+    if (method == TemplateMatcher::SSD) {
+        cv::matchTemplate(frame, templ, result, cv::TM_SQDIFF);
+        cv::minMaxLoc(result, &min_score, 0, &min_location, 0);
+        match.location = min_location;
+        match.score = min_score;
+    } else {
+        cv::matchTemplate(frame, templ, result, cv::TM_CCOEFF_NORMED);
+        cv::minMaxLoc(result, 0, &max_score, 0, &max_location);
+        match.location = max_location;
+        match.score = max_score;
+    }
+    return match;
+}
+
+int main(int argc, char** argv){
+    cv::CommandLineParser parser(argc, argv,
+        "{help h||}"
+        "{image|lena.jpg|frame to search}"
+        "{templates|templ.png,tmpl.png,lena_tmpl.jpg|templates to look for}"
+        "{crops|8|random crops of the frame (with noise) to look for as well}"
+        "{noise|4|standard deviation of the noise added to the crops}"
+        "{method|ncc|ssd or ncc}"
+        "{levels|4|pyramid levels above full size}"
+        "{candidates|4|windows followed down from the coarsest level}"
+        "{repeats|20|times each search is run for the timings}"
+        "{seed|1|for the crops}");
+    if(parser.has("help")){
+        parser.printMessage();
+        return 0;
+    }
+    cv::samples::addSamplesDataSearchPath("data");
+
+    cv::Mat frame = cv::imread(cv::samples::findFile(parser.get<std::string>("image")),
+                               cv::IMREAD_GRAYSCALE);
+    if(frame.empty()){
+        std::cout << "Could not read the image." << std::endl;
+        return 1;
+    }
+
+    std::vector<TestTemplate> tests;
+    std::stringstream list(parser.get<std::string>("templates"));
+    std::string name;
+    while(std::getline(list, name, ',')){
+        TestTemplate test;
+        test.name = name;
+        test.image = cv::imread(cv::samples::findFile(name, false), cv::IMREAD_GRAYSCALE);
+        test.truth = cv::Point(-1, -1);
+        if(test.image.empty()){
+            std::cout << "Could not read " << name << ", skipping it." << std::endl;
+            continue;
+        }
+        tests.push_back(test);
+    }
+    cv::RNG rng(parser.get<int>("seed"));
+    const int crops = parser.get<int>("crops");
+    for(int i = 0; i < crops; i++){
+        cv::Size size(rng.uniform(24, 97), rng.uniform(24, 97));
+        if(size.width > frame.cols || size.height > frame.rows) continue;
+        TestTemplate test;
+        test.truth = cv::Point(rng.uniform(0, frame.cols - size.width + 1),
+                               rng.uniform(0, frame.rows - size.height + 1));
+        test.name = cv::format("crop %dx%d", size.width, size.height);
+        cv::Mat noisy, noise(size, CV_16S);
+        frame(cv::Rect(test.truth, size)).convertTo(noisy, CV_16S);
+        rng.fill(noise, cv::RNG::NORMAL, 0, parser.get<double>("noise"));
+        (noisy + noise).convertTo(test.image, CV_8U);
+        tests.push_back(test);
+    }
+
+    TemplateMatcher::Settings settings;
+    settings.method = parser.get<std::string>("method") == "ssd" ?
+        TemplateMatcher::SSD : TemplateMatcher::NCC;
+    settings.max_levels = parser.get<int>("levels");
+    settings.candidates = parser.get<int>("candidates");
+    TemplateMatcher matcher(settings);
+    for(const TestTemplate &test: tests){
+        matcher.add(test.image);
+    }
+
+    const int repeats = std::max(1, parser.get<int>("repeats"));
+    std::vector<TemplateMatch> matches;
+    int64 start = cv::getTickCount();
+    for(int i = 0; i < repeats; i++){
+        matcher.match(frame, matches);
+    }
+    double pyramid_ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency()/repeats;
+
+    std::vector<TemplateMatch> full(tests.size());
+    start = cv::getTickCount();
+    for(int i = 0; i < repeats; i++){
+        for(std::size_t t = 0; t < tests.size(); t++){
+            full[t] = matchFull(frame, tests[t].image, settings.method);
+        }
+    }
+    double full_ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency()/repeats;
+
+    int agree = 0;
+    for(std::size_t t = 0; t < tests.size(); t++){
+        const TemplateMatch &a = matches[t], &b = full[t];
+        bool same = std::abs(a.location.x - b.location.x) <= 1 &&
+            std::abs(a.location.y - b.location.y) <= 1;
+        if(same) agree++;
+        std::cout << tests[t].name << " (" << tests[t].image.cols << "x" << tests[t].image.rows
+                  << "): pyramid " << a.location << " " << a.score << ", matchTemplate "
+                  << b.location << " " << b.score;
+        if(tests[t].truth.x >= 0) std::cout << ", cut from " << tests[t].truth;
+        std::cout << (same ? "" : "  DIFFERENT") << std::endl;
+    }
+
+    const TemplateMatcher::Stats &stats = matcher.get_stats();
+    std::cout << std::endl << agree << " of " << tests.size()
+              << " templates found within a pixel of matchTemplate" << std::endl;
+    std::cout << "Pyramid matcher: " << pyramid_ms << " ms a frame ("
+              << 1000.0*tests.size()/pyramid_ms << " templates/s), "
+              << stats.windows << " windows, " << stats.bound_pruned
+              << " ruled out from the integral images, " << stats.partial_pruned
+              << " stopped part way" << std::endl;
+    std::cout << "matchTemplate:   " << full_ms << " ms a frame ("
+              << 1000.0*tests.size()/full_ms << " templates/s)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include "trace.h"
+
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+// Recent events of one thread. Only that thread writes; anyone may read.
+// The fields are atomics (relaxed, so plain moves on x86) so that a reader
+// racing with the writer is well defined, and written is bumped after the
+// event is complete.
+struct TraceBuffer {
+    static const std::size_t capacity = 1 << 15;
+
+    struct Slot {
+        std::atomic<const char*> name;
+        std::atomic<int64> start_ticks;
+        std::atomic<int64> end_ticks;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<std::uint64_t> written;
+    int thread;
+
+    explicit TraceBuffer(int thread): slots(new Slot[capacity]), written(0), thread(thread) {}
+
+    void push(const char *name, int64 start_ticks, int64 end_ticks) {
+        std::uint64_t n = written.load(std::memory_order_relaxed);
+        Slot &slot = slots[n % capacity];
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.start_ticks.store(start_ticks, std::memory_order_relaxed);
+        slot.end_ticks.store(end_ticks, std::memory_order_relaxed);
+        written.store(n + 1, std::memory_order_release);
+    }
+
+    // Appends events newer than since_ticks (all if 0), oldest first
+    void copy(std::vector<TraceEvent> &out, int64 since_ticks)const {
+        std::uint64_t end = written.load(std::memory_order_acquire);
+        std::uint64_t begin = end > capacity ? end - capacity : 0;
+        // Walk back from the newest, so a time window stops early
+        std::uint64_t first = end;
+        while (first > begin) {
+            const Slot &slot = slots[(first - 1) % capacity];
+            if (since_ticks > 0 && slot.end_ticks.load(std::memory_order_relaxed) < since_ticks) break;
+            first--;
+        }
+        std::size_t old_size = out.size();
+        for (std::uint64_t i = first; i < end; i++) {
+            const Slot &slot = slots[i % capacity];
+            TraceEvent event;
+            event.name = slot.name.load(std::memory_order_relaxed);
+            event.start_ticks = slot.start_ticks.load(std::memory_order_relaxed);
+            event.end_ticks = slot.end_ticks.load(std::memory_order_relaxed);
+            event.thread = thread;
+            out.push_back(event);
+        }
+        // Drop anything the writer lapped while we were copying. It may be
+        // part way through rewriting slot now % capacity, which held event
+        // now - capacity, so that one goes too.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        std::uint64_t now = written.load(std::memory_order_relaxed);
+        if (now >= capacity && now - capacity >= first) {
+            std::size_t lapped = (std::size_t)std::min<std::uint64_t>(now - capacity + 1 - first,
+                                                                      end - first);
+            out.erase(out.begin() + old_size, out.begin() + old_size + lapped);
+        }
+    }
+};
+
+// Buffers are only added (once per thread) and never freed, so events from
+// threads which have finished can still be reported
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<TraceBuffer>> registry;
+
+TraceBuffer &threadBuffer() {
+    thread_local TraceBuffer *buffer = nullptr;
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.emplace_back(new TraceBuffer((int)registry.size()));
+        buffer = registry.back().get();
+    }
+    return *buffer;
+}
+
+std::vector<TraceEvent> collect(int64 since_ticks) {
+    std::vector<TraceEvent> events;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const std::unique_ptr<TraceBuffer> &buffer: registry) {
+        buffer->copy(events, since_ticks);
+    }
+    return events;
+}
+
+double ticksToMs(int64 ticks) {
+    return 1000.0*ticks/cv::getTickFrequency();
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[(std::size_t)(p*(sorted.size() - 1) + 0.5)];
+}
+
+}
+
+void Trace::record(const char *name, int64 start_ticks, int64 end_ticks) {
+#if SIMPLE_TRACE
+    threadBuffer().push(name, start_ticks, end_ticks);
+#endif
+}
+
+std::vector<TraceEvent> Trace::events() {
+    std::vector<TraceEvent> events = collect(0);
+    std::stable_sort(events.begin(), events.end(), [](const TraceEvent &a, const TraceEvent &b) {
+        return a.start_ticks < b.start_ticks;
+    });
+    return events;
+}
+
+std::vector<StageStats> Trace::stats(double window_seconds) {
+    int64 since = 0;
+    if (window_seconds > 0) {
+        since = cv::getTickCount() - (int64)(window_seconds*cv::getTickFrequency());
+    }
+    // Keyed by name rather than pointer, the same literal can have several
+    // addresses
+    std::map<std::string, std::vector<double>> durations;
+    for (const TraceEvent &event: collect(since)) {
+        durations[event.name].push_back(ticksToMs(event.end_ticks - event.start_ticks));
+    }
+    std::vector<StageStats> stats;
+    for (auto &entry: durations) {
+        std::vector<double> &ms = entry.second;
+        std::sort(ms.begin(), ms.end());
+        double sum = 0;
+        for (double d: ms) sum += d;
+        StageStats stage;
+        stage.name = entry.first;
+        stage.count = ms.size();
+        stage.mean_ms = sum/ms.size();
+        stage.p50_ms = percentile(ms, 0.5);
+        stage.p95_ms = percentile(ms, 0.95);
+        stage.p99_ms = percentile(ms, 0.99);
+        stage.max_ms = ms.back();
+        stats.push_back(stage);
+    }
+    return stats;
+}
+
+void Trace::report(std::ostream &os) {
+    std::vector<StageStats> stats = Trace::stats();
+    if (stats.empty()) return;
+    os << "Stage ms (count: mean, p50, p95, p99, max):" << std::endl;
+    for (const StageStats &stage: stats) {
+        os << "  " << stage.name << " (" << stage.count << "): " << stage.mean_ms
+           << ", " << stage.p50_ms << ", " << stage.p95_ms << ", " << stage.p99_ms
+           << ", " << stage.max_ms << std::endl;
+    }
+}
+
+void Trace::drawOverlay(cv::Mat &image, double window_seconds) {
+#if SIMPLE_TRACE
+    if (image.channels() == 1) {
+        cv::cvtColor(image, image, cv::COLOR_GRAY2BGR);
+    }
+    std::vector<std::string> lines;
+    for (const StageStats &stage: stats(window_seconds)) {
+        if (stage.name == "frame") {
+            lines.insert(lines.begin(), cv::format("%.1f fps, latency p50 %.1f p95 %.1f p99 %.1f ms",
+                stage.count/window_seconds, stage.p50_ms, stage.p95_ms, stage.p99_ms));
+        } else {
+            lines.push_back(cv::format("%s: p50 %.2f p95 %.2f p99 %.2f ms",
+                stage.name.c_str(), stage.p50_ms, stage.p95_ms, stage.p99_ms));
+        }
+    }
+    int y = 18;
+    for (const std::string &line: lines) {
+        // Dark outline so it reads on any background
+        cv::putText(image, line, cv::Point(8, y), cv::FONT_HERSHEY_SIMPLEX, 0.45,
+                    cv::Scalar::all(0), 3, cv::LINE_AA);
+        cv::putText(image, line, cv::Point(8, y), cv::FONT_HERSHEY_SIMPLEX, 0.45,
+                    cv::Scalar(0, 255, 0), 1, cv::LINE_AA);
+        y += 18;
+    }
+#endif
+}
+
+bool Trace::writeChromeTrace(const std::string &path) {
+    std::ofstream file(path);
+    if (!file) return false;
+    std::vector<TraceEvent> all = events();
+    int64 origin = all.empty() ? 0 : all.front().start_ticks;
+    const double ticks_per_us = cv::getTickFrequency()/1e6;
+    file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    for (std::size_t i = 0; i < all.size(); i++) {
+        const TraceEvent &event = all[i];
+        // Complete events ("X"), times in microseconds
+        file << (i ? ",\n" : "\n") << "{\"name\":\"" << event.name
+             << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+             << ",\"ts\":" << (event.start_ticks - origin)/ticks_per_us
+             << ",\"dur\":" << (event.end_ticks - event.start_ticks)/ticks_per_us << "}";
+    }
+    file << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+    return (bool)file;
+}
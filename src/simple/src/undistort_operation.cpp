@@ -0,0 +1,223 @@
+#include "undistort_operation.h"
+#include "fnv_hash.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SIMPLE_HAVE_MMAP 1
+#else
+#include <iterator>
+#include <vector>
+#define SIMPLE_HAVE_MMAP 0
+#endif
+
+// A whole file, read only
+struct MappedFile {
+    const uchar *data;
+    std::size_t size;
+#if SIMPLE_HAVE_MMAP
+    MappedFile(): data(0), size(0) {}
+    ~MappedFile() {
+        if (data) munmap((void*)data, size);
+    }
+    bool open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void *address = mmap(0, (std::size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                data = (const uchar*)address;
+                size = (std::size_t)info.st_size;
+            }
+        }
+        ::close(fd);
+        return data != 0;
+    }
+#else
+    // No mmap, read it in instead
+    std::vector<uchar> bytes;
+    MappedFile(): data(0), size(0) {}
+    bool open(const std::string &path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data = bytes.data();
+        size = bytes.size();
+        return size > 0;
+    }
+#endif
+};
+
+// Camera matrix, 14 distortion coefficients (padded with zeros), width
+// and height
+static const int key_length = 9 + 14 + 2;
+static const std::uint32_t cache_version = 1;
+static const char cache_magic[8] = { 'U', 'N', 'D', 'I', 'S', 'T', 'M', 'P' };
+
+struct CacheHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t header_bytes;
+    double key[key_length];
+    std::uint64_t xy_offset;     // From the start of the file
+    std::uint64_t table_offset;
+};
+
+static std::uint64_t alignUp(std::uint64_t offset) {
+    return (offset + 63) & ~(std::uint64_t)63;
+}
+
+static cv::Mat cacheKey(const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs, cv::Size size) {
+    cv::Mat key = cv::Mat::zeros(1, key_length, CV_64F);
+    cv::Mat k, d;
+    camera_matrix.convertTo(k, CV_64F);
+    dist_coeffs.convertTo(d, CV_64F);
+    CV_Assert(k.total() == 9 && d.total() <= 14);
+    std::memcpy(key.ptr<double>(), k.reshape(1, 1).ptr<double>(), 9*sizeof(double));
+    if (!d.empty()) {
+        d = d.reshape(1, 1);
+        std::memcpy(key.ptr<double>() + 9, d.ptr<double>(), d.total()*sizeof(double));
+    }
+    key.at<double>(9 + 14) = size.width;
+    key.at<double>(9 + 14 + 1) = size.height;
+    return key;
+}
+
+// 64 bit FNV-1a of the key, for the file name
+static std::string keyName(const cv::Mat &key) {
+    std::uint64_t hash = fnv1a64(key.ptr<uchar>(), key.total()*key.elemSize());
+    char name[40];
+    std::snprintf(name, sizeof(name), "undistort_%016llx.map", (unsigned long long)hash);
+    return name;
+}
+
+UndistortOperation::UndistortOperation(const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs,
+                                       cv::Size size, const std::string &cache_dir):
+    size(size), cached(false), startup_ms(0)
+{
+    int64 start = cv::getTickCount();
+    cv::Mat key = cacheKey(camera_matrix, dist_coeffs, size);
+    cache_path = (cache_dir.empty() ? std::string(".") : cache_dir) + "/" + keyName(key);
+    cached = mapCache(key);
+    if (!cached) {
+        cv::initUndistortRectifyMap(camera_matrix, dist_coeffs, cv::Mat(), camera_matrix, size,
+                                    CV_16SC2, map_xy, map_table);
+        writeCache(key);
+    }
+    startup_ms = 1000.0*(cv::getTickCount() - start)/cv::getTickFrequency();
+}
+
+bool UndistortOperation::mapCache(const cv::Mat &key) {
+    std::shared_ptr<MappedFile> file(new MappedFile());
+    if (!file->open(cache_path) || file->size < sizeof(CacheHeader)) return false;
+
+    CacheHeader header;
+    std::memcpy(&header, file->data, sizeof(header));
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+            header.version != cache_version || header.header_bytes != sizeof(CacheHeader) ||
+            std::memcmp(header.key, key.ptr<double>(), sizeof(header.key)) != 0) {
+        return false;
+    }
+    std::uint64_t xy_bytes = (std::uint64_t)size.area()*4;
+    std::uint64_t table_bytes = (std::uint64_t)size.area()*2;
+    if (header.xy_offset % 64 != 0 || header.table_offset % 64 != 0 ||
+            header.xy_offset + xy_bytes > file->size ||
+            header.table_offset + table_bytes > file->size) {
+        return false;
+    }
+
+    // Read only pages, remap never writes to its maps
+    map_xy = cv::Mat(size, CV_16SC2, (void*)(file->data + header.xy_offset));
+    map_table = cv::Mat(size, CV_16UC1, (void*)(file->data + header.table_offset));
+    mapping = file;
+    return true;
+}
+
+void UndistortOperation::writeCache(const cv::Mat &key)const {
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.header_bytes = sizeof(CacheHeader);
+    std::memcpy(header.key, key.ptr<double>(), sizeof(header.key));
+    header.xy_offset = alignUp(sizeof(CacheHeader));
+    header.table_offset = alignUp(header.xy_offset + (std::uint64_t)size.area()*4);
+
+    // Written under another name and renamed into place, so another
+    // launch never maps a half written file
+    std::string temp_path = cache_path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary);
+        if (!file) return;
+        file.write((const char*)&header, sizeof(header));
+        const char zeros[64] = {};
+        file.write(zeros, header.xy_offset - sizeof(header));
+        for (int i = 0; i < size.height; i++) {
+            file.write(map_xy.ptr<char>(i), size.width*4);
+        }
+        file.write(zeros, header.table_offset - (header.xy_offset + (std::uint64_t)size.area()*4));
+        for (int i = 0; i < size.height; i++) {
+            file.write(map_table.ptr<char>(i), size.width*2);
+        }
+        if (!file) {
+            file.close();
+            std::remove(temp_path.c_str());
+            return;
+        }
+    }
+    if (std::rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+    }
+}
+
+void UndistortOperation::undistort(const cv::Mat &image, cv::Mat &dst)const {
+    CV_Assert(image.size() == size && image.data != dst.data);
+    dst.create(size, image.type());
+    const int tile_rows = 64, tile_cols = 256;
+    int across = (size.width + tile_cols - 1)/tile_cols;
+    int down = (size.height + tile_rows - 1)/tile_rows;
+    cv::parallel_for_(cv::Range(0, across*down), [&](const cv::Range &range) {
+        for (int t = range.start; t < range.end; t++) {
+            cv::Rect tile = cv::Rect((t % across)*tile_cols, (t/across)*tile_rows,
+                                     tile_cols, tile_rows) & cv::Rect(cv::Point(0, 0), size);
+            // A view, so remap writes straight into dst
+            cv::Mat out = dst(tile);
+            cv::remap(image, out, map_xy(tile), map_table(tile), cv::INTER_LINEAR,
+                      cv::BORDER_CONSTANT);
+        }
+    });
+}
+
+bool UndistortOperation::readIntrinsics(const std::string &path, cv::Size size,
+                                        cv::Mat &camera_matrix, cv::Mat &dist_coeffs) {
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+    if (!fs.isOpened()) return false;
+    cv::FileNode k = fs["M1"], d = fs["D1"];
+    if (k.empty()) {
+        k = fs["camera_matrix"];
+        d = fs["distortion_coefficients"];
+    }
+    cv::Mat matrix;
+    k >> matrix;
+    d >> dist_coeffs;
+    if (matrix.total() != 9) return false;
+    matrix.convertTo(camera_matrix, CV_64F);
+
+    int width = (int)fs["image_width"], height = (int)fs["image_height"];
+    if (width > 0 && height > 0 && (width != size.width || height != size.height)) {
+        cv::Mat x_row = camera_matrix.row(0), y_row = camera_matrix.row(1);
+        x_row *= (double)size.width/width;
+        y_row *= (double)size.height/height;
+    }
+    return true;
+}